@@ -113,9 +113,19 @@ rb_sqlite3_aggregate_instance_destroy(sqlite3_context *ctx)
     *inst_ptr = Qnil;
 }
 
-static void
-rb_sqlite3_aggregator_step(sqlite3_context *ctx, int argc, sqlite3_value **argv)
+typedef struct {
+    sqlite3_context *ctx;
+    int argc;
+    sqlite3_value **argv;
+} aggregator_args_t;
+
+static VALUE
+rb_sqlite3_aggregator_step_body(VALUE aggregator_args_value)
 {
+    aggregator_args_t *args = (aggregator_args_t *)aggregator_args_value;
+    sqlite3_context *ctx = args->ctx;
+    int argc = args->argc;
+    sqlite3_value **argv = args->argv;
     VALUE inst = rb_sqlite3_aggregate_instance(ctx);
     VALUE handler_instance = rb_iv_get(inst, "-handler_instance");
     VALUE *params = NULL;
@@ -125,7 +135,7 @@ rb_sqlite3_aggregator_step(sqlite3_context *ctx, int argc, sqlite3_value **argv)
     int i;
 
     if (exc_status) {
-        return;
+        return Qnil;
     }
 
     if (argc == 1) {
@@ -147,12 +157,27 @@ rb_sqlite3_aggregator_step(sqlite3_context *ctx, int argc, sqlite3_value **argv)
     }
 
     rb_iv_set(inst, "-exc_status", INT2NUM(exc_status));
+
+    return Qnil;
 }
 
-/* we assume that this function is only called once per execution context */
 static void
-rb_sqlite3_aggregator_final(sqlite3_context *ctx)
+rb_sqlite3_aggregator_step(sqlite3_context *ctx, int argc, sqlite3_value **argv)
 {
+    aggregator_args_t args = { .ctx = ctx, .argc = argc, .argv = argv };
+    int exc_status;
+
+    rb_sqlite3_with_gvl(rb_sqlite3_aggregator_step_body, (VALUE)&args, &exc_status);
+
+    if (exc_status) {
+        sqlite3_result_error(ctx, "Ruby Exception occurred", -1);
+    }
+}
+
+static VALUE
+rb_sqlite3_aggregator_final_body(VALUE aggregator_args_value)
+{
+    sqlite3_context *ctx = ((aggregator_args_t *)aggregator_args_value)->ctx;
     VALUE inst = rb_sqlite3_aggregate_instance(ctx);
     VALUE handler_instance = rb_iv_get(inst, "-handler_instance");
     int exc_status = NUM2INT(rb_iv_get(inst, "-exc_status"));
@@ -173,6 +198,22 @@ rb_sqlite3_aggregator_final(sqlite3_context *ctx)
     }
 
     rb_sqlite3_aggregate_instance_destroy(ctx);
+
+    return Qnil;
+}
+
+/* we assume that this function is only called once per execution context */
+static void
+rb_sqlite3_aggregator_final(sqlite3_context *ctx)
+{
+    aggregator_args_t args = { .ctx = ctx, .argc = 0, .argv = NULL };
+    int exc_status;
+
+    rb_sqlite3_with_gvl(rb_sqlite3_aggregator_final_body, (VALUE)&args, &exc_status);
+
+    if (exc_status) {
+        sqlite3_result_error(ctx, "Ruby Exception occurred", -1);
+    }
 }
 
 /* call-seq: define_aggregator2(aggregator)
@@ -0,0 +1,349 @@
+#include <sqlite3_ruby.h>
+
+#define REQUIRE_OPEN_BLOB_STREAM(_ctxt) \
+  if (!_ctxt->blob) \
+    rb_raise(rb_path2class("SQLite3::Exception"), "cannot use a closed blob stream");
+
+VALUE cSqlite3BlobStream;
+
+static void
+blob_stream_mark(void *data)
+{
+    sqlite3BlobStreamRubyPtr ctx = (sqlite3BlobStreamRubyPtr)data;
+
+    rb_gc_mark_movable(ctx->db);
+}
+
+static void
+blob_stream_compact(void *data)
+{
+    sqlite3BlobStreamRubyPtr ctx = (sqlite3BlobStreamRubyPtr)data;
+
+    ctx->db = rb_gc_location(ctx->db);
+}
+
+static void
+blob_stream_deallocate(void *data)
+{
+    sqlite3BlobStreamRubyPtr ctx = (sqlite3BlobStreamRubyPtr)data;
+
+    if (ctx->blob) {
+        sqlite3_blob_close(ctx->blob);
+    }
+
+    xfree(data);
+}
+
+static size_t
+blob_stream_memsize(const void *data)
+{
+    const sqlite3BlobStreamRubyPtr ctx = (const sqlite3BlobStreamRubyPtr)data;
+    // NB: can't account for ctx->blob because the type is incomplete.
+    return sizeof(*ctx);
+}
+
+static const rb_data_type_t blob_stream_type = {
+    "SQLite3::BlobStream",
+    {
+        blob_stream_mark,
+        blob_stream_deallocate,
+        blob_stream_memsize,
+        blob_stream_compact,
+    },
+    0,
+    0,
+    RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_WB_PROTECTED,
+};
+
+static VALUE
+allocate(VALUE klass)
+{
+    sqlite3BlobStreamRubyPtr ctx;
+    VALUE object = TypedData_Make_Struct(klass, sqlite3BlobStreamRuby, &blob_stream_type, ctx);
+    ctx->db = Qnil;
+    return object;
+}
+
+/* Returns the open blob stream, raising if it or its database is closed. */
+static sqlite3BlobStreamRubyPtr
+blob_stream_unwrap(VALUE self, sqlite3 **db)
+{
+    sqlite3BlobStreamRubyPtr ctx;
+    sqlite3RubyPtr db_ctx;
+
+    TypedData_Get_Struct(self, sqlite3BlobStreamRuby, &blob_stream_type, ctx);
+    REQUIRE_OPEN_BLOB_STREAM(ctx);
+
+    db_ctx = sqlite3_database_unwrap(ctx->db);
+    if (!db_ctx->db) {
+        rb_raise(rb_path2class("SQLite3::Exception"), "cannot use a blob stream of a closed database");
+    }
+    *db = db_ctx->db;
+
+    return ctx;
+}
+
+/* call-seq: SQLite3::BlobStream.new(db, db_name, table, column, rowid, writable = false)
+ *
+ * Opens the BLOB (or TEXT) value stored in +column+ of the row +rowid+ of
+ * +table+ in the attached database +db_name+ ("main", "temp", or the name
+ * used in an ATTACH statement) for incremental I/O. The stream is read-only
+ * unless +writable+ is true.
+ *
+ * A blob stream cannot change the size of the value. To write a large value
+ * in chunks, first insert a zeroblob of the final size:
+ *
+ *   db.execute("insert into files (data) values (zeroblob(?))", [size])
+ *   stream = SQLite3::BlobStream.new(db, "main", "files", "data", db.last_insert_row_id, true)
+ *   io.each_chunk { |chunk| stream.write(chunk) }
+ *   stream.close
+ *
+ * See also Database#open_blob.
+ */
+static VALUE
+initialize(int argc, VALUE *argv, VALUE self)
+{
+    VALUE db, db_name, table, column, rowid, writable;
+    sqlite3BlobStreamRubyPtr ctx;
+    sqlite3RubyPtr db_ctx;
+    int status;
+
+    rb_scan_args(argc, argv, "51", &db, &db_name, &table, &column, &rowid, &writable);
+
+    TypedData_Get_Struct(self, sqlite3BlobStreamRuby, &blob_stream_type, ctx);
+    db_ctx = sqlite3_database_unwrap(db);
+
+    if (!db_ctx->db) {
+        rb_raise(rb_eArgError, "cannot open a blob stream on a closed database");
+    }
+    if (ctx->blob) {
+        rb_raise(rb_eRuntimeError, "blob stream is already open");
+    }
+
+    status = sqlite3_blob_open(
+                 db_ctx->db,
+                 StringValueCStr(db_name),
+                 StringValueCStr(table),
+                 StringValueCStr(column),
+                 (sqlite3_int64)NUM2LL(rowid),
+                 RTEST(writable) ? 1 : 0,
+                 &ctx->blob
+             );
+    CHECK(db_ctx->db, status);
+
+    RB_OBJ_WRITE(self, &ctx->db, db);
+    ctx->offset = 0;
+
+    return self;
+}
+
+/* call-seq: stream.read(length = nil, outbuf = nil)
+ *
+ * Reads up to +length+ bytes from the current position, or everything up to
+ * the end of the value if +length+ is nil, and returns them as a binary
+ * String. Like IO#read, it returns nil at the end of the value when +length+
+ * is positive. If +outbuf+ is given, the bytes are read into it instead of a
+ * new String, so a loop can stream the value through a single buffer.
+ */
+static VALUE
+stream_read(int argc, VALUE *argv, VALUE self)
+{
+    VALUE length, outbuf;
+    sqlite3BlobStreamRubyPtr ctx;
+    sqlite3 *db;
+    long len, remaining;
+
+    rb_scan_args(argc, argv, "02", &length, &outbuf);
+    ctx = blob_stream_unwrap(self, &db);
+
+    remaining = (long)sqlite3_blob_bytes(ctx->blob) - ctx->offset;
+    if (remaining < 0) { remaining = 0; }
+
+    if (NIL_P(length)) {
+        len = remaining;
+    } else {
+        len = NUM2LONG(length);
+        if (len < 0) {
+            rb_raise(rb_eArgError, "negative length %ld given", len);
+        }
+        if (len > 0 && remaining == 0) {
+            if (!NIL_P(outbuf)) { rb_str_resize(outbuf, 0); }
+            return Qnil;
+        }
+        if (len > remaining) { len = remaining; }
+    }
+
+    if (NIL_P(outbuf)) {
+        outbuf = rb_str_new(NULL, len);
+    } else {
+        StringValue(outbuf);
+        rb_str_modify(outbuf);
+        rb_str_resize(outbuf, len);
+        rb_enc_associate_index(outbuf, rb_ascii8bit_encindex());
+    }
+
+    CHECK(db, sqlite3_blob_read(ctx->blob, RSTRING_PTR(outbuf), (int)len, ctx->offset));
+    ctx->offset += (int)len;
+
+    return outbuf;
+}
+
+/* call-seq: stream.write(string)
+ *
+ * Writes the bytes of +string+ at the current position and returns the
+ * number of bytes written. Writing past the end of the value raises
+ * SQLite3::SQLException, as does writing to a read-only stream.
+ */
+static VALUE
+stream_write(VALUE self, VALUE string)
+{
+    sqlite3BlobStreamRubyPtr ctx;
+    sqlite3 *db;
+    long len;
+
+    ctx = blob_stream_unwrap(self, &db);
+
+    StringValue(string);
+    len = RSTRING_LEN(string);
+    if (len > (long)sqlite3_blob_bytes(ctx->blob) - ctx->offset) {
+        rb_raise(rb_path2class("SQLite3::SQLException"), "cannot write past the end of a blob");
+    }
+
+    CHECK(db, sqlite3_blob_write(ctx->blob, RSTRING_PTR(string), (int)len, ctx->offset));
+    ctx->offset += (int)len;
+
+    return LONG2NUM(len);
+}
+
+/* call-seq: stream.seek(offset, whence = IO::SEEK_SET)
+ *
+ * Moves the current position to +offset+, relative to the start of the value
+ * (IO::SEEK_SET or +:SET+), the current position (IO::SEEK_CUR or +:CUR+) or
+ * the end of the value (IO::SEEK_END or +:END+). Returns 0.
+ */
+static VALUE
+stream_seek(int argc, VALUE *argv, VALUE self)
+{
+    VALUE offset, whence;
+    sqlite3BlobStreamRubyPtr ctx;
+    sqlite3 *db;
+    long base, position;
+
+    rb_scan_args(argc, argv, "11", &offset, &whence);
+    ctx = blob_stream_unwrap(self, &db);
+
+    if (NIL_P(whence) || whence == INT2FIX(SEEK_SET) || whence == ID2SYM(rb_intern("SET"))) {
+        base = 0;
+    } else if (whence == INT2FIX(SEEK_CUR) || whence == ID2SYM(rb_intern("CUR"))) {
+        base = ctx->offset;
+    } else if (whence == INT2FIX(SEEK_END) || whence == ID2SYM(rb_intern("END"))) {
+        base = sqlite3_blob_bytes(ctx->blob);
+    } else {
+        rb_raise(rb_eArgError, "unknown whence: %"PRIsVALUE, rb_inspect(whence));
+    }
+
+    position = base + NUM2LONG(offset);
+    if (position < 0 || position > INT_MAX) {
+        rb_raise(rb_eArgError, "invalid position %ld", position);
+    }
+    ctx->offset = (int)position;
+
+    return INT2FIX(0);
+}
+
+/* call-seq: stream.pos
+ *
+ * Returns the current position, in bytes from the start of the value.
+ */
+static VALUE
+stream_pos(VALUE self)
+{
+    sqlite3 *db;
+    return INT2NUM(blob_stream_unwrap(self, &db)->offset);
+}
+
+/* call-seq: stream.size
+ *
+ * Returns the size of the value in bytes.
+ */
+static VALUE
+stream_size(VALUE self)
+{
+    sqlite3 *db;
+    return INT2NUM(sqlite3_blob_bytes(blob_stream_unwrap(self, &db)->blob));
+}
+
+#ifdef HAVE_SQLITE3_BLOB_REOPEN
+/* call-seq: stream.reopen(rowid)
+ *
+ * Moves the stream to the same column of the row +rowid+, and rewinds it.
+ * This is faster than opening a new stream.
+ */
+static VALUE
+stream_reopen(VALUE self, VALUE rowid)
+{
+    sqlite3BlobStreamRubyPtr ctx;
+    sqlite3 *db;
+
+    ctx = blob_stream_unwrap(self, &db);
+
+    CHECK(db, sqlite3_blob_reopen(ctx->blob, (sqlite3_int64)NUM2LL(rowid)));
+    ctx->offset = 0;
+
+    return self;
+}
+#endif
+
+/* call-seq: stream.close
+ *
+ * Closes the stream. It must not be used after being closed.
+ */
+static VALUE
+stream_close(VALUE self)
+{
+    sqlite3BlobStreamRubyPtr ctx;
+
+    TypedData_Get_Struct(self, sqlite3BlobStreamRuby, &blob_stream_type, ctx);
+    REQUIRE_OPEN_BLOB_STREAM(ctx);
+
+    sqlite3_blob_close(ctx->blob);
+    ctx->blob = NULL;
+
+    return Qnil;
+}
+
+/* call-seq: stream.closed?
+ *
+ * Returns true if the stream has been closed.
+ */
+static VALUE
+stream_closed_p(VALUE self)
+{
+    sqlite3BlobStreamRubyPtr ctx;
+
+    TypedData_Get_Struct(self, sqlite3BlobStreamRuby, &blob_stream_type, ctx);
+
+    return ctx->blob ? Qfalse : Qtrue;
+}
+
+void
+init_sqlite3_blob_stream(void)
+{
+#if 0
+    VALUE mSqlite3 = rb_define_module("SQLite3");
+#endif
+    cSqlite3BlobStream = rb_define_class_under(mSqlite3, "BlobStream", rb_cObject);
+
+    rb_define_alloc_func(cSqlite3BlobStream, allocate);
+    rb_define_method(cSqlite3BlobStream, "initialize", initialize, -1);
+    rb_define_method(cSqlite3BlobStream, "read", stream_read, -1);
+    rb_define_method(cSqlite3BlobStream, "write", stream_write, 1);
+    rb_define_method(cSqlite3BlobStream, "seek", stream_seek, -1);
+    rb_define_method(cSqlite3BlobStream, "pos", stream_pos, 0);
+    rb_define_method(cSqlite3BlobStream, "size", stream_size, 0);
+#ifdef HAVE_SQLITE3_BLOB_REOPEN
+    rb_define_method(cSqlite3BlobStream, "reopen", stream_reopen, 1);
+#endif
+    rb_define_method(cSqlite3BlobStream, "close", stream_close, 0);
+    rb_define_method(cSqlite3BlobStream, "closed?", stream_closed_p, 0);
+}
@@ -0,0 +1,17 @@
+#ifndef SQLITE3_BLOB_STREAM_RUBY
+#define SQLITE3_BLOB_STREAM_RUBY
+
+#include <sqlite3_ruby.h>
+
+struct _sqlite3BlobStreamRuby {
+    sqlite3_blob *blob;
+    VALUE db;
+    int offset;
+};
+
+typedef struct _sqlite3BlobStreamRuby sqlite3BlobStreamRuby;
+typedef sqlite3BlobStreamRuby *sqlite3BlobStreamRubyPtr;
+
+void init_sqlite3_blob_stream();
+
+#endif
@@ -1,5 +1,7 @@
 #include <sqlite3_ruby.h>
 #include <aggregator.h>
+#include <math.h>
+#include <ruby/fiber/scheduler.h>
 
 #ifdef _MSC_VER
 #pragma warning( push )
@@ -16,6 +18,158 @@
 
 VALUE cSqlite3Database;
 
+#ifdef RB_THREAD_LOCAL_SPECIFIER
+/* Set while the current thread is inside sqlite3_step() without the GVL, so
+ * that callbacks know they have to take it back before touching Ruby. */
+static RB_THREAD_LOCAL_SPECIFIER int gvl_released_p;
+#endif
+
+typedef struct {
+    sqlite3 *db;
+    sqlite3_stmt *stmt;
+    int status;
+    /* set by the unblocking function of the step */
+    volatile int interrupted;
+} step_without_gvl_args_t;
+
+#ifdef RB_THREAD_LOCAL_SPECIFIER
+/* The step the current thread is in without the GVL, if any, so that the busy
+ * handler can tell that the thread was interrupted. */
+static RB_THREAD_LOCAL_SPECIFIER step_without_gvl_args_t *current_step;
+#endif
+
+static void *
+step_without_gvl(void *data)
+{
+    step_without_gvl_args_t *args = (step_without_gvl_args_t *)data;
+
+#ifdef RB_THREAD_LOCAL_SPECIFIER
+    int was_released = gvl_released_p;
+    step_without_gvl_args_t *outer_step = current_step;
+    gvl_released_p = 1;
+    current_step = args;
+    args->status = sqlite3_step(args->stmt);
+    current_step = outer_step;
+    gvl_released_p = was_released;
+#else
+    args->status = sqlite3_step(args->stmt);
+#endif
+
+    return NULL;
+}
+
+int
+rb_sqlite3_step_released(sqlite3_stmt *stmt)
+{
+    step_without_gvl_args_t args = { .db = sqlite3_db_handle(stmt), .stmt = stmt, .status = SQLITE_INTERRUPT };
+
+    step_without_gvl(&args);
+
+    return args.status;
+}
+
+static void
+interrupt_step(void *data)
+{
+    step_without_gvl_args_t *args = (step_without_gvl_args_t *)data;
+
+    args->interrupted = 1;
+    sqlite3_interrupt(args->db);
+}
+
+int
+rb_sqlite3_step_without_gvl(sqlite3 *db, sqlite3_stmt *stmt, int offload_safe)
+{
+#ifdef RB_THREAD_LOCAL_SPECIFIER
+    step_without_gvl_args_t args = { .db = db, .stmt = stmt, .status = SQLITE_INTERRUPT };
+
+#ifdef RB_NOGVL_OFFLOAD_SAFE
+    if (offload_safe) {
+        rb_nogvl(step_without_gvl, (void *)&args, interrupt_step, (void *)&args, RB_NOGVL_OFFLOAD_SAFE);
+        return args.status;
+    }
+#endif
+    rb_thread_call_without_gvl(step_without_gvl, (void *)&args, interrupt_step, (void *)&args);
+
+    return args.status;
+#else
+    /* without thread-local storage the callbacks can't tell whether they hold
+     * the GVL, so keep it. */
+    return sqlite3_step(stmt);
+#endif
+}
+
+typedef struct {
+    VALUE (*func)(VALUE);
+    VALUE arg;
+    VALUE result;
+    int exc_status;
+} with_gvl_args_t;
+
+static void *
+call_with_gvl(void *data)
+{
+    with_gvl_args_t *args = (with_gvl_args_t *)data;
+
+    args->result = rb_protect(args->func, args->arg, &args->exc_status);
+
+    return NULL;
+}
+
+/* Calls +func+ with the GVL held. If the GVL was released for a step, it is
+ * re-acquired for the call and any exception is caught, left in rb_errinfo for
+ * Statement#step to re-raise, and reported through +exc_status+. Otherwise
+ * +func+ is called directly. */
+VALUE
+rb_sqlite3_with_gvl(VALUE (*func)(VALUE), VALUE arg, int *exc_status)
+{
+    *exc_status = 0;
+
+#ifdef RB_THREAD_LOCAL_SPECIFIER
+    if (gvl_released_p) {
+        with_gvl_args_t args = { .func = func, .arg = arg, .result = Qnil, .exc_status = 0 };
+
+        gvl_released_p = 0;
+        rb_thread_call_with_gvl(call_with_gvl, (void *)&args);
+        gvl_released_p = 1;
+
+        *exc_status = args.exc_status;
+        return args.result;
+    }
+#endif
+
+    return func(arg);
+}
+
+int
+rb_sqlite3_offload_p(sqlite3RubyPtr ctx)
+{
+    VALUE scheduler;
+
+    if (!(ctx->flags & SQLITE3_RB_DATABASE_NONBLOCKING)) { return 0; }
+
+    scheduler = rb_fiber_scheduler_current();
+    if (NIL_P(scheduler)) { return 0; }
+
+#ifdef RB_NOGVL_OFFLOAD_SAFE
+    /* the scheduler runs each step on a thread of its own */
+    if (rb_respond_to(scheduler, rb_intern("blocking_operation_wait"))) { return 0; }
+#endif
+
+    return 1;
+}
+
+int
+rb_sqlite3_ruby_callbacks_p(sqlite3RubyPtr ctx)
+{
+    if (RTEST(ctx->busy_handler) || RTEST(ctx->trace_handler) || RTEST(ctx->authorizer)) { return 1; }
+    if (RTEST(ctx->functions) && RARRAY_LEN(ctx->functions) > 0) { return 1; }
+    if (RTEST(ctx->aggregators) && RARRAY_LEN(ctx->aggregators) > 0) { return 1; }
+    if (RTEST(ctx->collations) && RHASH_SIZE(ctx->collations) > 0) { return 1; }
+
+    return 0;
+}
+
 /* See adr/2024-09-fork-safety.md */
 static void
 discard_db(sqlite3RubyPtr ctx)
@@ -129,6 +283,9 @@ database_mark(void *ctx)
     rb_gc_mark(c->trace_handler);
     rb_gc_mark(c->authorizer);
 
+    rb_gc_mark(c->stmt_cache);
+    rb_gc_mark(c->type_translators);
+
     rb_sqlite3_pin_array_and_contents(c->functions);
     pin_hash_and_contents(c->collations);
     pin_aggregators(c->aggregators);
@@ -257,6 +414,32 @@ rb_sqlite3_disable_quirk_mode(VALUE self)
 #endif
 }
 
+static int
+first_entry_i(VALUE key, VALUE value, VALUE entry)
+{
+    rb_ary_push(entry, key);
+    rb_ary_push(entry, value);
+    return ST_STOP;
+}
+
+/* Finalizes least recently used statements until there are at most +capacity+ left. */
+static void
+statement_cache_trim(sqlite3RubyPtr ctx, long capacity, int count_evictions)
+{
+    VALUE entry;
+
+    if (!ctx->stmt_cache) { return; }
+
+    entry = rb_ary_new_capa(2);
+    while ((long)RHASH_SIZE(ctx->stmt_cache) > capacity) {
+        rb_ary_clear(entry);
+        rb_hash_foreach(ctx->stmt_cache, first_entry_i, entry);
+        rb_hash_delete(ctx->stmt_cache, RARRAY_AREF(entry, 0));
+        rb_sqlite3_statement_finalize(RARRAY_AREF(entry, 1));
+        if (count_evictions) { ctx->stmt_cache_evictions++; }
+    }
+}
+
 /*
  *  Close the database and release all associated resources.
  *
@@ -274,8 +457,15 @@ sqlite3_rb_close(VALUE self)
     sqlite3RubyPtr ctx;
     TypedData_Get_Struct(self, sqlite3Ruby, &database_type, ctx);
 
+    /* cached statements would otherwise keep the connection open until they are collected */
+    statement_cache_trim(ctx, 0, 0);
     close_or_discard_db(ctx);
 
+    /* closing ended any transaction holding the in-process writer lock */
+    if (RTEST(rb_ivar_get(self, rb_intern("@writer_lock_held")))) {
+        rb_funcall(self, rb_intern("release_writer_lock"), 0);
+    }
+
     return self;
 }
 
@@ -286,6 +476,7 @@ sqlite3_rb_discard(VALUE self)
     sqlite3RubyPtr ctx;
     TypedData_Get_Struct(self, sqlite3Ruby, &database_type, ctx);
 
+    statement_cache_trim(ctx, 0, 0);
     discard_db(ctx);
 
     return self;
@@ -321,11 +512,25 @@ total_changes(VALUE self)
     return INT2NUM(sqlite3_total_changes(ctx->db));
 }
 
+typedef struct {
+    sqlite3RubyPtr ctx;
+    const char *sql;
+} trace_args_t;
+
+static VALUE
+call_trace_handler(VALUE trace_args_value)
+{
+    trace_args_t *args = (trace_args_t *)trace_args_value;
+    return rb_funcall(args->ctx->trace_handler, rb_intern("call"), 1, rb_str_new2(args->sql));
+}
+
 static void
 tracefunc(void *data, const char *sql)
 {
-    sqlite3RubyPtr ctx = (sqlite3RubyPtr)data;
-    rb_funcall(ctx->trace_handler, rb_intern("call"), 1, rb_str_new2(sql));
+    trace_args_t args = { .ctx = (sqlite3RubyPtr)data, .sql = sql };
+    int exc_status;
+
+    rb_sqlite3_with_gvl(call_trace_handler, (VALUE)&args, &exc_status);
 }
 
 /* call-seq:
@@ -356,15 +561,26 @@ trace(int argc, VALUE *argv, VALUE self)
     return self;
 }
 
+typedef struct {
+    sqlite3RubyPtr ctx;
+    int count;
+} busy_handler_args_t;
+
+static VALUE
+call_busy_handler(VALUE busy_handler_args_value)
+{
+    busy_handler_args_t *args = (busy_handler_args_t *)busy_handler_args_value;
+    return rb_funcall(args->ctx->busy_handler, rb_intern("call"), 1, INT2NUM(args->count));
+}
+
 static int
 rb_sqlite3_busy_handler(void *context, int count)
 {
-    sqlite3RubyPtr ctx = (sqlite3RubyPtr)context;
-
-    VALUE handle = ctx->busy_handler;
-    VALUE result = rb_funcall(handle, rb_intern("call"), 1, INT2NUM(count));
+    busy_handler_args_t args = { .ctx = (sqlite3RubyPtr)context, .count = count };
+    int exc_status;
+    VALUE result = rb_sqlite3_with_gvl(call_busy_handler, (VALUE)&args, &exc_status);
 
-    if (Qfalse == result) { return 0; }
+    if (exc_status || Qfalse == result) { return 0; }
 
     return 1;
 }
@@ -409,6 +625,140 @@ busy_handler(int argc, VALUE *argv, VALUE self)
     return self;
 }
 
+static void *
+busy_backoff_sleep(void *data)
+{
+    nanosleep((struct timespec *)data, NULL);
+
+    return NULL;
+}
+
+/* The longest the busy handler sleeps before checking for interrupts, in
+ * seconds. */
+#define BUSY_BACKOFF_SLICE 0.005
+
+/* Returns 1 if the connection, or the step the thread is in, was interrupted
+ * (by Database#interrupt, or by the unblocking function of the step). */
+static int
+busy_backoff_interrupted_p(sqlite3RubyPtr ctx)
+{
+#ifdef HAVE_SQLITE3_IS_INTERRUPTED
+    if (sqlite3_is_interrupted(ctx->db)) { return 1; }
+#endif
+#ifdef RB_THREAD_LOCAL_SPECIFIER
+    if (gvl_released_p) { return current_step && current_step->interrupted; }
+#endif
+
+    return rb_thread_interrupted(rb_thread_current());
+}
+
+static double
+timespec_to_seconds(const struct timespec *ts)
+{
+    return (double)ts->tv_sec + (double)ts->tv_nsec / 1e9;
+}
+
+/* Sleeps for an exponentially growing, jittered delay and retries until the
+ * deadline set by the first call of a busy wait has passed. The sleep never
+ * holds the GVL: a step that released it sleeps directly, otherwise the GVL is
+ * released for the sleep. The delay is slept in slices of at most
+ * BUSY_BACKOFF_SLICE, and a thread or connection interrupted meanwhile gives
+ * up. */
+static int
+rb_sqlite3_busy_backoff(void *context, int count)
+{
+    sqlite3RubyPtr ctx = (sqlite3RubyPtr)context;
+    struct _sqlite3BusyBackoff *backoff = &ctx->busy_backoff;
+    struct timespec now, after, delay;
+    double remaining, seconds, slept, slice;
+    int interrupted = 0;
+    unsigned int random;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (count == 0) {
+        backoff->waits++;
+        backoff->deadline = timespec_to_seconds(&now) + backoff->timeout;
+    }
+
+    remaining = backoff->deadline - timespec_to_seconds(&now);
+    if (remaining <= 0) {
+        backoff->timeouts++;
+        return 0;
+    }
+
+    seconds = ldexp(backoff->min_delay, count < 30 ? count : 30);
+    if (seconds > backoff->max_delay) { seconds = backoff->max_delay; }
+    if (backoff->jitter > 0) {
+        sqlite3_randomness((int)sizeof(random), &random);
+        seconds *= 1.0 - backoff->jitter * ((double)random / (double)UINT_MAX);
+    }
+    if (seconds > remaining) { seconds = remaining; }
+
+    for (slept = 0; slept < seconds && !interrupted; slept += slice) {
+        slice = seconds - slept < BUSY_BACKOFF_SLICE ? seconds - slept : BUSY_BACKOFF_SLICE;
+        delay.tv_sec = 0;
+        delay.tv_nsec = (long)(slice * 1e9);
+
+#ifdef RB_THREAD_LOCAL_SPECIFIER
+        if (gvl_released_p) {
+            busy_backoff_sleep(&delay);
+        } else
+#endif
+        {
+            rb_thread_call_without_gvl2(busy_backoff_sleep, (void *)&delay, RUBY_UBF_IO, NULL);
+        }
+        interrupted = busy_backoff_interrupted_p(ctx);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &after);
+    backoff->wait_time += timespec_to_seconds(&after) - timespec_to_seconds(&now);
+    backoff->retries++;
+
+    return !interrupted;
+}
+
+/* Installs the native busy handler, with times in seconds. See
+ * Database#busy_backoff. */
+static VALUE
+set_busy_backoff(VALUE self, VALUE timeout, VALUE min_delay, VALUE max_delay, VALUE jitter)
+{
+    sqlite3RubyPtr ctx;
+    TypedData_Get_Struct(self, sqlite3Ruby, &database_type, ctx);
+    REQUIRE_OPEN_DB(ctx);
+
+    ctx->busy_backoff.timeout = NUM2DBL(timeout);
+    ctx->busy_backoff.min_delay = NUM2DBL(min_delay);
+    ctx->busy_backoff.max_delay = NUM2DBL(max_delay);
+    ctx->busy_backoff.jitter = NUM2DBL(jitter);
+
+    RB_OBJ_WRITE(self, &ctx->busy_handler, Qnil);
+    CHECK(ctx->db, sqlite3_busy_handler(ctx->db, rb_sqlite3_busy_backoff, (void *)ctx));
+
+    return self;
+}
+
+/* call-seq: db.busy_stats
+ *
+ * Returns a Hash describing the time this connection spent in the busy
+ * handler installed by #busy_backoff: the number of busy +waits+, the number
+ * of +retries+ they made, the number that gave up at the deadline
+ * (+timeouts+), and the total +wait_time+ in seconds.
+ */
+static VALUE
+busy_stats(VALUE self)
+{
+    sqlite3RubyPtr ctx;
+    VALUE stats = rb_hash_new();
+    TypedData_Get_Struct(self, sqlite3Ruby, &database_type, ctx);
+
+    rb_hash_aset(stats, ID2SYM(rb_intern("waits")), SIZET2NUM(ctx->busy_backoff.waits));
+    rb_hash_aset(stats, ID2SYM(rb_intern("retries")), SIZET2NUM(ctx->busy_backoff.retries));
+    rb_hash_aset(stats, ID2SYM(rb_intern("timeouts")), SIZET2NUM(ctx->busy_backoff.timeouts));
+    rb_hash_aset(stats, ID2SYM(rb_intern("wait_time")), DBL2NUM(ctx->busy_backoff.wait_time));
+
+    return stats;
+}
+
 static int
 rb_sqlite3_statement_timeout(void *context)
 {
@@ -549,6 +899,7 @@ typedef struct {
     sqlite3_context *ctx;
     int argc;
     sqlite3_value **argv;
+    int exc_status;
 } rb_sqlite3_func_args_t;
 
 static VALUE
@@ -572,15 +923,25 @@ rb_sqlite3_func_protected(VALUE func_args_value)
     return Qnil;
 }
 
+static VALUE
+rb_sqlite3_func_call(VALUE func_args_value)
+{
+    rb_sqlite3_func_args_t *args = (rb_sqlite3_func_args_t *)func_args_value;
+
+    rb_protect(rb_sqlite3_func_protected, func_args_value, &args->exc_status);
+
+    return Qnil;
+}
+
 static void
 rb_sqlite3_func(sqlite3_context *ctx, int argc, sqlite3_value **argv)
 {
-    rb_sqlite3_func_args_t args = { .ctx = ctx, .argc = argc, .argv = argv };
+    rb_sqlite3_func_args_t args = { .ctx = ctx, .argc = argc, .argv = argv, .exc_status = 0 };
     int exc_status;
 
-    rb_protect(rb_sqlite3_func_protected, (VALUE)&args, &exc_status);
+    rb_sqlite3_with_gvl(rb_sqlite3_func_call, (VALUE)&args, &exc_status);
 
-    if (exc_status) {
+    if (exc_status || args.exc_status) {
         /* the user should never see this message, because Statement#step will
          * re-raise the exception still in rb_errinfo */
         sqlite3_result_error(ctx, "Ruby Exception occurred", -1);
@@ -720,6 +1081,25 @@ changes(VALUE self)
     return INT2NUM(sqlite3_changes(ctx->db));
 }
 
+typedef struct {
+    sqlite3RubyPtr db_ctx;
+    int action;
+    const char *a, *b, *c, *d;
+} auth_args_t;
+
+static VALUE
+call_authorizer(VALUE auth_args_value)
+{
+    auth_args_t *args = (auth_args_t *)auth_args_value;
+    VALUE action = INT2NUM(args->action);
+    VALUE a      = args->a ? rb_str_new2(args->a) : Qnil;
+    VALUE b      = args->b ? rb_str_new2(args->b) : Qnil;
+    VALUE c      = args->c ? rb_str_new2(args->c) : Qnil;
+    VALUE d      = args->d ? rb_str_new2(args->d) : Qnil;
+
+    return rb_funcall(args->db_ctx->authorizer, rb_intern("call"), 5, action, a, b, c, d);
+}
+
 static int
 rb_sqlite3_auth(
     void *ctx,
@@ -729,14 +1109,13 @@ rb_sqlite3_auth(
     const char *_c,
     const char *_d)
 {
-    sqlite3RubyPtr db_ctx = (sqlite3RubyPtr)ctx;
-    VALUE action = INT2NUM(_action);
-    VALUE a      = _a ? rb_str_new2(_a) : Qnil;
-    VALUE b      = _b ? rb_str_new2(_b) : Qnil;
-    VALUE c      = _c ? rb_str_new2(_c) : Qnil;
-    VALUE d      = _d ? rb_str_new2(_d) : Qnil;
-    VALUE result = rb_funcall(db_ctx->authorizer, rb_intern("call"), 5, action, a, b, c, d);
+    auth_args_t args = {
+        .db_ctx = (sqlite3RubyPtr)ctx, .action = _action, .a = _a, .b = _b, .c = _c, .d = _d
+    };
+    int exc_status;
+    VALUE result = rb_sqlite3_with_gvl(call_authorizer, (VALUE)&args, &exc_status);
 
+    if (exc_status) { return SQLITE_DENY; }
     if (T_FIXNUM == TYPE(result)) { return (int)NUM2INT(result); }
     if (Qtrue == result) { return SQLITE_OK; }
     if (Qfalse == result) { return SQLITE_DENY; }
@@ -796,6 +1175,331 @@ set_busy_timeout(VALUE self, VALUE timeout)
     return self;
 }
 
+/* call-seq: db.release_gvl = true
+ *
+ * When +true+, statements prepared on this database release the GVL while
+ * SQLite steps them, so one slow query does not stall every other Ruby thread.
+ * Ruby callbacks (functions, aggregators, collations, the authorizer, the busy
+ * handler and the tracer) take the GVL back before they run. Interrupting the
+ * stepping thread calls #interrupt, which aborts every statement running on
+ * this connection.
+ *
+ * Because sqlite serializes access to a connection, a connection with this
+ * enabled should not be used by several threads at once while Ruby callbacks
+ * are registered.
+ *
+ * See also Statement#release_gvl=, which overrides this per statement.
+ */
+static VALUE
+set_release_gvl(VALUE self, VALUE enable)
+{
+    sqlite3RubyPtr ctx;
+    TypedData_Get_Struct(self, sqlite3Ruby, &database_type, ctx);
+
+    if (RTEST(enable)) {
+        ctx->flags |= SQLITE3_RB_DATABASE_RELEASE_GVL;
+    } else {
+        ctx->flags &= ~SQLITE3_RB_DATABASE_RELEASE_GVL;
+    }
+
+    return enable;
+}
+
+/* call-seq: db.release_gvl?
+ *
+ * Returns +true+ if statements prepared on this database release the GVL
+ * while stepping.
+ */
+static VALUE
+release_gvl_p(VALUE self)
+{
+    sqlite3RubyPtr ctx;
+    TypedData_Get_Struct(self, sqlite3Ruby, &database_type, ctx);
+
+    return (ctx->flags & SQLITE3_RB_DATABASE_RELEASE_GVL) ? Qtrue : Qfalse;
+}
+
+/* call-seq: db.nonblocking = true
+ *
+ * When +true+, statements run from a non-blocking fiber while a fiber
+ * scheduler is set (see Fiber.set_scheduler) don't block the event loop.
+ * Each call that steps a statement (Statement#step, Statement#step_many and
+ * the others, and so #execute, #query, #execute_fast and #execute_batch) is
+ * handed to a worker thread of this connection, which steps it with the GVL
+ * released, and the fiber waits for the rows there while the scheduler runs
+ * other fibers. On Ruby versions whose scheduler provides
+ * +blocking_operation_wait+, each step is handed to the scheduler instead.
+ * Statements run outside a scheduler are not affected.
+ *
+ * #interrupt cancels a statement that a fiber is waiting for, which then
+ * raises SQLite3::InterruptException in that fiber, and a fiber that is
+ * stopped while it waits interrupts its statement before it unwinds.
+ *
+ * Ruby callbacks (functions, aggregators, the busy handler and so on) run on
+ * the worker thread. Fibers that share a connection still wait for each
+ * other in SQLite, so give each concurrent fiber its own connection, for
+ * example through SQLite3::Pool.
+ *
+ * This implies #release_gvl= for statements prepared while it is enabled.
+ */
+static VALUE
+set_nonblocking(VALUE self, VALUE enable)
+{
+    sqlite3RubyPtr ctx;
+    TypedData_Get_Struct(self, sqlite3Ruby, &database_type, ctx);
+
+    if (RTEST(enable)) {
+        ctx->flags |= SQLITE3_RB_DATABASE_NONBLOCKING;
+    } else {
+        ctx->flags &= ~SQLITE3_RB_DATABASE_NONBLOCKING;
+    }
+
+    return enable;
+}
+
+/* call-seq: db.nonblocking?
+ *
+ * Returns +true+ if statements run from a fiber scheduler are handed to a
+ * worker thread.
+ */
+static VALUE
+nonblocking_p(VALUE self)
+{
+    sqlite3RubyPtr ctx;
+    TypedData_Get_Struct(self, sqlite3Ruby, &database_type, ctx);
+
+    return (ctx->flags & SQLITE3_RB_DATABASE_NONBLOCKING) ? Qtrue : Qfalse;
+}
+
+/* Returns true if a call from the current fiber should be offloaded. */
+static VALUE
+offload_p(VALUE self)
+{
+    sqlite3RubyPtr ctx;
+    TypedData_Get_Struct(self, sqlite3Ruby, &database_type, ctx);
+
+    return rb_sqlite3_offload_p(ctx) ? Qtrue : Qfalse;
+}
+
+/* call-seq: db.dedup_text = true
+ *
+ * When +true+, statements prepared on this database return TEXT values as
+ * interned (deduplicated) frozen Strings, so that a value repeated across many
+ * rows, like a status or a country code, is a single object. This is meant for
+ * result sets dominated by columns with few distinct values.
+ *
+ * See also Statement#dedup_text=, which overrides this per statement.
+ */
+static VALUE
+set_dedup_text(VALUE self, VALUE enable)
+{
+    sqlite3RubyPtr ctx;
+    TypedData_Get_Struct(self, sqlite3Ruby, &database_type, ctx);
+
+    if (RTEST(enable)) {
+        ctx->flags |= SQLITE3_RB_DATABASE_DEDUP_TEXT;
+    } else {
+        ctx->flags &= ~SQLITE3_RB_DATABASE_DEDUP_TEXT;
+    }
+
+    return enable;
+}
+
+/* call-seq: db.dedup_text?
+ *
+ * Returns +true+ if statements prepared on this database deduplicate TEXT
+ * values.
+ */
+static VALUE
+dedup_text_p(VALUE self)
+{
+    sqlite3RubyPtr ctx;
+    TypedData_Get_Struct(self, sqlite3Ruby, &database_type, ctx);
+
+    return (ctx->flags & SQLITE3_RB_DATABASE_DEDUP_TEXT) ? Qtrue : Qfalse;
+}
+
+/* call-seq: db.type_translators = translators
+ *
+ * Sets the registry used to translate the values of result columns by their
+ * declared type (see Statement#column_decltype), or turns translation off with
+ * +nil+. Pass +true+ for TYPE_TRANSLATORS, or a Hash of type name to
+ * translator. Type names are matched case-insensitively, without any size or
+ * precision ("DECIMAL(10,2)" matches "decimal"). A translator is one of the
+ * built-in ones, which run in C as rows are stepped:
+ *
+ * - +:time+: ISO-8601 TEXT (as produced by SQLite's date and time functions)
+ *   or INTEGER Unix time to Time. Times without an offset are UTC.
+ * - +:date+: "YYYY-MM-DD" TEXT to Date.
+ * - +:boolean+: numbers, and TEXT such as "t", "true", "f" and "false", to
+ *   +true+ or +false+.
+ * - +:decimal+: numbers and numeric TEXT to BigDecimal. REAL values go through
+ *   their shortest decimal form (Float#to_s). Note that columns declared
+ *   DECIMAL have NUMERIC affinity, so SQLite stores most numeric text as REAL.
+ *   The bigdecimal gem is required when this translator is set, so a missing
+ *   gem raises LoadError here rather than while rows are stepped.
+ * - +:json+: JSON TEXT, or a BLOB in SQLite's JSONB format, to the Hash,
+ *   Array, String, number, boolean or +nil+ it encodes. Object keys are
+ *   frozen, deduplicated Strings. See also SQLite3::JSONB.
+ *
+ * or any object responding to +call+, which is called with each non-NULL value
+ * of the column and returns its translation. NULLs are never translated, and
+ * values a built-in translator does not understand are returned unchanged.
+ *
+ * Statements pick up the registry when they are prepared. See also
+ * Statement#type_translators=.
+ *
+ *   db.type_translators = true
+ *   db.execute("create table events (at datetime, done boolean)")
+ *   db.execute("insert into events values (datetime('now'), 1)")
+ *   db.execute("select * from events") # => [[2025-01-01 12:00:00 UTC, true]]
+ */
+static VALUE
+set_type_translators(VALUE self, VALUE translators)
+{
+    sqlite3RubyPtr ctx;
+    TypedData_Get_Struct(self, sqlite3Ruby, &database_type, ctx);
+
+    RB_OBJ_WRITE(self, &ctx->type_translators, rb_sqlite3_type_translators_normalize(translators));
+
+    return translators;
+}
+
+/* call-seq: db.type_translators
+ *
+ * Returns the type translator registry, keyed by normalized type name, or
+ * +nil+ if type translation is off.
+ */
+static VALUE
+type_translators(VALUE self)
+{
+    sqlite3RubyPtr ctx;
+    TypedData_Get_Struct(self, sqlite3Ruby, &database_type, ctx);
+
+    return RTEST(ctx->type_translators) ? ctx->type_translators : Qnil;
+}
+
+/* call-seq: db.statement_cache_size = size
+ *
+ * Sets the number of prepared statements this database keeps for reuse by
+ * #execute, #query, #get_first_value and the pragma helpers. When the cache
+ * is full the least recently used statement is finalized to make room. A
+ * size of 0 disables the cache.
+ */
+static VALUE
+set_statement_cache_size(VALUE self, VALUE size)
+{
+    sqlite3RubyPtr ctx;
+    int capacity = NUM2INT(size);
+    TypedData_Get_Struct(self, sqlite3Ruby, &database_type, ctx);
+
+    if (capacity < 0) {
+        rb_raise(rb_eArgError, "negative statement cache size");
+    }
+
+    ctx->stmt_cache_capacity = capacity;
+    statement_cache_trim(ctx, capacity, 0);
+
+    return size;
+}
+
+/* call-seq: db.statement_cache_size
+ *
+ * Returns the maximum number of statements kept in the statement cache.
+ */
+static VALUE
+statement_cache_size(VALUE self)
+{
+    sqlite3RubyPtr ctx;
+    TypedData_Get_Struct(self, sqlite3Ruby, &database_type, ctx);
+
+    return INT2NUM(ctx->stmt_cache_capacity);
+}
+
+/* call-seq: db.statement_cache_stats
+ *
+ * Returns a Hash with the number of statement cache +hits+, +misses+ and
+ * +evictions+, and the number of statements currently cached (+size+).
+ */
+static VALUE
+statement_cache_stats(VALUE self)
+{
+    sqlite3RubyPtr ctx;
+    VALUE stats = rb_hash_new();
+    TypedData_Get_Struct(self, sqlite3Ruby, &database_type, ctx);
+
+    rb_hash_aset(stats, ID2SYM(rb_intern("hits")), SIZET2NUM(ctx->stmt_cache_hits));
+    rb_hash_aset(stats, ID2SYM(rb_intern("misses")), SIZET2NUM(ctx->stmt_cache_misses));
+    rb_hash_aset(stats, ID2SYM(rb_intern("evictions")), SIZET2NUM(ctx->stmt_cache_evictions));
+    rb_hash_aset(stats, ID2SYM(rb_intern("size")),
+                 LONG2NUM(ctx->stmt_cache ? (long)RHASH_SIZE(ctx->stmt_cache) : 0L));
+
+    return stats;
+}
+
+/* call-seq: db.clear_statement_cache
+ *
+ * Finalizes every statement in the statement cache.
+ */
+static VALUE
+clear_statement_cache(VALUE self)
+{
+    sqlite3RubyPtr ctx;
+    TypedData_Get_Struct(self, sqlite3Ruby, &database_type, ctx);
+
+    statement_cache_trim(ctx, 0, 0);
+
+    return self;
+}
+
+/* Removes and returns the cached statement for +sql+, or nil. */
+static VALUE
+statement_cache_fetch(VALUE self, VALUE sql)
+{
+    sqlite3RubyPtr ctx;
+    VALUE stmt;
+    TypedData_Get_Struct(self, sqlite3Ruby, &database_type, ctx);
+
+    if (!ctx->stmt_cache_capacity) { return Qnil; }
+
+    if (ctx->stmt_cache) {
+        stmt = rb_hash_delete(ctx->stmt_cache, sql);
+        if (!NIL_P(stmt) && rb_sqlite3_statement_checkout(stmt)) {
+            ctx->stmt_cache_hits++;
+            return stmt;
+        }
+    }
+
+    ctx->stmt_cache_misses++;
+    return Qnil;
+}
+
+/* Resets +stmt+ and caches it for +sql+ as the most recently used statement,
+ * or finalizes it if it can't be cached. */
+static VALUE
+statement_cache_store(VALUE self, VALUE sql, VALUE stmt)
+{
+    sqlite3RubyPtr ctx;
+    TypedData_Get_Struct(self, sqlite3Ruby, &database_type, ctx);
+
+    /* A statement checked out twice by nested calls is only cached once. */
+    if (!ctx->db || !ctx->stmt_cache_capacity ||
+            (ctx->stmt_cache && RTEST(rb_hash_lookup2(ctx->stmt_cache, sql, Qfalse)))) {
+        rb_sqlite3_statement_finalize(stmt);
+        return self;
+    }
+
+    if (!rb_sqlite3_statement_recycle(stmt)) { return self; }
+
+    if (!ctx->stmt_cache) {
+        RB_OBJ_WRITE(self, &ctx->stmt_cache, rb_hash_new());
+    }
+    rb_hash_aset(ctx->stmt_cache, sql, stmt);
+    statement_cache_trim(ctx, ctx->stmt_cache_capacity, 1);
+
+    return self;
+}
+
 /* call-seq: db.extended_result_codes = true
  *
  * Enable extended result codes in SQLite.  These result codes allow for more
@@ -813,10 +1517,16 @@ set_extended_result_codes(VALUE self, VALUE enable)
     return self;
 }
 
-int
-rb_comparator_func(void *ctx, int a_len, const void *a, int b_len, const void *b)
-{
+typedef struct {
     VALUE comparator;
+    int a_len, b_len;
+    const void *a, *b;
+} comparator_args_t;
+
+static VALUE
+call_comparator(VALUE comparator_args_value)
+{
+    comparator_args_t *args = (comparator_args_t *)comparator_args_value;
     VALUE a_str;
     VALUE b_str;
     VALUE comparison;
@@ -824,9 +1534,8 @@ rb_comparator_func(void *ctx, int a_len, const void *a, int b_len, const void *b
 
     internal_encoding = rb_default_internal_encoding();
 
-    comparator = (VALUE)ctx;
-    a_str = rb_str_new((const char *)a, a_len);
-    b_str = rb_str_new((const char *)b, b_len);
+    a_str = rb_str_new((const char *)args->a, args->a_len);
+    b_str = rb_str_new((const char *)args->b, args->b_len);
 
     rb_enc_associate_index(a_str, rb_utf8_encindex());
     rb_enc_associate_index(b_str, rb_utf8_encindex());
@@ -836,7 +1545,21 @@ rb_comparator_func(void *ctx, int a_len, const void *a, int b_len, const void *b
         b_str = rb_str_export_to_enc(b_str, internal_encoding);
     }
 
-    comparison = rb_funcall(comparator, rb_intern("compare"), 2, a_str, b_str);
+    comparison = rb_funcall(args->comparator, rb_intern("compare"), 2, a_str, b_str);
+
+    return INT2NUM(NUM2INT(comparison));
+}
+
+int
+rb_comparator_func(void *ctx, int a_len, const void *a, int b_len, const void *b)
+{
+    comparator_args_t args = {
+        .comparator = (VALUE)ctx, .a_len = a_len, .a = a, .b_len = b_len, .b = b
+    };
+    int exc_status;
+    VALUE comparison = rb_sqlite3_with_gvl(call_comparator, (VALUE)&args, &exc_status);
+
+    if (exc_status) { return 0; }
 
     return NUM2INT(comparison);
 }
@@ -932,77 +1655,194 @@ transaction_active_p(VALUE self)
     return sqlite3_get_autocommit(ctx->db) ? Qfalse : Qtrue;
 }
 
-static int
-hash_callback_function(VALUE callback_ary, int count, char **data, char **columns)
+/* The state of an exec_batch call, shared with its sqlite3_exec callback. */
+struct exec_batch_state {
+    VALUE rows;     /* the rows collected so far, or Qnil when they are yielded */
+    int as_hash;
+    VALUE columns;  /* the column names of the current statement, reused across rows */
+    int count;
+    char **values;
+    char **names;
+    int state;      /* the rb_protect state of a callback that raised */
+};
+
+/* Returns the frozen column names of the row being converted, creating them
+ * only when a statement with other columns starts returning rows. */
+static VALUE
+exec_batch_columns(struct exec_batch_state *batch)
 {
-    VALUE new_hash = rb_hash_new();
     int i;
 
-    for (i = 0; i < count; i++) {
-        if (data[i] == NULL) {
-            rb_hash_aset(new_hash, rb_str_new_cstr(columns[i]), Qnil);
-        } else {
-            rb_hash_aset(new_hash, rb_str_new_cstr(columns[i]), rb_str_new_cstr(data[i]));
+    if (!NIL_P(batch->columns) && RARRAY_LEN(batch->columns) == batch->count) {
+        for (i = 0; i < batch->count; i++) {
+            if (strcmp(RSTRING_PTR(RARRAY_AREF(batch->columns, i)), batch->names[i])) { break; }
         }
+        if (i == batch->count) { return batch->columns; }
     }
 
-    rb_ary_push(callback_ary, new_hash);
+    batch->columns = rb_ary_new_capa(batch->count);
+    for (i = 0; i < batch->count; i++) {
+        rb_ary_push(batch->columns, rb_obj_freeze(rb_str_new_cstr(batch->names[i])));
+    }
 
-    return 0;
+    return batch->columns;
 }
 
-static int
-regular_callback_function(VALUE callback_ary, int count, char **data, char **columns)
+static VALUE
+exec_batch_row(VALUE data)
 {
-    VALUE new_ary = rb_ary_new();
+    struct exec_batch_state *batch = (struct exec_batch_state *)data;
+    VALUE row, value;
     int i;
 
-    for (i = 0; i < count; i++) {
-        if (data[i] == NULL) {
-            rb_ary_push(new_ary, Qnil);
-        } else {
-            rb_ary_push(new_ary, rb_str_new_cstr(data[i]));
+    if (batch->as_hash) {
+        VALUE columns = exec_batch_columns(batch);
+        row = rb_hash_new_capa(batch->count);
+        for (i = 0; i < batch->count; i++) {
+            value = batch->values[i] ? rb_str_new_cstr(batch->values[i]) : Qnil;
+            rb_hash_aset(row, RARRAY_AREF(columns, i), value);
+        }
+    } else {
+        row = rb_ary_new_capa(batch->count);
+        for (i = 0; i < batch->count; i++) {
+            rb_ary_push(row, batch->values[i] ? rb_str_new_cstr(batch->values[i]) : Qnil);
         }
     }
 
-    rb_ary_push(callback_ary, new_ary);
+    if (NIL_P(batch->rows)) {
+        rb_yield(row);
+    } else {
+        rb_ary_push(batch->rows, row);
+    }
 
-    return 0;
+    return Qnil;
+}
+
+/* Converts a row, and yields it when streaming. Ruby exceptions (and break)
+ * must not unwind through sqlite3_exec, so they are caught here, abort the
+ * batch, and are re-raised once sqlite3_exec has cleaned up. */
+static int
+exec_batch_callback(void *data, int count, char **values, char **names)
+{
+    struct exec_batch_state *batch = (struct exec_batch_state *)data;
+
+    batch->count = count;
+    batch->values = values;
+    batch->names = names;
+    rb_protect(exec_batch_row, (VALUE)batch, &batch->state);
+
+    return batch->state ? 1 : 0;
 }
 
+struct exec_fast_args {
+    VALUE self;
+    VALUE sql;
+    VALUE stmt;
+    VALUE bind_vars;
+    int as_hash;
+};
+
+static VALUE
+exec_fast_body(VALUE data)
+{
+    struct exec_fast_args *args = (struct exec_fast_args *)data;
+    return rb_sqlite3_statement_execute_all(args->stmt, args->bind_vars, args->as_hash);
+}
 
-/* Is invoked by calling db.execute_batch2(sql, &block)
+static VALUE
+exec_fast_ensure(VALUE data)
+{
+    struct exec_fast_args *args = (struct exec_fast_args *)data;
+    return statement_cache_store(args->self, args->sql, args->stmt);
+}
+
+/* Is invoked by calling db.execute_fast(sql, bind_vars, &block)
+ *
+ * Takes a statement for +sql+ from the statement cache (preparing it on a
+ * miss), binds +bind_vars+ and steps it to the end, then returns the
+ * statement to the cache.
+ */
+static VALUE
+exec_fast(VALUE self, VALUE sql, VALUE bind_vars, VALUE results_as_hash)
+{
+    sqlite3RubyPtr ctx;
+    struct exec_fast_args args;
+
+    TypedData_Get_Struct(self, sqlite3Ruby, &database_type, ctx);
+    REQUIRE_OPEN_DB(ctx);
+
+    StringValue(sql);
+
+    args.self = self;
+    args.sql = sql;
+    args.bind_vars = bind_vars;
+    args.as_hash = RTEST(results_as_hash);
+    args.stmt = statement_cache_fetch(self, sql);
+
+    if (NIL_P(args.stmt)) {
+        VALUE argv[3];
+        argv[0] = self;
+        argv[1] = sql;
+        argv[2] = rb_hash_new();
+        rb_hash_aset(argv[2], ID2SYM(rb_intern("persistent")), ctx->stmt_cache_capacity ? Qtrue : Qfalse);
+        args.stmt = rb_class_new_instance_kw(3, argv, cSqlite3Statement, RB_PASS_KEYWORDS);
+    }
+
+    return rb_ensure(exec_fast_body, (VALUE)&args, exec_fast_ensure, (VALUE)&args);
+}
+
+/* Is invoked by calling db.execute_batch2(sql, stream: stream, &block)
  *
  * Executes all statements in a given string separated by semicolons.
  * If a query is made, all values returned are strings
  * (except for 'NULL' values which return nil),
  * so the user may parse values with a block.
  * If no query is made, an empty array will be returned.
+ * With +stream+, each row is yielded as soon as SQLite produces it instead,
+ * and nil is returned.
  */
 static VALUE
-exec_batch(VALUE self, VALUE sql, VALUE results_as_hash)
+exec_batch(VALUE self, VALUE sql, VALUE results_as_hash, VALUE stream)
 {
     sqlite3RubyPtr ctx;
     int status;
-    VALUE callback_ary = rb_ary_new();
-    char *errMsg;
+    struct exec_batch_state batch;
+    char *errMsg = NULL;
 
     TypedData_Get_Struct(self, sqlite3Ruby, &database_type, ctx);
     REQUIRE_OPEN_DB(ctx);
 
-    if (results_as_hash == Qtrue) {
-        status = sqlite3_exec(ctx->db, StringValuePtr(sql), (sqlite3_callback)hash_callback_function,
-                              (void *)callback_ary,
-                              &errMsg);
-    } else {
-        status = sqlite3_exec(ctx->db, StringValuePtr(sql), (sqlite3_callback)regular_callback_function,
-                              (void *)callback_ary,
-                              &errMsg);
+    batch.rows = RTEST(stream) ? Qnil : rb_ary_new();
+    batch.as_hash = results_as_hash == Qtrue;
+    batch.columns = Qnil;
+    batch.state = 0;
+
+    status = sqlite3_exec(ctx->db, StringValuePtr(sql), exec_batch_callback, (void *)&batch, &errMsg);
+
+    if (batch.state) {
+        sqlite3_free(errMsg);
+        rb_jump_tag(batch.state);
     }
 
     CHECK_MSG(ctx->db, status, errMsg);
 
-    return callback_ary;
+    RB_GC_GUARD(batch.columns);
+    return batch.rows;
+}
+
+/* Is invoked by calling db.execute_batch(sql, bind_vars)
+ *
+ * Prepares and runs each statement of +sql+ in turn, walking SQLite's tail
+ * pointer over the one buffer, and returns the first row of the last one.
+ */
+static VALUE
+exec_script(VALUE self, VALUE sql, VALUE bind_vars)
+{
+    sqlite3RubyPtr ctx;
+    TypedData_Get_Struct(self, sqlite3Ruby, &database_type, ctx);
+    REQUIRE_OPEN_DB(ctx);
+
+    return rb_sqlite3_statement_execute_script(self, sql, bind_vars);
 }
 
 /* call-seq: db.db_filename(database_name)
@@ -1093,8 +1933,27 @@ init_sqlite3_database(void)
     rb_define_method(cSqlite3Database, "statement_timeout=", set_statement_timeout, 1);
 #endif
     rb_define_method(cSqlite3Database, "extended_result_codes=", set_extended_result_codes, 1);
+    rb_define_method(cSqlite3Database, "release_gvl=", set_release_gvl, 1);
+    rb_define_method(cSqlite3Database, "release_gvl?", release_gvl_p, 0);
+    rb_define_method(cSqlite3Database, "nonblocking=", set_nonblocking, 1);
+    rb_define_method(cSqlite3Database, "nonblocking?", nonblocking_p, 0);
+    rb_define_private_method(cSqlite3Database, "offload?", offload_p, 0);
+    rb_define_method(cSqlite3Database, "dedup_text=", set_dedup_text, 1);
+    rb_define_method(cSqlite3Database, "dedup_text?", dedup_text_p, 0);
+    rb_define_method(cSqlite3Database, "type_translators=", set_type_translators, 1);
+    rb_define_method(cSqlite3Database, "type_translators", type_translators, 0);
+    rb_define_method(cSqlite3Database, "statement_cache_size=", set_statement_cache_size, 1);
+    rb_define_method(cSqlite3Database, "statement_cache_size", statement_cache_size, 0);
+    rb_define_method(cSqlite3Database, "statement_cache_stats", statement_cache_stats, 0);
+    rb_define_method(cSqlite3Database, "clear_statement_cache", clear_statement_cache, 0);
+    rb_define_private_method(cSqlite3Database, "statement_cache_fetch", statement_cache_fetch, 1);
+    rb_define_private_method(cSqlite3Database, "statement_cache_store", statement_cache_store, 2);
     rb_define_method(cSqlite3Database, "transaction_active?", transaction_active_p, 0);
-    rb_define_private_method(cSqlite3Database, "exec_batch", exec_batch, 2);
+    rb_define_private_method(cSqlite3Database, "set_busy_backoff", set_busy_backoff, 4);
+    rb_define_method(cSqlite3Database, "busy_stats", busy_stats, 0);
+    rb_define_private_method(cSqlite3Database, "exec_batch", exec_batch, 3);
+    rb_define_private_method(cSqlite3Database, "exec_script", exec_script, 2);
+    rb_define_private_method(cSqlite3Database, "exec_fast", exec_fast, 3);
     rb_define_private_method(cSqlite3Database, "db_filename", db_filename, 1);
 
 #ifdef HAVE_SQLITE3_LOAD_EXTENSION
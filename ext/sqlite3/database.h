@@ -6,6 +6,23 @@
 /* bits in the `flags` field */
 #define SQLITE3_RB_DATABASE_READONLY  0x01
 #define SQLITE3_RB_DATABASE_DISCARDED 0x02
+#define SQLITE3_RB_DATABASE_RELEASE_GVL 0x04
+#define SQLITE3_RB_DATABASE_DEDUP_TEXT 0x08
+#define SQLITE3_RB_DATABASE_NONBLOCKING 0x10
+
+/* Settings and counters of the native busy handler (see Database#busy_backoff).
+ * Times are in seconds. */
+struct _sqlite3BusyBackoff {
+    double timeout;
+    double min_delay;
+    double max_delay;
+    double jitter;
+    double deadline;
+    size_t waits;
+    size_t retries;
+    size_t timeouts;
+    double wait_time;
+};
 
 struct _sqlite3Ruby {
     sqlite3 *db;
@@ -19,6 +36,13 @@ struct _sqlite3Ruby {
     struct timespec stmt_deadline;
     rb_pid_t owner;
     int flags;
+    VALUE stmt_cache;
+    int stmt_cache_capacity;
+    size_t stmt_cache_hits;
+    size_t stmt_cache_misses;
+    size_t stmt_cache_evictions;
+    VALUE type_translators;
+    struct _sqlite3BusyBackoff busy_backoff;
 };
 
 typedef struct _sqlite3Ruby sqlite3Ruby;
@@ -33,4 +57,26 @@ void set_sqlite3_func_result(sqlite3_context *ctx, VALUE result);
 sqlite3RubyPtr sqlite3_database_unwrap(VALUE database);
 VALUE sqlite3val2rb(sqlite3_value *val);
 
+/* Steps +stmt+ with the GVL released, interrupting it if the thread is interrupted.
+ * With +offload_safe+ set, a fiber scheduler may run the step on another thread. */
+int rb_sqlite3_step_without_gvl(sqlite3 *db, sqlite3_stmt *stmt, int offload_safe);
+
+/* Steps +stmt+ on a Ruby thread that has already released the GVL, so that
+ * Ruby callbacks take it back before they run. */
+int rb_sqlite3_step_released(sqlite3_stmt *stmt);
+
+/* Returns 1 if a statement of the nonblocking database +ctx+ run from the
+ * current fiber should be handed to the database's worker thread (see
+ * Database#nonblocking=). */
+int rb_sqlite3_offload_p(sqlite3RubyPtr ctx);
+
+/* Returns 1 if Ruby callbacks (functions, aggregators, collations, the
+ * authorizer, the trace handler or a Ruby busy handler) were registered on the
+ * database. SQLite may invoke them from any statement. */
+int rb_sqlite3_ruby_callbacks_p(sqlite3RubyPtr ctx);
+
+/* Ruby callbacks invoked by sqlite must run through this, because they may be
+ * called from a step that released the GVL. */
+VALUE rb_sqlite3_with_gvl(VALUE (*func)(VALUE), VALUE arg, int *exc_status);
+
 #endif
@@ -99,6 +99,12 @@ rb_sqlite3_raise_msg(sqlite3 *db, int status, const char *msg)
 
 void
 rb_sqlite3_raise_with_sql(sqlite3 *db, int status, const char *sql)
+{
+    rb_sqlite3_raise_with_sql_len(db, status, sql, sql ? (long)strlen(sql) : 0);
+}
+
+void
+rb_sqlite3_raise_with_sql_len(sqlite3 *db, int status, const char *sql, long len)
 {
     VALUE klass = status2klass(status);
     if (NIL_P(klass)) {
@@ -114,7 +120,7 @@ rb_sqlite3_raise_with_sql(sqlite3 *db, int status, const char *sql)
     VALUE exception = rb_exc_new2(klass, error_msg);
     rb_iv_set(exception, "@code", INT2FIX(status));
     if (sql) {
-        rb_iv_set(exception, "@sql", rb_str_new2(sql));
+        rb_iv_set(exception, "@sql", rb_str_new(sql, len));
         rb_iv_set(exception, "@sql_offset", INT2FIX(error_offset));
     }
 
@@ -8,5 +8,6 @@
 void rb_sqlite3_raise(sqlite3 *db, int status);
 void rb_sqlite3_raise_msg(sqlite3 *db, int status, const char *msg);
 void rb_sqlite3_raise_with_sql(sqlite3 *db, int status, const char *sql);
+void rb_sqlite3_raise_with_sql_len(sqlite3 *db, int status, const char *sql, long len);
 
 #endif
@@ -118,6 +118,8 @@ module Sqlite3
         # Truffle Ruby doesn't support this yet:
         # https://github.com/oracle/truffleruby/issues/3408
         have_func("rb_enc_interned_str_cstr")
+        have_func("rb_enc_interned_str")
+        have_func("rb_hash_new_capa")
 
         # Functions defined in 1.9 but not 1.8
         have_func("rb_proc_arity")
@@ -137,8 +139,12 @@ module Sqlite3
         end
 
         have_func("sqlite3_prepare_v2")
+        have_func("sqlite3_prepare_v3", "sqlite3.h") # v3.20.0
+        have_func("sqlite3_bind_text64", "sqlite3.h") # v3.8.7
+        have_func("sqlite3_blob_reopen", "sqlite3.h") # v3.7.4
         have_func("sqlite3_db_name", "sqlite3.h") # v3.39.0
         have_func("sqlite3_error_offset", "sqlite3.h") # v3.38.0
+        have_func("sqlite3_is_interrupted", "sqlite3.h") # v3.41.0
 
         have_type("sqlite3_int64", "sqlite3.h")
         have_type("sqlite3_uint64", "sqlite3.h")
@@ -0,0 +1,745 @@
+#include <sqlite3_ruby.h>
+#include <ruby/util.h>
+#include <math.h>
+
+/* The nesting limit SQLite applies to JSON and JSONB. */
+#define JSON_MAX_DEPTH 1000
+
+/* The element types of SQLite's JSONB format, https://sqlite.org/jsonb.html */
+enum jsonb_type {
+    JSONB_NULL = 0,
+    JSONB_TRUE,
+    JSONB_FALSE,
+    JSONB_INT,
+    JSONB_INT5,
+    JSONB_FLOAT,
+    JSONB_FLOAT5,
+    JSONB_TEXT,
+    JSONB_TEXTJ,
+    JSONB_TEXT5,
+    JSONB_TEXTRAW,
+    JSONB_ARRAY,
+    JSONB_OBJECT
+};
+
+VALUE cSqlite3JSONB;
+static ID id_at_value, id_to_s;
+
+/* Object keys are interned, as the same keys repeat from one document to the
+ * next. */
+static VALUE
+json_key(const char *ptr, long len)
+{
+    return rb_sqlite3_text_value(ptr, len, 1, NULL);
+}
+
+/* Converts an integer, with an optional sign and, as JSON5 allows, in hex. */
+static VALUE
+json_integer(const char *ptr, long len)
+{
+    const char *p = ptr, *end = ptr + len;
+    int negative = 0, base = 10;
+    long long value = 0;
+
+    if (p < end && (*p == '-' || *p == '+')) { negative = *p++ == '-'; }
+    if (end - p > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
+        base = 16;
+        p += 2;
+    }
+    if (p == end) { return Qundef; }
+
+    for (; p < end; p++) {
+        if (base == 16 ? !ISXDIGIT(*p) : !ISDIGIT(*p)) { return Qundef; }
+        if (base == 10 && end - ptr <= 18) { value = value * 10 + (*p - '0'); }
+    }
+
+    if (base == 10 && len <= 18) { return LL2NUM(negative ? -value : value); }
+    return rb_str_to_inum(rb_str_new(ptr, len), base, 0);
+}
+
+/* Converts a float, including the forms JSON5 adds: a leading "+", a leading
+ * or trailing ".", Infinity and NaN. */
+static VALUE
+json_float(const char *ptr, long len)
+{
+    const char *p = ptr, *end = ptr + len;
+    char buf[64], *str, *parsed;
+    VALUE tmp = Qnil;
+    double value;
+    int negative = 0;
+
+    if (p < end && (*p == '-' || *p == '+')) { negative = *p++ == '-'; }
+    if ((end - p == 8 && !memcmp(p, "Infinity", 8)) || (end - p == 3 && !sqlite3_strnicmp(p, "inf", 3))) {
+        return DBL2NUM(negative ? -HUGE_VAL : HUGE_VAL);
+    }
+    if (end - p == 3 && !sqlite3_strnicmp(p, "nan", 3)) { return DBL2NUM(NAN); }
+    if (p < end && end[-1] == '.') {
+        end--;
+        len--;
+    }
+    if (p == end) { return Qundef; }
+
+    if ((size_t)len < sizeof(buf)) {
+        memcpy(buf, ptr, (size_t)len);
+        buf[len] = '\0';
+        str = buf;
+    } else {
+        tmp = rb_str_new(ptr, len);
+        str = RSTRING_PTR(tmp);
+    }
+
+    value = ruby_strtod(str, &parsed);
+    RB_GC_GUARD(tmp);
+
+    return parsed == str + len ? DBL2NUM(value) : Qundef;
+}
+
+static void
+append_utf8(VALUE str, unsigned long c)
+{
+    char buf[4];
+    int len;
+
+    if (c < 0x80) {
+        buf[0] = (char)c;
+        len = 1;
+    } else if (c < 0x800) {
+        buf[0] = (char)(0xc0 | (c >> 6));
+        buf[1] = (char)(0x80 | (c & 0x3f));
+        len = 2;
+    } else if (c < 0x10000) {
+        buf[0] = (char)(0xe0 | (c >> 12));
+        buf[1] = (char)(0x80 | ((c >> 6) & 0x3f));
+        buf[2] = (char)(0x80 | (c & 0x3f));
+        len = 3;
+    } else {
+        buf[0] = (char)(0xf0 | (c >> 18));
+        buf[1] = (char)(0x80 | ((c >> 12) & 0x3f));
+        buf[2] = (char)(0x80 | ((c >> 6) & 0x3f));
+        buf[3] = (char)(0x80 | (c & 0x3f));
+        len = 4;
+    }
+
+    rb_str_cat(str, buf, len);
+}
+
+/* Reads +n+ hex digits, or returns -1. */
+static long
+read_hex(const char *p, const char *end, int n)
+{
+    long value = 0;
+
+    if (end - p < n) { return -1; }
+    while (n--) {
+        int c = *p++;
+        if (!ISXDIGIT(c)) { return -1; }
+        value = value * 16 + (ISDIGIT(c) ? c - '0' : TOLOWER(c) - 'a' + 10);
+    }
+
+    return value;
+}
+
+/* Decodes the escapes of a JSON string body and, with +json5+, those JSON5
+ * adds. Unpaired surrogates become U+FFFD. Returns Qundef at an invalid
+ * escape. */
+static VALUE
+json_unescape(const char *p, const char *end, int json5)
+{
+    VALUE str = rb_enc_str_new(NULL, 0, rb_utf8_encoding());
+    const char *run = p;
+    long c, low;
+
+    while (p < end) {
+        if (*p != '\\') {
+            p++;
+            continue;
+        }
+
+        rb_str_cat(str, run, p - run);
+        if (++p == end) { return Qundef; }
+        c = (unsigned char)*p++;
+        if (!json5 && !(c && strchr("\"\\/bfnrtu", (int)c))) { return Qundef; }
+
+        switch (c) {
+            case 'b':
+                rb_str_cat(str, "\b", 1);
+                break;
+            case 'f':
+                rb_str_cat(str, "\f", 1);
+                break;
+            case 'n':
+                rb_str_cat(str, "\n", 1);
+                break;
+            case 'r':
+                rb_str_cat(str, "\r", 1);
+                break;
+            case 't':
+                rb_str_cat(str, "\t", 1);
+                break;
+            case 'v':
+                rb_str_cat(str, "\v", 1);
+                break;
+            case '0':
+                rb_str_cat(str, "\0", 1);
+                break;
+            case '"':
+            case '\\':
+            case '/':
+            case '\'':
+                rb_str_cat(str, p - 1, 1);
+                break;
+            case 'x':
+                if ((c = read_hex(p, end, 2)) < 0) { return Qundef; }
+                p += 2;
+                append_utf8(str, (unsigned long)c);
+                break;
+            case 'u':
+                if ((c = read_hex(p, end, 4)) < 0) { return Qundef; }
+                p += 4;
+                if (c >= 0xd800 && c <= 0xdbff && end - p >= 6 && p[0] == '\\' && p[1] == 'u'
+                        && (low = read_hex(p + 2, end, 4)) >= 0xdc00 && low <= 0xdfff) {
+                    c = 0x10000 + ((c - 0xd800) << 10) + (low - 0xdc00);
+                    p += 6;
+                } else if (c >= 0xd800 && c <= 0xdfff) {
+                    c = 0xfffd;
+                }
+                append_utf8(str, (unsigned long)c);
+                break;
+            /* JSON5 line continuations */
+            case '\r':
+                if (p < end && *p == '\n') { p++; }
+                break;
+            case '\n':
+                break;
+            case 0xe2:
+                /* U+2028 and U+2029 */
+                if (end - p < 2 || (unsigned char)p[0] != 0x80 || ((unsigned char)p[1] & 0xfe) != 0xa8) {
+                    return Qundef;
+                }
+                p += 2;
+                break;
+            default:
+                return Qundef;
+        }
+        run = p;
+    }
+
+    rb_str_cat(str, run, p - run);
+    return str;
+}
+
+struct json_parser {
+    const char *p;
+    const char *end;
+    int depth;
+};
+
+static VALUE json_parse_value(struct json_parser *parser);
+
+static void
+json_skip_space(struct json_parser *parser)
+{
+    while (parser->p < parser->end
+            && (*parser->p == ' ' || *parser->p == '\t' || *parser->p == '\n' || *parser->p == '\r')) {
+        parser->p++;
+    }
+}
+
+static int
+json_literal(struct json_parser *parser, const char *word, long len)
+{
+    if (parser->end - parser->p < len || memcmp(parser->p, word, (size_t)len)) { return 0; }
+
+    parser->p += len;
+    return 1;
+}
+
+static VALUE
+json_parse_string(struct json_parser *parser, int key)
+{
+    const char *start = ++parser->p;
+    int escaped = 0;
+    VALUE str;
+
+    while (parser->p < parser->end && *parser->p != '"') {
+        if ((unsigned char)*parser->p < 0x20) { return Qundef; }
+        if (*parser->p == '\\') {
+            escaped = 1;
+            if (++parser->p == parser->end) { return Qundef; }
+        }
+        parser->p++;
+    }
+    if (parser->p == parser->end) { return Qundef; }
+    parser->p++;
+
+    if (!escaped) {
+        return key ? json_key(start, parser->p - 1 - start) : rb_utf8_str_new(start, parser->p - 1 - start);
+    }
+
+    str = json_unescape(start, parser->p - 1, 0);
+    if (str == Qundef || !key) { return str; }
+    return json_key(RSTRING_PTR(str), RSTRING_LEN(str));
+}
+
+static VALUE
+json_parse_number(struct json_parser *parser)
+{
+    const char *start = parser->p, *p = parser->p, *end = parser->end;
+    int is_float = 0;
+
+    if (p < end && *p == '-') { p++; }
+    if (p < end && *p == '0') {
+        p++;
+    } else if (p < end && *p >= '1' && *p <= '9') {
+        while (p < end && ISDIGIT(*p)) { p++; }
+    } else {
+        return Qundef;
+    }
+
+    if (p < end && *p == '.') {
+        is_float = 1;
+        if (++p == end || !ISDIGIT(*p)) { return Qundef; }
+        while (p < end && ISDIGIT(*p)) { p++; }
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        is_float = 1;
+        if (++p < end && (*p == '+' || *p == '-')) { p++; }
+        if (p == end || !ISDIGIT(*p)) { return Qundef; }
+        while (p < end && ISDIGIT(*p)) { p++; }
+    }
+
+    parser->p = p;
+    return is_float ? json_float(start, p - start) : json_integer(start, p - start);
+}
+
+static VALUE
+json_parse_array(struct json_parser *parser)
+{
+    VALUE ary = rb_ary_new(), value;
+
+    parser->p++;
+    json_skip_space(parser);
+    if (parser->p < parser->end && *parser->p == ']') {
+        parser->p++;
+        return ary;
+    }
+
+    for (;;) {
+        if ((value = json_parse_value(parser)) == Qundef) { return Qundef; }
+        rb_ary_push(ary, value);
+
+        json_skip_space(parser);
+        if (parser->p == parser->end) { return Qundef; }
+        if (*parser->p == ']') {
+            parser->p++;
+            return ary;
+        }
+        if (*parser->p++ != ',') { return Qundef; }
+    }
+}
+
+static VALUE
+json_parse_object(struct json_parser *parser)
+{
+    VALUE hash = rb_hash_new(), key, value;
+
+    parser->p++;
+    json_skip_space(parser);
+    if (parser->p < parser->end && *parser->p == '}') {
+        parser->p++;
+        return hash;
+    }
+
+    for (;;) {
+        json_skip_space(parser);
+        if (parser->p == parser->end || *parser->p != '"') { return Qundef; }
+        if ((key = json_parse_string(parser, 1)) == Qundef) { return Qundef; }
+
+        json_skip_space(parser);
+        if (parser->p == parser->end || *parser->p++ != ':') { return Qundef; }
+        if ((value = json_parse_value(parser)) == Qundef) { return Qundef; }
+        rb_hash_aset(hash, key, value);
+
+        json_skip_space(parser);
+        if (parser->p == parser->end) { return Qundef; }
+        if (*parser->p == '}') {
+            parser->p++;
+            return hash;
+        }
+        if (*parser->p++ != ',') { return Qundef; }
+    }
+}
+
+static VALUE
+json_parse_value(struct json_parser *parser)
+{
+    VALUE value;
+
+    json_skip_space(parser);
+    if (parser->p == parser->end) { return Qundef; }
+
+    switch (*parser->p) {
+        case '{':
+        case '[':
+            if (++parser->depth > JSON_MAX_DEPTH) { return Qundef; }
+            value = *parser->p == '{' ? json_parse_object(parser) : json_parse_array(parser);
+            parser->depth--;
+            return value;
+        case '"':
+            return json_parse_string(parser, 0);
+        case 't':
+            return json_literal(parser, "true", 4) ? Qtrue : Qundef;
+        case 'f':
+            return json_literal(parser, "false", 5) ? Qfalse : Qundef;
+        case 'n':
+            return json_literal(parser, "null", 4) ? Qnil : Qundef;
+        default:
+            return json_parse_number(parser);
+    }
+}
+
+VALUE
+rb_sqlite3_json_parse(const char *text, long len)
+{
+    struct json_parser parser;
+    VALUE value;
+
+    parser.p = text;
+    parser.end = text + len;
+    parser.depth = 0;
+
+    value = json_parse_value(&parser);
+    if (value == Qundef) { return Qundef; }
+
+    json_skip_space(&parser);
+    return parser.p == parser.end ? value : Qundef;
+}
+
+/* Reads the header of the JSONB element at +p+: its type and the sizes of the
+ * header and of the payload that follows it. */
+static int
+jsonb_header(const unsigned char *p, const unsigned char *end, int *type, size_t *header, size_t *payload)
+{
+    size_t available = (size_t)(end - p), n = 0, i;
+    sqlite3_uint64 size;
+
+    if (!available) { return 0; }
+
+    *type = p[0] & 0x0f;
+    size = p[0] >> 4;
+    if (size >= 12) {
+        n = (size_t)1 << (size - 12);
+        if (available < 1 + n) { return 0; }
+        for (size = 0, i = 1; i <= n; i++) {
+            size = size << 8 | p[i];
+        }
+    }
+
+    *header = 1 + n;
+    if (size > available - *header) { return 0; }
+    *payload = (size_t)size;
+
+    return 1;
+}
+
+static VALUE
+jsonb_decode(const unsigned char *p, const unsigned char *end, const unsigned char **next, int depth, int key)
+{
+    const unsigned char *payload, *payload_end;
+    size_t header, size;
+    int type;
+    VALUE container, item, value;
+
+    *next = p;
+    if (!jsonb_header(p, end, &type, &header, &size)) { return Qundef; }
+
+    payload = p + header;
+    payload_end = payload + size;
+    *next = payload_end;
+
+    if (key && (type < JSONB_TEXT || type > JSONB_TEXTRAW)) { return Qundef; }
+
+    switch (type) {
+        case JSONB_NULL:
+            return size ? Qundef : Qnil;
+        case JSONB_TRUE:
+            return size ? Qundef : Qtrue;
+        case JSONB_FALSE:
+            return size ? Qundef : Qfalse;
+        case JSONB_INT:
+        case JSONB_INT5:
+            return json_integer((const char *)payload, (long)size);
+        case JSONB_FLOAT:
+        case JSONB_FLOAT5:
+            return json_float((const char *)payload, (long)size);
+        case JSONB_TEXT:
+        case JSONB_TEXTRAW:
+            return key ? json_key((const char *)payload, (long)size)
+                   : rb_utf8_str_new((const char *)payload, (long)size);
+        case JSONB_TEXTJ:
+        case JSONB_TEXT5:
+            value = json_unescape((const char *)payload, (const char *)payload_end, type == JSONB_TEXT5);
+            if (value == Qundef || !key) { return value; }
+            return json_key(RSTRING_PTR(value), RSTRING_LEN(value));
+        case JSONB_ARRAY:
+            if (depth >= JSON_MAX_DEPTH) { return Qundef; }
+            container = rb_ary_new();
+            while (payload < payload_end) {
+                if ((value = jsonb_decode(payload, payload_end, &payload, depth + 1, 0)) == Qundef) {
+                    return Qundef;
+                }
+                rb_ary_push(container, value);
+            }
+            return container;
+        case JSONB_OBJECT:
+            if (depth >= JSON_MAX_DEPTH) { return Qundef; }
+            container = rb_hash_new();
+            while (payload < payload_end) {
+                if ((item = jsonb_decode(payload, payload_end, &payload, depth + 1, 1)) == Qundef
+                        || payload == payload_end
+                        || (value = jsonb_decode(payload, payload_end, &payload, depth + 1, 0)) == Qundef) {
+                    return Qundef;
+                }
+                rb_hash_aset(container, item, value);
+            }
+            return container;
+        default:
+            return Qundef;
+    }
+}
+
+VALUE
+rb_sqlite3_jsonb_load(const unsigned char *blob, long len)
+{
+    const unsigned char *next;
+    VALUE value = jsonb_decode(blob, blob + len, &next, 0, 0);
+
+    return next == blob + len ? value : Qundef;
+}
+
+static int
+jsonb_header_length(size_t size)
+{
+    sqlite3_uint64 n = size;
+
+    return n <= 11 ? 1 : n <= 0xff ? 2 : n <= 0xffff ? 3 : n <= 0xffffffff ? 5 : 9;
+}
+
+/* Writes the +length+ byte header of an element. */
+static void
+jsonb_write_header(unsigned char *out, int type, size_t size, int length)
+{
+    sqlite3_uint64 n = size;
+    int i;
+
+    if (length == 1) {
+        out[0] = (unsigned char)(n << 4 | (unsigned)type);
+        return;
+    }
+
+    out[0] = (unsigned char)((length == 2 ? 12 : length == 3 ? 13 : length == 5 ? 14 : 15) << 4 | type);
+    for (i = length - 1; i > 0; i--) {
+        out[i] = (unsigned char)(n & 0xff);
+        n >>= 8;
+    }
+}
+
+static void
+jsonb_append(VALUE buf, int type, const char *payload, long size)
+{
+    unsigned char header[9];
+    int length = jsonb_header_length((size_t)size);
+
+    jsonb_write_header(header, type, (size_t)size, length);
+    rb_str_cat(buf, (const char *)header, length);
+    rb_str_cat(buf, payload, size);
+}
+
+/* Containers are written with a one byte header, which is widened once the
+ * size of their payload is known. */
+static long
+jsonb_open(VALUE buf)
+{
+    long start = RSTRING_LEN(buf);
+
+    rb_str_cat(buf, "", 1);
+    return start;
+}
+
+static void
+jsonb_close(VALUE buf, long start, int type)
+{
+    size_t size = (size_t)(RSTRING_LEN(buf) - start - 1);
+    int length = jsonb_header_length(size);
+    char *ptr;
+
+    if (length > 1) {
+        rb_str_modify_expand(buf, length - 1);
+        ptr = RSTRING_PTR(buf);
+        memmove(ptr + start + length, ptr + start + 1, size);
+        rb_str_set_len(buf, RSTRING_LEN(buf) + length - 1);
+    }
+
+    jsonb_write_header((unsigned char *)RSTRING_PTR(buf) + start, type, size, length);
+}
+
+static void
+jsonb_dump_string(VALUE buf, VALUE str)
+{
+    const char *p, *end;
+    int type = JSONB_TEXT;
+
+    if (!UTF8_P(str) && !USASCII_P(str)) {
+        str = rb_str_encode(str, rb_enc_from_encoding(rb_utf8_encoding()), 0, Qnil);
+    }
+
+    for (p = RSTRING_PTR(str), end = RSTRING_END(str); p < end; p++) {
+        if ((unsigned char)*p < 0x20 || *p == '"' || *p == '\\') {
+            type = JSONB_TEXTRAW;
+            break;
+        }
+    }
+
+    jsonb_append(buf, type, RSTRING_PTR(str), RSTRING_LEN(str));
+    RB_GC_GUARD(str);
+}
+
+struct jsonb_dump_args {
+    VALUE buf;
+    int depth;
+};
+
+static void jsonb_dump_value(VALUE buf, VALUE obj, int depth);
+
+static int
+jsonb_dump_pair(VALUE key, VALUE value, VALUE data)
+{
+    struct jsonb_dump_args *args = (struct jsonb_dump_args *)data;
+
+    if (SYMBOL_P(key)) {
+        key = rb_sym2str(key);
+    } else if (!RB_TYPE_P(key, T_STRING)) {
+        key = rb_obj_as_string(key);
+    }
+
+    jsonb_dump_string(args->buf, key);
+    jsonb_dump_value(args->buf, value, args->depth);
+
+    return ST_CONTINUE;
+}
+
+static void
+jsonb_dump_value(VALUE buf, VALUE obj, int depth)
+{
+    struct jsonb_dump_args args;
+    char digits[24];
+    long start, i;
+    VALUE str;
+
+    switch (TYPE(obj)) {
+        case T_NIL:
+            jsonb_append(buf, JSONB_NULL, "", 0);
+            break;
+        case T_TRUE:
+            jsonb_append(buf, JSONB_TRUE, "", 0);
+            break;
+        case T_FALSE:
+            jsonb_append(buf, JSONB_FALSE, "", 0);
+            break;
+        case T_FIXNUM:
+            jsonb_append(buf, JSONB_INT, digits, snprintf(digits, sizeof(digits), "%ld", FIX2LONG(obj)));
+            break;
+        case T_BIGNUM:
+            str = rb_big2str(obj, 10);
+            jsonb_append(buf, JSONB_INT, RSTRING_PTR(str), RSTRING_LEN(str));
+            break;
+        case T_FLOAT:
+            if (isnan(RFLOAT_VALUE(obj)) || isinf(RFLOAT_VALUE(obj))) {
+                rb_raise(rb_eArgError, "%"PRIsVALUE" is not allowed in JSON", obj);
+            }
+            str = rb_funcall(obj, id_to_s, 0);
+            jsonb_append(buf, JSONB_FLOAT, RSTRING_PTR(str), RSTRING_LEN(str));
+            break;
+        case T_SYMBOL:
+            jsonb_dump_string(buf, rb_sym2str(obj));
+            break;
+        case T_STRING:
+            jsonb_dump_string(buf, obj);
+            break;
+        case T_ARRAY:
+            if (depth >= JSON_MAX_DEPTH) { rb_raise(rb_eArgError, "nesting of %d is too deep", depth + 1); }
+            start = jsonb_open(buf);
+            for (i = 0; i < RARRAY_LEN(obj); i++) {
+                jsonb_dump_value(buf, RARRAY_AREF(obj, i), depth + 1);
+            }
+            jsonb_close(buf, start, JSONB_ARRAY);
+            break;
+        case T_HASH:
+            if (depth >= JSON_MAX_DEPTH) { rb_raise(rb_eArgError, "nesting of %d is too deep", depth + 1); }
+            start = jsonb_open(buf);
+            args.buf = buf;
+            args.depth = depth + 1;
+            rb_hash_foreach(obj, jsonb_dump_pair, (VALUE)&args);
+            jsonb_close(buf, start, JSONB_OBJECT);
+            break;
+        default:
+            rb_raise(rb_eTypeError, "can't convert %"PRIsVALUE" into JSONB", rb_obj_class(obj));
+    }
+}
+
+VALUE
+rb_sqlite3_jsonb_dump(VALUE obj)
+{
+    VALUE buf = rb_str_buf_new(64);
+
+    jsonb_dump_value(buf, obj, 0);
+    return rb_obj_freeze(buf);
+}
+
+VALUE
+rb_sqlite3_jsonb_value(VALUE jsonb)
+{
+    return rb_ivar_get(jsonb, id_at_value);
+}
+
+/* call-seq: SQLite3::JSONB.dump(obj)
+ *
+ * Encodes +obj+ into a frozen binary String in SQLite's JSONB format. Hashes,
+ * Arrays, Strings, Symbols, Integers, finite Floats, +true+, +false+ and +nil+
+ * are accepted, and Hash keys are converted to Strings. Raises TypeError for
+ * any other object.
+ */
+static VALUE
+jsonb_s_dump(VALUE UNUSED(klass), VALUE obj)
+{
+    return rb_sqlite3_jsonb_dump(obj);
+}
+
+/* call-seq: SQLite3::JSONB.load(blob)
+ *
+ * Decodes a String in SQLite's JSONB format. Raises ArgumentError if +blob+
+ * is not valid JSONB.
+ */
+static VALUE
+jsonb_s_load(VALUE UNUSED(klass), VALUE blob)
+{
+    VALUE value;
+
+    StringValue(blob);
+    value = rb_sqlite3_jsonb_load((const unsigned char *)RSTRING_PTR(blob), RSTRING_LEN(blob));
+    RB_GC_GUARD(blob);
+
+    if (value == Qundef) { rb_raise(rb_eArgError, "invalid JSONB"); }
+    return value;
+}
+
+void
+init_sqlite3_json(void)
+{
+    id_at_value = rb_intern("@value");
+    id_to_s = rb_intern("to_s");
+
+    cSqlite3JSONB = rb_define_class_under(mSqlite3, "JSONB", rb_cObject);
+    rb_define_singleton_method(cSqlite3JSONB, "dump", jsonb_s_dump, 1);
+    rb_define_singleton_method(cSqlite3JSONB, "load", jsonb_s_load, 1);
+}
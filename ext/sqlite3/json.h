@@ -0,0 +1,25 @@
+#ifndef SQLITE3_JSON_RUBY
+#define SQLITE3_JSON_RUBY
+
+#include <sqlite3_ruby.h>
+
+extern VALUE cSqlite3JSONB;
+
+void init_sqlite3_json();
+
+/* Parses +len+ bytes of JSON text into Hashes, Arrays, Strings, numbers,
+ * booleans and nil. Returns Qundef if the text is not valid JSON. */
+VALUE rb_sqlite3_json_parse(const char *text, long len);
+
+/* Decodes a value in SQLite's JSONB format, as rb_sqlite3_json_parse decodes
+ * text. Returns Qundef if the blob is not valid JSONB. */
+VALUE rb_sqlite3_jsonb_load(const unsigned char *blob, long len);
+
+/* Encodes +obj+, made of Hashes, Arrays, Strings, Symbols, numbers, booleans
+ * and nil, into a frozen binary String in SQLite's JSONB format. */
+VALUE rb_sqlite3_jsonb_dump(VALUE obj);
+
+/* Returns the value a SQLite3::JSONB wraps. */
+VALUE rb_sqlite3_jsonb_value(VALUE jsonb);
+
+#endif
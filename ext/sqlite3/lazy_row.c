@@ -0,0 +1,295 @@
+#include <sqlite3_ruby.h>
+
+VALUE cSqlite3LazyRow;
+
+static void
+lazy_row_mark(void *data)
+{
+    sqlite3LazyRowRubyPtr ctx = (sqlite3LazyRowRubyPtr)data;
+    int i;
+
+    rb_gc_mark_movable(ctx->columns);
+    for (i = 0; i < ctx->ncolumns; i++) {
+        rb_gc_mark_movable(ctx->values[i]);
+    }
+}
+
+static void
+lazy_row_compact(void *data)
+{
+    sqlite3LazyRowRubyPtr ctx = (sqlite3LazyRowRubyPtr)data;
+    int i;
+
+    ctx->columns = rb_gc_location(ctx->columns);
+    for (i = 0; i < ctx->ncolumns; i++) {
+        ctx->values[i] = rb_gc_location(ctx->values[i]);
+    }
+}
+
+static void
+lazy_row_deallocate(void *data)
+{
+    sqlite3LazyRowRubyPtr ctx = (sqlite3LazyRowRubyPtr)data;
+
+    xfree(ctx->cells);
+    xfree(data);
+}
+
+static size_t
+lazy_row_memsize(const void *data)
+{
+    const sqlite3LazyRowRubyPtr ctx = (const sqlite3LazyRowRubyPtr)data;
+    return sizeof(*ctx) + ctx->size;
+}
+
+static const rb_data_type_t lazy_row_type = {
+    "SQLite3::LazyRow",
+    {
+        lazy_row_mark,
+        lazy_row_deallocate,
+        lazy_row_memsize,
+        lazy_row_compact,
+    },
+    0,
+    0,
+    RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_WB_PROTECTED,
+};
+
+VALUE
+rb_sqlite3_lazy_row_new(sqlite3_stmt *stmt, VALUE columns, int dedup, rb_encoding *internal_encoding)
+{
+    sqlite3LazyRowRubyPtr ctx;
+    struct _sqlite3LazyRowCell *cells;
+    VALUE row;
+    int i, ncolumns = (int)RARRAY_LEN(columns);
+    size_t header, size, bytes = 0;
+    char *data;
+
+    row = TypedData_Make_Struct(cSqlite3LazyRow, sqlite3LazyRowRuby, &lazy_row_type, ctx);
+    RB_OBJ_WRITE(row, &ctx->columns, columns);
+    ctx->dedup = dedup;
+    ctx->internal_encoding = internal_encoding;
+
+    /* The cells, the decoded values and the TEXT and BLOB bytes share one
+     * allocation. Asking for each value's length first also settles its
+     * representation, so the pointers read below stay valid. */
+    for (i = 0; i < ncolumns; i++) {
+        switch (sqlite3_column_type(stmt, i)) {
+            case SQLITE_TEXT:
+                sqlite3_column_text(stmt, i);
+                bytes += (size_t)sqlite3_column_bytes(stmt, i);
+                break;
+            case SQLITE_BLOB:
+                sqlite3_column_blob(stmt, i);
+                bytes += (size_t)sqlite3_column_bytes(stmt, i);
+                break;
+        }
+    }
+
+    header = (sizeof(struct _sqlite3LazyRowCell) + sizeof(VALUE)) * (size_t)ncolumns;
+    size = header + bytes;
+    cells = xmalloc(size ? size : 1);
+    ctx->cells = cells;
+    ctx->values = (VALUE *)(cells + ncolumns);
+    ctx->data = (char *)cells + header;
+    ctx->size = size;
+
+    data = ctx->data;
+    for (i = 0; i < ncolumns; i++) {
+        struct _sqlite3LazyRowCell *cell = &cells[i];
+
+        ctx->values[i] = Qundef;
+        cell->type = sqlite3_column_type(stmt, i);
+        cell->len = 0;
+
+        switch (cell->type) {
+            case SQLITE_INTEGER:
+                cell->as.i = sqlite3_column_int64(stmt, i);
+                break;
+            case SQLITE_FLOAT:
+                cell->as.d = sqlite3_column_double(stmt, i);
+                break;
+            case SQLITE_TEXT:
+            case SQLITE_BLOB: {
+                const void *src = cell->type == SQLITE_TEXT
+                                  ? (const void *)sqlite3_column_text(stmt, i)
+                                  : sqlite3_column_blob(stmt, i);
+                cell->len = (long)sqlite3_column_bytes(stmt, i);
+                cell->as.offset = (long)(data - ctx->data);
+                if (cell->len) { memcpy(data, src, (size_t)cell->len); }
+                data += cell->len;
+            }
+            break;
+        }
+    }
+    ctx->ncolumns = ncolumns;
+
+    return row;
+}
+
+VALUE
+rb_sqlite3_cell_value(const struct _sqlite3LazyRowCell *cell, const char *data, int dedup, rb_encoding *internal_encoding)
+{
+    switch (cell->type) {
+        case SQLITE_INTEGER:
+            return LL2NUM(cell->as.i);
+        case SQLITE_FLOAT:
+            return rb_float_new(cell->as.d);
+        case SQLITE_TEXT:
+            return rb_sqlite3_text_value(data + cell->as.offset, cell->len, dedup, internal_encoding);
+        case SQLITE_BLOB:
+            return rb_obj_freeze(rb_str_new(data + cell->as.offset, cell->len));
+        default:
+            return Qnil;
+    }
+}
+
+/* Returns the Ruby value of column +i+, converting it on first use. */
+static VALUE
+lazy_row_value(VALUE self, sqlite3LazyRowRubyPtr ctx, int i)
+{
+    VALUE val = ctx->values[i];
+
+    if (val != Qundef) { return val; }
+
+    val = rb_sqlite3_cell_value(&ctx->cells[i], ctx->data, ctx->dedup, ctx->internal_encoding);
+
+    RB_OBJ_WRITE(self, &ctx->values[i], val);
+
+    return val;
+}
+
+/* Returns the index of the column named +name+, or -1. When several columns
+ * share a name, the last one is found, as in the Hash returned by #to_h. */
+static int
+lazy_row_column_index(sqlite3LazyRowRubyPtr ctx, VALUE name)
+{
+    int i;
+
+    for (i = ctx->ncolumns - 1; i >= 0; i--) {
+        VALUE column = RARRAY_AREF(ctx->columns, i);
+        if (!NIL_P(column) && RSTRING_LEN(column) == RSTRING_LEN(name)
+                && memcmp(RSTRING_PTR(column), RSTRING_PTR(name), (size_t)RSTRING_LEN(name)) == 0) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/* call-seq:
+ *   row[index] → value
+ *   row[name] → value
+ *
+ * Returns the value of the column at +index+ (negative indexes count from the
+ * last column), or of the column named +name+, a String or Symbol. Returns
+ * +nil+ if there is no such column. The value is converted the way
+ * Statement#step converts it the first time it is read, and the same object is
+ * returned afterwards.
+ */
+static VALUE
+aref(VALUE self, VALUE key)
+{
+    sqlite3LazyRowRubyPtr ctx;
+    long i;
+
+    TypedData_Get_Struct(self, sqlite3LazyRowRuby, &lazy_row_type, ctx);
+
+    if (RB_INTEGER_TYPE_P(key)) {
+        i = NUM2LONG(key);
+        if (i < 0) { i += ctx->ncolumns; }
+        if (i < 0 || i >= ctx->ncolumns) { return Qnil; }
+    } else {
+        if (SYMBOL_P(key)) { key = rb_sym2str(key); }
+        i = lazy_row_column_index(ctx, StringValue(key));
+        if (i < 0) { return Qnil; }
+    }
+
+    return lazy_row_value(self, ctx, (int)i);
+}
+
+/* call-seq: row.to_a
+ *
+ * Returns the values of the row as a frozen Array, like Statement#step.
+ */
+static VALUE
+to_a(VALUE self)
+{
+    sqlite3LazyRowRubyPtr ctx;
+    VALUE list;
+    int i;
+
+    TypedData_Get_Struct(self, sqlite3LazyRowRuby, &lazy_row_type, ctx);
+
+    list = rb_ary_new_capa(ctx->ncolumns);
+    for (i = 0; i < ctx->ncolumns; i++) {
+        rb_ary_push(list, lazy_row_value(self, ctx, i));
+    }
+
+    return rb_obj_freeze(list);
+}
+
+/* call-seq: row.to_h
+ *
+ * Returns the row as a Hash of column name to value, like
+ * Statement#step_hash.
+ */
+static VALUE
+to_h(VALUE self)
+{
+    sqlite3LazyRowRubyPtr ctx;
+    VALUE hash;
+    int i;
+
+    TypedData_Get_Struct(self, sqlite3LazyRowRuby, &lazy_row_type, ctx);
+
+    hash = rb_hash_new();
+    for (i = 0; i < ctx->ncolumns; i++) {
+        rb_hash_aset(hash, RARRAY_AREF(ctx->columns, i), lazy_row_value(self, ctx, i));
+    }
+
+    return hash;
+}
+
+/* call-seq: row.columns
+ *
+ * Returns the frozen Array of column names.
+ */
+static VALUE
+columns(VALUE self)
+{
+    sqlite3LazyRowRubyPtr ctx;
+    TypedData_Get_Struct(self, sqlite3LazyRowRuby, &lazy_row_type, ctx);
+
+    return ctx->columns;
+}
+
+/* call-seq: row.size
+ *
+ * Returns the number of columns.
+ */
+static VALUE
+size(VALUE self)
+{
+    sqlite3LazyRowRubyPtr ctx;
+    TypedData_Get_Struct(self, sqlite3LazyRowRuby, &lazy_row_type, ctx);
+
+    return INT2NUM(ctx->ncolumns);
+}
+
+void
+init_sqlite3_lazy_row(void)
+{
+#if 0
+    VALUE mSqlite3 = rb_define_module("SQLite3");
+#endif
+    cSqlite3LazyRow = rb_define_class_under(mSqlite3, "LazyRow", rb_cObject);
+
+    rb_undef_alloc_func(cSqlite3LazyRow);
+    rb_define_method(cSqlite3LazyRow, "[]", aref, 1);
+    rb_define_method(cSqlite3LazyRow, "to_a", to_a, 0);
+    rb_define_method(cSqlite3LazyRow, "to_h", to_h, 0);
+    rb_define_method(cSqlite3LazyRow, "columns", columns, 0);
+    rb_define_method(cSqlite3LazyRow, "size", size, 0);
+    rb_define_alias(cSqlite3LazyRow, "length", "size");
+}
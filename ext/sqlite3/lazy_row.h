@@ -0,0 +1,45 @@
+#ifndef SQLITE3_LAZY_ROW_RUBY
+#define SQLITE3_LAZY_ROW_RUBY
+
+#include <sqlite3_ruby.h>
+
+/* A column value as it was stored in the row. TEXT and BLOB values point into
+ * the row's buffer. */
+struct _sqlite3LazyRowCell {
+    int type;
+    long len;
+    union {
+        sqlite3_int64 i;
+        double d;
+        long offset;
+    } as;
+};
+
+struct _sqlite3LazyRowRuby {
+    VALUE columns;
+    int ncolumns;
+    int dedup;
+    rb_encoding *internal_encoding;
+    struct _sqlite3LazyRowCell *cells;
+    VALUE *values;
+    char *data;
+    size_t size;
+};
+
+typedef struct _sqlite3LazyRowRuby sqlite3LazyRowRuby;
+typedef sqlite3LazyRowRuby *sqlite3LazyRowRubyPtr;
+
+extern VALUE cSqlite3LazyRow;
+
+void init_sqlite3_lazy_row();
+
+/* Copies the current row of +stmt+ into a new LazyRow whose columns are named
+ * by the frozen Array +columns+. */
+VALUE rb_sqlite3_lazy_row_new(sqlite3_stmt *stmt, VALUE columns, int dedup, rb_encoding *internal_encoding);
+
+/* Converts +cell+, whose TEXT or BLOB bytes are in +data+, into the Ruby value
+ * a LazyRow returns for it. */
+VALUE rb_sqlite3_cell_value(const struct _sqlite3LazyRowCell *cell, const char *data, int dedup,
+                            rb_encoding *internal_encoding);
+
+#endif
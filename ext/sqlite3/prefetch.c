@@ -0,0 +1,470 @@
+#include <sqlite3_ruby.h>
+#include <ruby/thread_native.h>
+
+/* Statement#each_prefetched hands the stepping of a statement to a worker
+ * thread, which steps it with the GVL released and copies the raw values of
+ * each batch of rows into one of +depth+ buffers, while the calling thread
+ * converts the batches it is handed into Ruby rows and yields them. The worker
+ * waits while every buffer is full, and the caller while every one is empty.
+ * The buffers are used in turn, as a ring. */
+
+/* The status of a batch that could not be copied for lack of memory. */
+#define PREFETCH_NOMEM (-1)
+
+struct prefetch_batch {
+    struct _sqlite3LazyRowCell *cells;
+    char *data;
+    size_t data_len;
+    size_t data_capa;
+    long nrows;
+    /* SQLITE_ROW if more rows may follow, otherwise the status that ended
+     * the statement */
+    int status;
+};
+
+struct prefetch_state {
+    sqlite3_stmt *st;
+    int ncolumns;
+    long batch_size;
+    int depth;
+    struct prefetch_batch *batches;
+    /* the next batch to hand to the caller, and the number of filled ones */
+    int head;
+    int ready;
+    int cancelled;
+    int stepping;
+    int woken;
+    int finished;
+    rb_nativethread_lock_t lock;
+    rb_nativethread_cond_t cond;
+};
+
+struct prefetch_args {
+    VALUE self;
+    sqlite3StmtRubyPtr ctx;
+    struct prefetch_state *state;
+    VALUE worker;
+    /* set once the statement was stepped to its end, or failed */
+    int ended;
+};
+
+/* Copies the current row of the statement to the end of +batch+. Runs without
+ * the GVL, so the TEXT and BLOB bytes are kept with malloc. Returns 0 if they
+ * could not be. */
+static int
+prefetch_copy_row(struct prefetch_state *state, struct prefetch_batch *batch)
+{
+    sqlite3_stmt *stmt = state->st;
+    struct _sqlite3LazyRowCell *cells = batch->cells + batch->nrows * state->ncolumns;
+    size_t bytes = 0;
+    int i;
+
+    /* As in LazyRow, asking for each value's length first also settles its
+     * representation, so the pointers read below stay valid. */
+    for (i = 0; i < state->ncolumns; i++) {
+        cells[i].type = sqlite3_column_type(stmt, i);
+        cells[i].len = 0;
+        switch (cells[i].type) {
+            case SQLITE_TEXT:
+                sqlite3_column_text(stmt, i);
+                cells[i].len = (long)sqlite3_column_bytes(stmt, i);
+                break;
+            case SQLITE_BLOB:
+                sqlite3_column_blob(stmt, i);
+                cells[i].len = (long)sqlite3_column_bytes(stmt, i);
+                break;
+        }
+        bytes += (size_t)cells[i].len;
+    }
+
+    if (batch->data_len + bytes > batch->data_capa) {
+        size_t capa = batch->data_capa ? batch->data_capa : 4096;
+        char *data;
+
+        while (capa < batch->data_len + bytes) { capa *= 2; }
+        data = realloc(batch->data, capa);
+        if (!data) { return 0; }
+        batch->data = data;
+        batch->data_capa = capa;
+    }
+
+    for (i = 0; i < state->ncolumns; i++) {
+        struct _sqlite3LazyRowCell *cell = &cells[i];
+
+        switch (cell->type) {
+            case SQLITE_INTEGER:
+                cell->as.i = sqlite3_column_int64(stmt, i);
+                break;
+            case SQLITE_FLOAT:
+                cell->as.d = sqlite3_column_double(stmt, i);
+                break;
+            case SQLITE_TEXT:
+            case SQLITE_BLOB: {
+                const void *src = cell->type == SQLITE_TEXT
+                                  ? (const void *)sqlite3_column_text(stmt, i)
+                                  : sqlite3_column_blob(stmt, i);
+                cell->as.offset = (long)batch->data_len;
+                if (cell->len) { memcpy(batch->data + batch->data_len, src, (size_t)cell->len); }
+                batch->data_len += (size_t)cell->len;
+            }
+            break;
+        }
+    }
+    batch->nrows++;
+
+    return 1;
+}
+
+/* The worker's loop, run without the GVL: fills the next free batch, hands it
+ * over, and stops after the batch that ends the statement. */
+static void *
+prefetch_loop(void *data)
+{
+    struct prefetch_state *state = (struct prefetch_state *)data;
+    int status = SQLITE_ROW;
+
+    while (status == SQLITE_ROW) {
+        struct prefetch_batch *batch = NULL;
+
+        rb_native_mutex_lock(&state->lock);
+        while (state->ready == state->depth && !state->cancelled) {
+            rb_native_cond_wait(&state->cond, &state->lock);
+        }
+        if (!state->cancelled) {
+            batch = &state->batches[(state->head + state->ready) % state->depth];
+            state->stepping = 1;
+        }
+        rb_native_mutex_unlock(&state->lock);
+
+        if (!batch) { break; }
+
+        batch->nrows = 0;
+        batch->data_len = 0;
+        while (batch->nrows < state->batch_size) {
+            status = rb_sqlite3_step_released(state->st);
+            if (status != SQLITE_ROW) { break; }
+            if (!prefetch_copy_row(state, batch)) {
+                status = PREFETCH_NOMEM;
+                break;
+            }
+        }
+        batch->status = status;
+
+        rb_native_mutex_lock(&state->lock);
+        state->stepping = 0;
+        state->ready++;
+        rb_native_cond_broadcast(&state->cond);
+        rb_native_mutex_unlock(&state->lock);
+    }
+
+    return NULL;
+}
+
+/* Stops the worker, interrupting the step it is in, if any. Called when the
+ * caller leaves the iteration and when the worker's thread is killed. */
+static void
+prefetch_cancel(void *data)
+{
+    struct prefetch_state *state = (struct prefetch_state *)data;
+    int stepping;
+
+    rb_native_mutex_lock(&state->lock);
+    state->cancelled = 1;
+    stepping = state->stepping;
+    rb_native_cond_broadcast(&state->cond);
+    rb_native_mutex_unlock(&state->lock);
+
+    if (stepping) {
+        sqlite3_interrupt(sqlite3_db_handle(state->st));
+    }
+}
+
+/* The body of the worker thread. Returns the exception raised by a Ruby
+ * callback during a step, if any. */
+static VALUE
+prefetch_worker(void *data)
+{
+    struct prefetch_state *state = (struct prefetch_state *)data;
+    VALUE error;
+
+    /* the "2" variant leaves interrupts to the end of the thread */
+    rb_thread_call_without_gvl2(prefetch_loop, data, prefetch_cancel, data);
+
+    error = rb_errinfo();
+    rb_set_errinfo(Qnil);
+
+    rb_native_mutex_lock(&state->lock);
+    state->finished = 1;
+    rb_native_cond_broadcast(&state->cond);
+    rb_native_mutex_unlock(&state->lock);
+
+    return error;
+}
+
+static void *
+prefetch_wait(void *data)
+{
+    struct prefetch_state *state = (struct prefetch_state *)data;
+
+    rb_native_mutex_lock(&state->lock);
+    while (!state->ready && !state->finished && !state->woken) {
+        rb_native_cond_wait(&state->cond, &state->lock);
+    }
+    rb_native_mutex_unlock(&state->lock);
+
+    return NULL;
+}
+
+static void
+prefetch_wake(void *data)
+{
+    struct prefetch_state *state = (struct prefetch_state *)data;
+
+    rb_native_mutex_lock(&state->lock);
+    state->woken = 1;
+    rb_native_cond_broadcast(&state->cond);
+    rb_native_mutex_unlock(&state->lock);
+}
+
+/* Waits, without the GVL, for the worker to fill the next batch. Returns NULL
+ * if the worker stopped without handing over the batch that ends the
+ * statement. */
+static struct prefetch_batch *
+prefetch_next_batch(struct prefetch_state *state)
+{
+    struct prefetch_batch *batch = NULL;
+
+    rb_native_mutex_lock(&state->lock);
+    while (!state->ready && !state->finished) {
+        state->woken = 0;
+        rb_native_mutex_unlock(&state->lock);
+        rb_thread_call_without_gvl(prefetch_wait, state, prefetch_wake, state);
+        rb_native_mutex_lock(&state->lock);
+    }
+    if (state->ready) {
+        batch = &state->batches[state->head];
+    }
+    rb_native_mutex_unlock(&state->lock);
+
+    return batch;
+}
+
+/* Converts the rows of +batch+ into frozen Arrays, as LazyRow converts values. */
+static VALUE
+prefetch_batch_rows(struct prefetch_args *args, struct prefetch_batch *batch)
+{
+    struct prefetch_state *state = args->state;
+    rb_encoding *internal_encoding = rb_default_internal_encoding();
+    int dedup = args->ctx->flags & SQLITE3_RB_STATEMENT_DEDUP_TEXT;
+    VALUE rows = rb_ary_new_capa(batch->nrows);
+    long i;
+    int j;
+
+    for (i = 0; i < batch->nrows; i++) {
+        const struct _sqlite3LazyRowCell *cells = batch->cells + i * state->ncolumns;
+        VALUE row = rb_ary_new_capa(state->ncolumns);
+
+        for (j = 0; j < state->ncolumns; j++) {
+            rb_ary_push(row, rb_sqlite3_cell_value(&cells[j], batch->data, dedup, internal_encoding));
+        }
+        rb_ary_push(rows, rb_obj_freeze(row));
+    }
+
+    return rows;
+}
+
+static VALUE
+prefetch_body(VALUE data)
+{
+    struct prefetch_args *args = (struct prefetch_args *)data;
+    struct prefetch_state *state = args->state;
+
+    for (;;) {
+        struct prefetch_batch *batch = prefetch_next_batch(state);
+        VALUE rows, error;
+        long i;
+        int status;
+
+        if (!batch) {
+            rb_raise(rb_path2class("SQLite3::InterruptException"), "prefetching was stopped");
+        }
+
+        rows = prefetch_batch_rows(args, batch);
+        status = batch->status;
+
+        /* hand the buffer back before yielding, so the worker can refill it */
+        rb_native_mutex_lock(&state->lock);
+        state->head = (state->head + 1) % state->depth;
+        state->ready--;
+        rb_native_cond_broadcast(&state->cond);
+        rb_native_mutex_unlock(&state->lock);
+
+        for (i = 0; i < RARRAY_LEN(rows); i++) {
+            rb_yield(RARRAY_AREF(rows, i));
+        }
+
+        if (status == SQLITE_ROW) { continue; }
+        args->ended = 1;
+        if (status == SQLITE_DONE) {
+            args->ctx->done_p = 1;
+            return Qnil;
+        }
+
+        /* the worker stopped after this batch */
+        error = rb_funcall(args->worker, rb_intern("value"), 0);
+        if (status == PREFETCH_NOMEM) { rb_memerror(); }
+        if (!NIL_P(error)) { rb_exc_raise(error); }
+
+        sqlite3_reset(state->st);
+        args->ctx->done_p = 0;
+        CHECK(sqlite3_db_handle(state->st), status);
+        return Qnil;
+    }
+}
+
+static VALUE
+prefetch_join(VALUE worker)
+{
+    return rb_funcall(worker, rb_intern("join"), 0);
+}
+
+static VALUE
+prefetch_ensure(VALUE data)
+{
+    struct prefetch_args *args = (struct prefetch_args *)data;
+    struct prefetch_state *state = args->state;
+    VALUE error = Qnil;
+    int tag = 0, i;
+
+    prefetch_cancel(state);
+
+    /* The worker uses the buffers until it ends, so wait for it even if the
+     * wait is interrupted, and raise the interrupt afterwards. */
+    for (;;) {
+        int join_tag = 0;
+
+        rb_protect(prefetch_join, args->worker, &join_tag);
+        if (!join_tag) { break; }
+        if (!tag) {
+            tag = join_tag;
+            error = rb_errinfo();
+        }
+    }
+
+    /* rows stepped ahead are lost, and the step may have been interrupted */
+    if (!args->ended) {
+        sqlite3_reset(state->st);
+        args->ctx->done_p = 0;
+    }
+    args->ctx->flags &= ~SQLITE3_RB_STATEMENT_PREFETCHING;
+
+    for (i = 0; i < state->depth; i++) {
+        xfree(state->batches[i].cells);
+        free(state->batches[i].data);
+    }
+    xfree(state->batches);
+    rb_native_cond_destroy(&state->cond);
+    rb_native_mutex_destroy(&state->lock);
+    xfree(state);
+
+    if (tag) {
+        if (rb_obj_is_kind_of(error, rb_eException)) { rb_set_errinfo(error); }
+        rb_jump_tag(tag);
+    }
+    RB_GC_GUARD(error);
+
+    return Qnil;
+}
+
+/* Yields the rows of the statement stepped on the calling thread, in batches
+ * of +batch_size+. */
+static VALUE
+prefetch_on_this_thread(VALUE self, VALUE batch_size)
+{
+    VALUE rows;
+    long i;
+
+    while (RARRAY_LEN(rows = rb_funcall(self, rb_intern("step_many"), 1, batch_size)) > 0) {
+        for (i = 0; i < RARRAY_LEN(rows); i++) {
+            rb_yield(RARRAY_AREF(rows, i));
+        }
+    }
+
+    return self;
+}
+
+/* Is invoked by calling stmt.each_prefetched(batch: batch_size, depth: depth)
+ *
+ * Steps the statement to the end on a worker thread, up to +depth+ batches of
+ * +batch_size+ rows ahead of the rows yielded.
+ */
+static VALUE
+prefetch(VALUE self, VALUE batch_size, VALUE depth)
+{
+    sqlite3StmtRubyPtr ctx;
+    struct prefetch_args args;
+    struct prefetch_state *state;
+    long size = NUM2LONG(batch_size);
+    int count = NUM2INT(depth), i;
+
+    ctx = sqlite3_statement_unwrap(self);
+
+    if (ctx->db->flags & SQLITE3_RB_DATABASE_DISCARDED) {
+        rb_raise(rb_path2class("SQLite3::Exception"), "cannot use a statement associated with a discarded database");
+    }
+    if (!ctx->st) {
+        rb_raise(rb_path2class("SQLite3::Exception"), "cannot use a closed statement");
+    }
+    if (ctx->flags & SQLITE3_RB_STATEMENT_PREFETCHING) {
+        rb_raise(rb_path2class("SQLite3::Exception"), "cannot use a statement while it is being prefetched");
+    }
+    if (size < 1 || count < 1) {
+        rb_raise(rb_eArgError, "batch size and depth must be positive");
+    }
+
+    if (ctx->done_p) { return self; }
+
+#ifdef RB_THREAD_LOCAL_SPECIFIER
+    /* A worker inside a Ruby callback waits for the GVL while holding the
+     * connection's mutex, and a block using the connection would wait for that
+     * mutex while holding the GVL. */
+    if (rb_sqlite3_ruby_callbacks_p(ctx->db)) {
+        return prefetch_on_this_thread(self, batch_size);
+    }
+#else
+    /* without thread-local storage the callbacks can't tell whether they hold
+     * the GVL */
+    return prefetch_on_this_thread(self, batch_size);
+#endif
+
+    state = ZALLOC(struct prefetch_state);
+    state->st = ctx->st;
+    state->ncolumns = sqlite3_column_count(ctx->st);
+    state->batch_size = size;
+    state->depth = count;
+    state->batches = ZALLOC_N(struct prefetch_batch, count);
+    for (i = 0; i < count; i++) {
+        state->batches[i].cells = ALLOC_N(struct _sqlite3LazyRowCell, state->ncolumns ? size * state->ncolumns : 1);
+    }
+    rb_native_mutex_initialize(&state->lock);
+    rb_native_cond_initialize(&state->cond);
+
+    args.self = self;
+    args.ctx = ctx;
+    args.state = state;
+    args.ended = 0;
+
+    args.worker = rb_thread_create(prefetch_worker, state);
+    ctx->flags |= SQLITE3_RB_STATEMENT_PREFETCHING;
+
+    rb_ensure(prefetch_body, (VALUE)&args, prefetch_ensure, (VALUE)&args);
+    RB_GC_GUARD(args.worker);
+
+    return self;
+}
+
+void
+init_sqlite3_prefetch(void)
+{
+    rb_define_private_method(cSqlite3Statement, "prefetch", prefetch, 2);
+}
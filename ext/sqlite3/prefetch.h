@@ -0,0 +1,8 @@
+#ifndef SQLITE3_PREFETCH_RUBY
+#define SQLITE3_PREFETCH_RUBY
+
+#include <sqlite3_ruby.h>
+
+void init_sqlite3_prefetch();
+
+#endif
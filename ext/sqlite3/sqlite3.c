@@ -194,9 +194,14 @@ Init_sqlite3_native(void)
     init_sqlite3_constants();
     init_sqlite3_database();
     init_sqlite3_statement();
+    init_sqlite3_lazy_row();
+    init_sqlite3_prefetch();
+    init_sqlite3_type_translator();
+    init_sqlite3_json();
 #ifdef HAVE_SQLITE3_BACKUP_INIT
     init_sqlite3_backup();
 #endif
+    init_sqlite3_blob_stream();
     rb_define_singleton_method(mSqlite3, "sqlcipher?", using_sqlcipher, 0);
     rb_define_singleton_method(mSqlite3, "libversion", libversion, 0);
     rb_define_singleton_method(mSqlite3, "threadsafe", threadsafe_p, 0);
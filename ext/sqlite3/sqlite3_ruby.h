@@ -13,6 +13,7 @@
 #endif
 
 #include <ruby/encoding.h>
+#include <ruby/thread.h>
 
 #define USASCII_P(_obj) (rb_enc_get_index(_obj) == rb_usascii_encindex())
 #define UTF8_P(_obj) (rb_enc_get_index(_obj) == rb_utf8_encindex())
@@ -41,6 +42,11 @@ extern VALUE cSqlite3Blob;
 #include <statement.h>
 #include <exception.h>
 #include <backup.h>
+#include <blob_stream.h>
+#include <lazy_row.h>
+#include <prefetch.h>
+#include <type_translator.h>
+#include <json.h>
 #include <timespec.h>
 
 int bignum_to_int64(VALUE big, sqlite3_int64 *result);
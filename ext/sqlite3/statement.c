@@ -4,12 +4,38 @@
   if (!_ctxt->st) \
     rb_raise(rb_path2class("SQLite3::Exception"), "cannot use a closed statement");
 
+#define REQUIRE_IDLE_STMT(_ctxt) \
+  if (_ctxt->flags & SQLITE3_RB_STATEMENT_PREFETCHING) \
+    rb_raise(rb_path2class("SQLite3::Exception"), "cannot use a statement while it is being prefetched");
+
 #define REQUIRE_LIVE_DB(_ctxt) \
   if (_ctxt->db->flags & SQLITE3_RB_DATABASE_DISCARDED) \
     rb_raise(rb_path2class("SQLite3::Exception"), "cannot use a statement associated with a discarded database");
 
 VALUE cSqlite3Statement;
 
+#ifndef HAVE_RB_HASH_NEW_CAPA
+#define rb_hash_new_capa(_capa) rb_hash_new()
+#endif
+
+static void
+statement_mark(void *data)
+{
+    sqlite3StmtRubyPtr s = (sqlite3StmtRubyPtr)data;
+
+    int i;
+
+    rb_gc_mark(s->columns);
+    rb_gc_mark(s->bind_names);
+    rb_gc_mark(s->translators);
+    rb_gc_mark(s->column_translators);
+    for (i = 0; i < s->decode_plan_len; i++) {
+        rb_gc_mark(s->decode_plan[i].callable);
+    }
+    /* sqlite holds raw pointers into these, so they must not move. */
+    rb_sqlite3_pin_array_and_contents(s->bound_values);
+}
+
 static void
 statement_deallocate(void *data)
 {
@@ -19,6 +45,7 @@ statement_deallocate(void *data)
         sqlite3_finalize(s->st);
     }
 
+    xfree(s->decode_plan);
     xfree(data);
 }
 
@@ -27,13 +54,13 @@ statement_memsize(const void *data)
 {
     const sqlite3StmtRubyPtr s = (const sqlite3StmtRubyPtr)data;
     // NB: can't account for s->st because the type is incomplete.
-    return sizeof(*s);
+    return sizeof(*s) + sizeof(*s->decode_plan) * (size_t)s->decode_plan_len;
 }
 
 static const rb_data_type_t statement_type = {
     "SQLite3::Backup",
     {
-        NULL,
+        statement_mark,
         statement_deallocate,
         statement_memsize,
     },
@@ -49,14 +76,49 @@ allocate(VALUE klass)
     return TypedData_Make_Struct(klass, sqlite3StmtRuby, &statement_type, ctx);
 }
 
+sqlite3StmtRubyPtr
+sqlite3_statement_unwrap(VALUE stmt)
+{
+    sqlite3StmtRubyPtr ctx;
+    TypedData_Get_Struct(stmt, sqlite3StmtRuby, &statement_type, ctx);
+    return ctx;
+}
+
+/* Copies the per-statement settings of the database to the statement. */
+static void
+stmt_inherit_settings(VALUE self, sqlite3StmtRubyPtr ctx)
+{
+    if (ctx->translators != ctx->db->type_translators) {
+        RB_OBJ_WRITE(self, &ctx->translators, ctx->db->type_translators);
+        ctx->decode_plan_len = 0;
+    }
+
+    ctx->flags &= ~(SQLITE3_RB_STATEMENT_RELEASE_GVL | SQLITE3_RB_STATEMENT_DEDUP_TEXT |
+                    SQLITE3_RB_STATEMENT_NONBLOCKING);
+
+    if (ctx->db->flags & SQLITE3_RB_DATABASE_RELEASE_GVL) {
+        ctx->flags |= SQLITE3_RB_STATEMENT_RELEASE_GVL;
+    }
+    if (ctx->db->flags & SQLITE3_RB_DATABASE_NONBLOCKING) {
+        ctx->flags |= SQLITE3_RB_STATEMENT_RELEASE_GVL | SQLITE3_RB_STATEMENT_NONBLOCKING;
+    }
+    if (ctx->db->flags & SQLITE3_RB_DATABASE_DEDUP_TEXT) {
+        ctx->flags |= SQLITE3_RB_STATEMENT_DEDUP_TEXT;
+    }
+}
+
 static VALUE
-prepare(VALUE self, VALUE db, VALUE sql)
+prepare(int argc, VALUE *argv, VALUE self)
 {
-    sqlite3RubyPtr db_ctx = sqlite3_database_unwrap(db);
+    VALUE db, sql, persistent;
+    sqlite3RubyPtr db_ctx;
     sqlite3StmtRubyPtr ctx;
     const char *tail = NULL;
     int status;
 
+    rb_scan_args(argc, argv, "21", &db, &sql, &persistent);
+    db_ctx = sqlite3_database_unwrap(db);
+
     StringValue(sql);
 
     TypedData_Get_Struct(self, sqlite3StmtRuby, &statement_type, ctx);
@@ -66,6 +128,16 @@ prepare(VALUE self, VALUE db, VALUE sql)
      * variable will keep it from being GCed. */
     ctx->db = db_ctx;
 
+#ifdef HAVE_SQLITE3_PREPARE_V3
+    status = sqlite3_prepare_v3(
+                 db_ctx->db,
+                 (const char *)StringValuePtr(sql),
+                 (int)RSTRING_LEN(sql),
+                 RTEST(persistent) ? SQLITE_PREPARE_PERSISTENT : 0,
+                 &ctx->st,
+                 &tail
+             );
+#else
 #ifdef HAVE_SQLITE3_PREPARE_V2
     status = sqlite3_prepare_v2(
 #else
@@ -77,10 +149,13 @@ prepare(VALUE self, VALUE db, VALUE sql)
                  &ctx->st,
                  &tail
              );
+#endif
 
     CHECK_PREPARE(db_ctx->db, status, StringValuePtr(sql));
     timespecclear(&db_ctx->stmt_deadline);
 
+    stmt_inherit_settings(self, ctx);
+
     return rb_utf8_str_new_cstr(tail);
 }
 
@@ -97,6 +172,7 @@ sqlite3_rb_close(VALUE self)
     TypedData_Get_Struct(self, sqlite3StmtRuby, &statement_type, ctx);
 
     REQUIRE_OPEN_STMT(ctx);
+    REQUIRE_IDLE_STMT(ctx);
 
     sqlite3_finalize(ctx->st);
     ctx->st = NULL;
@@ -104,6 +180,65 @@ sqlite3_rb_close(VALUE self)
     return self;
 }
 
+/* Clears the bindings, releasing any Strings bound without copying. */
+static void
+stmt_clear_bindings(sqlite3StmtRubyPtr ctx)
+{
+    sqlite3_clear_bindings(ctx->st);
+    if (ctx->bound_values) {
+        rb_ary_clear(ctx->bound_values);
+    }
+}
+
+int
+rb_sqlite3_statement_checkout(VALUE self)
+{
+    sqlite3StmtRubyPtr ctx;
+    TypedData_Get_Struct(self, sqlite3StmtRuby, &statement_type, ctx);
+
+    if (!ctx->st) { return 0; }
+
+    /* behave like a statement prepared now */
+    timespecclear(&ctx->db->stmt_deadline);
+    stmt_inherit_settings(self, ctx);
+
+    return 1;
+}
+
+int
+rb_sqlite3_statement_recycle(VALUE self)
+{
+    sqlite3StmtRubyPtr ctx;
+    TypedData_Get_Struct(self, sqlite3StmtRuby, &statement_type, ctx);
+
+    if (!ctx->st) { return 0; }
+
+    sqlite3_reset(ctx->st);
+    stmt_clear_bindings(ctx);
+    ctx->done_p = 0;
+
+    /* Column names and types may change if the schema does before the next
+     * checkout. */
+    RB_OBJ_WRITE(self, &ctx->columns, Qfalse);
+    ctx->decode_plan_len = 0;
+    rb_ivar_set(self, rb_intern("@columns"), Qnil);
+    rb_ivar_set(self, rb_intern("@types"), Qnil);
+
+    return 1;
+}
+
+void
+rb_sqlite3_statement_finalize(VALUE self)
+{
+    sqlite3StmtRubyPtr ctx;
+    TypedData_Get_Struct(self, sqlite3StmtRuby, &statement_type, ctx);
+
+    if (ctx->st) {
+        sqlite3_finalize(ctx->st);
+        ctx->st = NULL;
+    }
+}
+
 /* call-seq: stmt.closed?
  *
  * Returns true if the statement has been closed.
@@ -119,27 +254,20 @@ closed_p(VALUE self)
     return Qfalse;
 }
 
-static VALUE
-step(VALUE self)
+/* Steps the statement once, re-raising any exception left behind by a Ruby
+ * callback that sqlite invoked during the step. */
+static int
+stmt_step(sqlite3StmtRubyPtr ctx)
 {
-    sqlite3StmtRubyPtr ctx;
-    sqlite3_stmt *stmt;
-    int value, length;
-    VALUE list;
-    rb_encoding *internal_encoding;
-
-    TypedData_Get_Struct(self, sqlite3StmtRuby, &statement_type, ctx);
-
-    REQUIRE_LIVE_DB(ctx);
-    REQUIRE_OPEN_STMT(ctx);
-
-    if (ctx->done_p) { return Qnil; }
-
-    internal_encoding = rb_default_internal_encoding();
+    int status;
 
-    stmt = ctx->st;
+    if (ctx->flags & SQLITE3_RB_STATEMENT_RELEASE_GVL) {
+        status = rb_sqlite3_step_without_gvl(sqlite3_db_handle(ctx->st), ctx->st,
+                                             ctx->flags & SQLITE3_RB_STATEMENT_NONBLOCKING);
+    } else {
+        status = sqlite3_step(ctx->st);
+    }
 
-    value = sqlite3_step(stmt);
     if (rb_errinfo() != Qnil) {
         /* some user defined function was invoked as a callback during step and
          * it raised an exception that has been suppressed until step returns.
@@ -149,199 +277,1427 @@ step(VALUE self)
         rb_exc_raise(exception);
     }
 
-    length = sqlite3_column_count(stmt);
-    list = rb_ary_new2((long)length);
+    return status;
+}
 
-    switch (value) {
-        case SQLITE_ROW: {
-            int i;
-            for (i = 0; i < length; i++) {
-                VALUE val;
+#if HAVE_RB_ENC_INTERNED_STR_CSTR
+static VALUE
+interned_utf8_cstr(const char *str)
+{
+    return rb_enc_interned_str_cstr(str, rb_utf8_encoding());
+}
+#else
+static VALUE
+interned_utf8_cstr(const char *str)
+{
+    VALUE rb_str = rb_utf8_str_new_cstr(str);
+    return rb_funcall(rb_str, rb_intern("-@"), 0);
+}
+#endif
 
-                switch (sqlite3_column_type(stmt, i)) {
-                    case SQLITE_INTEGER:
-                        val = LL2NUM(sqlite3_column_int64(stmt, i));
-                        break;
-                    case SQLITE_FLOAT:
-                        val = rb_float_new(sqlite3_column_double(stmt, i));
-                        break;
-                    case SQLITE_TEXT: {
-                        val = rb_utf8_str_new(
-                                  (const char *)sqlite3_column_text(stmt, i),
-                                  (long)sqlite3_column_bytes(stmt, i)
-                              );
-                        if (internal_encoding) {
-                            val = rb_str_export_to_enc(val, internal_encoding);
-                        }
-                        rb_obj_freeze(val);
-                    }
-                    break;
-                    case SQLITE_BLOB: {
-                        val = rb_str_new(
-                                  (const char *)sqlite3_column_blob(stmt, i),
-                                  (long)sqlite3_column_bytes(stmt, i)
-                              );
-                        rb_obj_freeze(val);
-                    }
-                    break;
-                    case SQLITE_NULL:
-                        val = Qnil;
-                        break;
-                    default:
-                        rb_raise(rb_eRuntimeError, "bad type");
-                }
+#ifdef HAVE_RB_ENC_INTERNED_STR
+static VALUE
+interned_utf8_str(const char *str, long len)
+{
+    return rb_enc_interned_str(str, len, rb_utf8_encoding());
+}
+#else
+static VALUE
+interned_utf8_str(const char *str, long len)
+{
+    VALUE rb_str = rb_utf8_str_new(str, len);
+    return rb_funcall(rb_str, rb_intern("-@"), 0);
+}
+#endif
 
-                rb_ary_store(list, (long)i, val);
-            }
+VALUE
+rb_sqlite3_text_value(const char *text, long len, int dedup, rb_encoding *internal_encoding)
+{
+    VALUE val;
+
+    if (dedup) {
+        val = interned_utf8_str(text, len);
+        if (internal_encoding) {
+            val = rb_funcall(rb_str_export_to_enc(val, internal_encoding), rb_intern("-@"), 0);
         }
-        break;
-        case SQLITE_DONE:
-            ctx->done_p = 1;
-            return Qnil;
-            break;
-        default:
-            sqlite3_reset(stmt);
-            ctx->done_p = 0;
-            CHECK(sqlite3_db_handle(ctx->st), value);
+        return val;
     }
 
-    rb_obj_freeze(list);
-
-    return list;
+    val = rb_utf8_str_new(text, len);
+    if (internal_encoding) {
+        val = rb_str_export_to_enc(val, internal_encoding);
+    }
+    return rb_obj_freeze(val);
 }
 
-/* call-seq: stmt.bind_param(key, value)
- *
- * Binds value to the named (or positional) placeholder. If +param+ is a
- * Fixnum, it is treated as an index for a positional placeholder.
- * Otherwise it is used as the name of the placeholder to bind to.
- *
- * Type mapping from Ruby to SQLite3:
- * - +nil+        → NULL
- * - Integer      → INTEGER (or REAL when outside the signed int64 range)
- * - Float        → REAL
- * - SQLite3::Blob → BLOB
- * - String with Encoding::ASCII_8BIT (a.k.a. BINARY) → BLOB
- * - String with Encoding::UTF_16LE or Encoding::UTF_16BE → TEXT (bound as UTF-16)
- * - String (all other encodings) → TEXT (re-encoded to UTF-8 if necessary)
- * - Any other type → raises RuntimeError
- *
- * Note: if you have a string with only ASCII characters but ASCII-8BIT
- * encoding and want it bound as TEXT rather than BLOB, re-encode it first:
- *
- *   stmt.bind_param(1, my_binary_str.encode(Encoding::UTF_8))
- *
- * See also #bind_params.
- */
-static VALUE
-bind_param(VALUE self, VALUE key, VALUE value)
+/* The storage class that values of a column declared as +decltype+ have, or
+ * 0 if they may have any. These are the types allowed in STRICT tables. */
+static unsigned char
+decltype_storage_class(const char *decltype)
 {
-    sqlite3StmtRubyPtr ctx;
-    int status;
-    int index;
-
-    TypedData_Get_Struct(self, sqlite3StmtRuby, &statement_type, ctx);
+    if (!decltype) { return 0; }
+    if (!sqlite3_stricmp(decltype, "INTEGER") || !sqlite3_stricmp(decltype, "INT")) { return SQLITE_INTEGER; }
+    if (!sqlite3_stricmp(decltype, "REAL")) { return SQLITE_FLOAT; }
+    if (!sqlite3_stricmp(decltype, "TEXT")) { return SQLITE_TEXT; }
+    if (!sqlite3_stricmp(decltype, "BLOB")) { return SQLITE_BLOB; }
+    return 0;
+}
 
-    REQUIRE_LIVE_DB(ctx);
-    REQUIRE_OPEN_STMT(ctx);
+/* Drops the cached column names and decode plan if the statement has been
+ * re-prepared (after a schema change, for example) since they were built, as
+ * the names and declared types may differ even if the column count doesn't. */
+static void
+stmt_check_reprepared(VALUE self, sqlite3StmtRubyPtr ctx)
+{
+#ifdef SQLITE_STMTSTATUS_REPREPARE
+    int reprepares = sqlite3_stmt_status(ctx->st, SQLITE_STMTSTATUS_REPREPARE, 0);
 
-    switch (TYPE(key)) {
-        case T_SYMBOL:
-            key = rb_funcall(key, rb_intern("to_s"), 0);
-        case T_STRING:
-            if (RSTRING_PTR(key)[0] != ':') { key = rb_str_plus(rb_str_new2(":"), key); }
-            index = sqlite3_bind_parameter_index(ctx->st, StringValuePtr(key));
-            break;
-        default:
-            index = (int)NUM2INT(key);
+    if (reprepares != ctx->reprepares) {
+        ctx->reprepares = reprepares;
+        RB_OBJ_WRITE(self, &ctx->columns, Qfalse);
+        ctx->decode_plan_len = 0;
     }
+#endif
+}
 
-    if (index == 0) {
-        rb_raise(rb_path2class("SQLite3::Exception"), "no such bind parameter");
+/* Returns the decode plan of the statement: the expected storage class of each
+ * result column, from its declared type, and its translator, chosen by
+ * #column_translators= or else by declared type. It is built once and rebuilt
+ * if the statement is re-prepared or the column count or the translators
+ * change. The storage
+ * class is only a hint, as NULLs, outer joins and non-STRICT tables can all
+ * produce values of another type, so every value is still checked against it.
+ * Custom translators are marked through the plan, so each is written with a
+ * write barrier. */
+static const struct _sqlite3StmtColumnPlan *
+stmt_decode_plan(VALUE self, sqlite3StmtRubyPtr ctx)
+{
+    int i, length = sqlite3_column_count(ctx->st);
+
+    stmt_check_reprepared(self, ctx);
+
+    if (!ctx->decode_plan || ctx->decode_plan_len != length) {
+        ctx->decode_plan_len = 0;
+        REALLOC_N(ctx->decode_plan, struct _sqlite3StmtColumnPlan, length ? length : 1);
+        for (i = 0; i < length; i++) {
+            const char *decltype = sqlite3_column_decltype(ctx->st, i);
+            struct _sqlite3StmtColumnPlan *plan = &ctx->decode_plan[i];
+
+            plan->storage_class = decltype_storage_class(decltype);
+            plan->translator = (unsigned char)rb_sqlite3_column_translator_for(
+                                   ctx->column_translators, i, sqlite3_column_name(ctx->st, i), &plan->callable);
+            if (!plan->translator) {
+                plan->translator = (unsigned char)rb_sqlite3_type_translator_for(ctx->translators, decltype, &plan->callable);
+            }
+            RB_OBJ_WRITTEN(self, Qundef, plan->callable);
+        }
+        ctx->decode_plan_len = length;
     }
 
-    switch (TYPE(value)) {
-        case T_STRING:
-            if (CLASS_OF(value) == cSqlite3Blob
-                    || rb_enc_get_index(value) == rb_ascii8bit_encindex()
-               ) {
-                status = sqlite3_bind_blob(
-                             ctx->st,
-                             index,
-                             (const char *)StringValuePtr(value),
-                             (int)RSTRING_LEN(value),
-                             SQLITE_TRANSIENT
-                         );
-            } else {
+    return ctx->decode_plan;
+}
 
+/* Converts column +i+ of the current row of the statement into a Ruby value.
+ * TEXT values of columns declared TEXT get their coderange computed now, while
+ * the bytes are in cache, so String operations don't have to scan them later. */
+static VALUE
+stmt_column_value(sqlite3StmtRubyPtr ctx, int i, rb_encoding *internal_encoding)
+{
+    sqlite3_stmt *stmt = ctx->st;
+    const struct _sqlite3StmtColumnPlan *plan = i < ctx->decode_plan_len ? &ctx->decode_plan[i] : NULL;
+    VALUE val;
 
-                if (UTF16_LE_P(value) || UTF16_BE_P(value)) {
-                    status = sqlite3_bind_text16(
-                                 ctx->st,
-                                 index,
-                                 (const char *)StringValuePtr(value),
-                                 (int)RSTRING_LEN(value),
-                                 SQLITE_TRANSIENT
-                             );
-                } else {
-                    if (!UTF8_P(value) || !USASCII_P(value)) {
-                        value = rb_str_encode(value, rb_enc_from_encoding(rb_utf8_encoding()), 0, Qnil);
-                    }
-                    status = sqlite3_bind_text(
-                                 ctx->st,
-                                 index,
-                                 (const char *)StringValuePtr(value),
-                                 (int)RSTRING_LEN(value),
-                                 SQLITE_TRANSIENT
-                             );
-                }
-            }
+    if (plan && plan->translator && plan->translator != SQLITE3_TRANSLATE_CUSTOM) {
+        val = rb_sqlite3_type_translate(plan->translator, stmt, i);
+        if (val != Qundef) { return val; }
+    }
+
+    switch (sqlite3_column_type(stmt, i)) {
+        case SQLITE_INTEGER:
+            val = LL2NUM(sqlite3_column_int64(stmt, i));
             break;
-        case T_BIGNUM: {
-            sqlite3_int64 num64;
-            if (bignum_to_int64(value, &num64)) {
-                status = sqlite3_bind_int64(ctx->st, index, num64);
+        case SQLITE_FLOAT:
+            val = rb_float_new(sqlite3_column_double(stmt, i));
+            break;
+        case SQLITE_TEXT: {
+            const char *text = (const char *)sqlite3_column_text(stmt, i);
+            long len = (long)sqlite3_column_bytes(stmt, i);
+            int dedup = ctx->flags & SQLITE3_RB_STATEMENT_DEDUP_TEXT;
+
+            if (!dedup && !internal_encoding && plan && plan->storage_class == SQLITE_TEXT) {
+                val = rb_utf8_str_new(text, len);
+                rb_enc_str_coderange(val);
+                rb_obj_freeze(val);
                 break;
             }
+
+            val = rb_sqlite3_text_value(text, len, dedup, internal_encoding);
         }
-        case T_FLOAT:
-            status = sqlite3_bind_double(ctx->st, index, NUM2DBL(value));
-            break;
-        case T_FIXNUM:
-            status = sqlite3_bind_int64(ctx->st, index, (sqlite3_int64)FIX2LONG(value));
-            break;
-        case T_NIL:
-            status = sqlite3_bind_null(ctx->st, index);
+        break;
+        case SQLITE_BLOB: {
+            val = rb_str_new(
+                      (const char *)sqlite3_column_blob(stmt, i),
+                      (long)sqlite3_column_bytes(stmt, i)
+                  );
+            rb_obj_freeze(val);
+        }
+        break;
+        case SQLITE_NULL:
+            val = Qnil;
             break;
         default:
-            rb_raise(rb_eRuntimeError, "can't prepare %s",
-                     rb_class2name(CLASS_OF(value)));
-            break;
+            rb_raise(rb_eRuntimeError, "bad type");
     }
 
-    CHECK(sqlite3_db_handle(ctx->st), status);
+    if (plan && plan->translator == SQLITE3_TRANSLATE_CUSTOM && !NIL_P(val)) {
+        val = rb_funcall(plan->callable, rb_intern("call"), 1, val);
+    }
 
-    return self;
+    return val;
 }
 
-/* call-seq: stmt.reset!
- *
- * Resets the statement. This is typically done internally, though it might
- * occasionally be necessary to manually reset the statement.
- */
+/* Rows up to this many columns are built on the stack and copied into their
+ * Array in one go. */
+#define STMT_STACK_ROW_COLUMNS 16
+
+/* Converts the current row of the statement into a frozen Array. */
 static VALUE
-reset_bang(VALUE self)
+stmt_row_to_ary(VALUE self, sqlite3StmtRubyPtr ctx, rb_encoding *internal_encoding)
 {
-    sqlite3StmtRubyPtr ctx;
-
-    TypedData_Get_Struct(self, sqlite3StmtRuby, &statement_type, ctx);
-
-    REQUIRE_LIVE_DB(ctx);
-    REQUIRE_OPEN_STMT(ctx);
+    int i, length;
+    VALUE list;
 
-    sqlite3_reset(ctx->st);
+    stmt_decode_plan(self, ctx);
+    length = ctx->decode_plan_len;
 
-    ctx->done_p = 0;
+    if (length <= STMT_STACK_ROW_COLUMNS) {
+        VALUE values[STMT_STACK_ROW_COLUMNS];
+
+        for (i = 0; i < length; i++) {
+            values[i] = stmt_column_value(ctx, i, internal_encoding);
+        }
+        list = rb_ary_new_from_values((long)length, values);
+    } else {
+        list = rb_ary_new2((long)length);
+        for (i = 0; i < length; i++) {
+            rb_ary_store(list, (long)i, stmt_column_value(ctx, i, internal_encoding));
+        }
+    }
+
+    return rb_obj_freeze(list);
+}
+
+/* Returns the interned column names of the statement, cached until the
+ * statement is re-prepared or the column count changes. */
+static VALUE
+stmt_columns(VALUE self, sqlite3StmtRubyPtr ctx)
+{
+    int i, length = sqlite3_column_count(ctx->st);
+    VALUE columns;
+
+    stmt_check_reprepared(self, ctx);
+    columns = ctx->columns;
+
+    if (!columns || RARRAY_LEN(columns) != length) {
+        columns = rb_ary_new2((long)length);
+        for (i = 0; i < length; i++) {
+            const char *name = sqlite3_column_name(ctx->st, i);
+            rb_ary_store(columns, (long)i, name ? interned_utf8_cstr(name) : Qnil);
+        }
+        rb_obj_freeze(columns);
+        RB_OBJ_WRITE(self, &ctx->columns, columns);
+    }
+
+    return columns;
+}
+
+/* Converts the current row of the statement into a Hash keyed by +columns+. */
+static VALUE
+stmt_row_to_hash(VALUE self, sqlite3StmtRubyPtr ctx, VALUE columns, rb_encoding *internal_encoding)
+{
+    long i, length = RARRAY_LEN(columns);
+    VALUE hash = rb_hash_new_capa(length);
+
+    stmt_decode_plan(self, ctx);
+    for (i = 0; i < length; i++) {
+        rb_hash_aset(hash, RARRAY_AREF(columns, i), stmt_column_value(ctx, (int)i, internal_encoding));
+    }
+
+    return hash;
+}
+
+/* Copies the current row of the statement into a LazyRow keyed by +columns+. */
+static VALUE
+stmt_row_to_lazy(sqlite3StmtRubyPtr ctx, VALUE columns, rb_encoding *internal_encoding)
+{
+    return rb_sqlite3_lazy_row_new(
+               ctx->st,
+               columns,
+               ctx->flags & SQLITE3_RB_STATEMENT_DEDUP_TEXT,
+               internal_encoding
+           );
+}
+
+/* Calls the current method again on the database's worker thread and returns
+ * its result, for a nonblocking statement run from a fiber scheduler. */
+static VALUE
+stmt_offload(VALUE self, int argc, const VALUE *argv)
+{
+    VALUE *args = ALLOCA_N(VALUE, argc + 1);
+
+    args[0] = ID2SYM(rb_frame_this_func());
+    MEMCPY(args + 1, argv, VALUE, argc);
+
+    return rb_funcallv(self, rb_intern("offload"), argc + 1, args);
+}
+
+#define OFFLOAD_IF_NONBLOCKING(self, ctx, argc, argv) \
+  if (((ctx)->flags & SQLITE3_RB_STATEMENT_NONBLOCKING) && rb_sqlite3_offload_p((ctx)->db)) \
+    return stmt_offload((self), (argc), (argv));
+
+/* Resets the statement after a failed step and raises the matching exception. */
+static void
+stmt_step_failed(sqlite3StmtRubyPtr ctx, int status)
+{
+    sqlite3_reset(ctx->st);
+    ctx->done_p = 0;
+    CHECK(sqlite3_db_handle(ctx->st), status);
+}
+
+static VALUE
+step(VALUE self)
+{
+    sqlite3StmtRubyPtr ctx;
+    int value;
+
+    TypedData_Get_Struct(self, sqlite3StmtRuby, &statement_type, ctx);
+
+    REQUIRE_LIVE_DB(ctx);
+    REQUIRE_OPEN_STMT(ctx);
+    REQUIRE_IDLE_STMT(ctx);
+    OFFLOAD_IF_NONBLOCKING(self, ctx, 0, NULL);
+
+    if (ctx->done_p) { return Qnil; }
+
+    value = stmt_step(ctx);
+
+    switch (value) {
+        case SQLITE_ROW:
+            return stmt_row_to_ary(self, ctx, rb_default_internal_encoding());
+        case SQLITE_DONE:
+            ctx->done_p = 1;
+            return Qnil;
+        default:
+            stmt_step_failed(ctx, value);
+    }
+
+    return Qnil;
+}
+
+/* call-seq: stmt.step_hash
+ *
+ * Steps the statement once and returns the row as a Hash of column name to
+ * value, or +nil+ when there are no more rows. The column names are interned
+ * Strings shared by every row.
+ */
+static VALUE
+step_hash(VALUE self)
+{
+    sqlite3StmtRubyPtr ctx;
+    int value;
+
+    TypedData_Get_Struct(self, sqlite3StmtRuby, &statement_type, ctx);
+
+    REQUIRE_LIVE_DB(ctx);
+    REQUIRE_OPEN_STMT(ctx);
+    REQUIRE_IDLE_STMT(ctx);
+    OFFLOAD_IF_NONBLOCKING(self, ctx, 0, NULL);
+
+    if (ctx->done_p) { return Qnil; }
+
+    value = stmt_step(ctx);
+
+    switch (value) {
+        case SQLITE_ROW:
+            return stmt_row_to_hash(self, ctx, stmt_columns(self, ctx), rb_default_internal_encoding());
+        case SQLITE_DONE:
+            ctx->done_p = 1;
+            return Qnil;
+        default:
+            stmt_step_failed(ctx, value);
+    }
+
+    return Qnil;
+}
+
+/* call-seq: stmt.step_lazy
+ *
+ * Steps the statement once and returns the row as a LazyRow, or +nil+ when
+ * there are no more rows. A LazyRow copies the row's raw values into a single
+ * buffer and only converts a column into a Ruby object when it is read, which
+ * is cheaper than #step when only a few columns of a wide row are used.
+ * LazyRow values are not translated by #type_translators.
+ */
+static VALUE
+step_lazy(VALUE self)
+{
+    sqlite3StmtRubyPtr ctx;
+    int value;
+
+    TypedData_Get_Struct(self, sqlite3StmtRuby, &statement_type, ctx);
+
+    REQUIRE_LIVE_DB(ctx);
+    REQUIRE_OPEN_STMT(ctx);
+    REQUIRE_IDLE_STMT(ctx);
+    OFFLOAD_IF_NONBLOCKING(self, ctx, 0, NULL);
+
+    if (ctx->done_p) { return Qnil; }
+
+    value = stmt_step(ctx);
+
+    switch (value) {
+        case SQLITE_ROW:
+            return stmt_row_to_lazy(ctx, stmt_columns(self, ctx), rb_default_internal_encoding());
+        case SQLITE_DONE:
+            ctx->done_p = 1;
+            return Qnil;
+        default:
+            stmt_step_failed(ctx, value);
+    }
+
+    return Qnil;
+}
+
+/* call-seq: stmt.step_into(row)
+ *
+ * Steps the statement once and replaces the contents of the Array +row+ with
+ * the values of the new row, as #step would return them, without allocating
+ * a new Array. Returns +row+, or +nil+ when there are no more rows.
+ */
+static VALUE
+step_into(VALUE self, VALUE row)
+{
+    sqlite3StmtRubyPtr ctx;
+    rb_encoding *internal_encoding;
+    int value, i, length;
+
+    TypedData_Get_Struct(self, sqlite3StmtRuby, &statement_type, ctx);
+
+    REQUIRE_LIVE_DB(ctx);
+    REQUIRE_OPEN_STMT(ctx);
+    REQUIRE_IDLE_STMT(ctx);
+    OFFLOAD_IF_NONBLOCKING(self, ctx, 1, &row);
+
+    Check_Type(row, T_ARRAY);
+    rb_check_frozen(row);
+
+    if (ctx->done_p) { return Qnil; }
+
+    value = stmt_step(ctx);
+
+    switch (value) {
+        case SQLITE_ROW:
+            internal_encoding = rb_default_internal_encoding();
+            stmt_decode_plan(self, ctx);
+            length = ctx->decode_plan_len;
+            for (i = 0; i < length; i++) {
+                rb_ary_store(row, (long)i, stmt_column_value(ctx, i, internal_encoding));
+            }
+            rb_ary_resize(row, (long)length);
+            return row;
+        case SQLITE_DONE:
+            ctx->done_p = 1;
+            return Qnil;
+        default:
+            stmt_step_failed(ctx, value);
+    }
+
+    return Qnil;
+}
+
+enum stmt_row_type {
+    STMT_ROW_ARRAY,
+    STMT_ROW_HASH,
+    STMT_ROW_LAZY
+};
+
+static VALUE
+stmt_step_many(VALUE self, VALUE max_rows, enum stmt_row_type row_type)
+{
+    sqlite3StmtRubyPtr ctx;
+    rb_encoding *internal_encoding;
+    VALUE columns = Qnil;
+    long max, i;
+    VALUE rows;
+
+    TypedData_Get_Struct(self, sqlite3StmtRuby, &statement_type, ctx);
+
+    REQUIRE_LIVE_DB(ctx);
+    REQUIRE_OPEN_STMT(ctx);
+    REQUIRE_IDLE_STMT(ctx);
+    OFFLOAD_IF_NONBLOCKING(self, ctx, 1, &max_rows);
+
+    max = NUM2LONG(max_rows);
+    if (max < 0) {
+        rb_raise(rb_eArgError, "negative row count");
+    }
+
+    rows = rb_ary_new_capa(max < 1024 ? max : 1024);
+
+    if (ctx->done_p) { return rows; }
+
+    internal_encoding = rb_default_internal_encoding();
+
+    for (i = 0; i < max; i++) {
+        int value = stmt_step(ctx);
+
+        if (value == SQLITE_ROW) {
+            VALUE row;
+            if (row_type != STMT_ROW_ARRAY && NIL_P(columns)) {
+                columns = stmt_columns(self, ctx);
+            }
+            switch (row_type) {
+                case STMT_ROW_HASH:
+                    row = stmt_row_to_hash(self, ctx, columns, internal_encoding);
+                    break;
+                case STMT_ROW_LAZY:
+                    row = stmt_row_to_lazy(ctx, columns, internal_encoding);
+                    break;
+                default:
+                    row = stmt_row_to_ary(self, ctx, internal_encoding);
+            }
+            rb_ary_push(rows, row);
+        } else if (value == SQLITE_DONE) {
+            ctx->done_p = 1;
+            break;
+        } else {
+            stmt_step_failed(ctx, value);
+        }
+    }
+
+    return rows;
+}
+
+/* call-seq: stmt.step_many(max_rows)
+ *
+ * Steps the statement up to +max_rows+ times in a single call and returns an
+ * Array of the rows, each a frozen Array as returned by #step. The returned
+ * Array holds fewer than +max_rows+ rows, and may be empty, once the statement
+ * has no more rows.
+ */
+static VALUE
+step_many(VALUE self, VALUE max_rows)
+{
+    return stmt_step_many(self, max_rows, STMT_ROW_ARRAY);
+}
+
+/* call-seq: stmt.step_many_hashes(max_rows)
+ *
+ * Like #step_many, but each row is a Hash as returned by #step_hash.
+ */
+static VALUE
+step_many_hashes(VALUE self, VALUE max_rows)
+{
+    return stmt_step_many(self, max_rows, STMT_ROW_HASH);
+}
+
+/* call-seq: stmt.step_many_lazy(max_rows)
+ *
+ * Like #step_many, but each row is a LazyRow as returned by #step_lazy.
+ */
+static VALUE
+step_many_lazy(VALUE self, VALUE max_rows)
+{
+    return stmt_step_many(self, max_rows, STMT_ROW_LAZY);
+}
+
+/* Steps the statement to its end in one native call, yielding each row (a
+ * LazyRow if +lazy+ is set) as soon as it is stepped. Leaving the block leaves
+ * the statement right after the last row yielded. Called by Statement#each.
+ */
+static VALUE
+each_row(VALUE self, VALUE lazy)
+{
+    sqlite3StmtRubyPtr ctx;
+    rb_encoding *internal_encoding = rb_default_internal_encoding();
+
+    TypedData_Get_Struct(self, sqlite3StmtRuby, &statement_type, ctx);
+
+    /* the block may close, reset or offload the statement between rows */
+    for (;;) {
+        VALUE row;
+        int value;
+
+        REQUIRE_LIVE_DB(ctx);
+        REQUIRE_OPEN_STMT(ctx);
+        REQUIRE_IDLE_STMT(ctx);
+
+        if ((ctx->flags & SQLITE3_RB_STATEMENT_NONBLOCKING) && rb_sqlite3_offload_p(ctx->db)) {
+            row = rb_funcall(self, RTEST(lazy) ? rb_intern("step_lazy") : rb_intern("step"), 0);
+            if (NIL_P(row)) { break; }
+            rb_yield(row);
+            continue;
+        }
+
+        if (ctx->done_p) { break; }
+
+        value = stmt_step(ctx);
+        if (value == SQLITE_DONE) {
+            ctx->done_p = 1;
+            break;
+        } else if (value != SQLITE_ROW) {
+            stmt_step_failed(ctx, value);
+        }
+
+        if (RTEST(lazy)) {
+            row = stmt_row_to_lazy(ctx, stmt_columns(self, ctx), internal_encoding);
+        } else {
+            row = stmt_row_to_ary(self, ctx, internal_encoding);
+        }
+        rb_yield(row);
+    }
+
+    return self;
+}
+
+/* call-seq:
+ *   stmt.fetch_columns → Hash
+ *   stmt.fetch_columns(max_rows) → Hash
+ *
+ * Steps through the remaining rows of the statement, or at most +max_rows+ of
+ * them, and returns a Hash of column name to an Array holding that column's
+ * values, converted as #step converts them. No per-row Array is allocated.
+ *
+ * When several columns share a name, the last one wins. Once the statement
+ * has no more rows the Arrays are empty.
+ */
+static VALUE
+fetch_columns(int argc, VALUE *argv, VALUE self)
+{
+    sqlite3StmtRubyPtr ctx;
+    rb_encoding *internal_encoding;
+    VALUE max_rows, columns, values, result;
+    long max, i, j, ncolumns;
+
+    TypedData_Get_Struct(self, sqlite3StmtRuby, &statement_type, ctx);
+
+    REQUIRE_LIVE_DB(ctx);
+    REQUIRE_OPEN_STMT(ctx);
+    REQUIRE_IDLE_STMT(ctx);
+    OFFLOAD_IF_NONBLOCKING(self, ctx, argc, argv);
+
+    rb_scan_args(argc, argv, "01", &max_rows);
+
+    max = NIL_P(max_rows) ? LONG_MAX : NUM2LONG(max_rows);
+    if (max < 0) {
+        rb_raise(rb_eArgError, "negative row count");
+    }
+
+    columns = stmt_columns(self, ctx);
+    ncolumns = RARRAY_LEN(columns);
+
+    values = rb_ary_new_capa(ncolumns);
+    for (j = 0; j < ncolumns; j++) {
+        rb_ary_push(values, rb_ary_new());
+    }
+
+    internal_encoding = rb_default_internal_encoding();
+    stmt_decode_plan(self, ctx);
+
+    for (i = 0; i < max && !ctx->done_p; i++) {
+        int value = stmt_step(ctx);
+
+        if (value == SQLITE_ROW) {
+            for (j = 0; j < ncolumns; j++) {
+                rb_ary_push(RARRAY_AREF(values, j), stmt_column_value(ctx, (int)j, internal_encoding));
+            }
+        } else if (value == SQLITE_DONE) {
+            ctx->done_p = 1;
+        } else {
+            stmt_step_failed(ctx, value);
+        }
+    }
+
+    result = rb_hash_new_capa(ncolumns);
+    for (j = 0; j < ncolumns; j++) {
+        rb_hash_aset(result, RARRAY_AREF(columns, j), RARRAY_AREF(values, j));
+    }
+
+    return result;
+}
+
+static void
+packed_cat_le64(VALUE str, sqlite3_uint64 bits)
+{
+    char buf[8];
+    int k;
+
+    for (k = 0; k < 8; k++) {
+        buf[k] = (char)((bits >> (8 * k)) & 0xff);
+    }
+
+    rb_str_buf_cat(str, buf, 8);
+}
+
+/* call-seq:
+ *   stmt.fetch_packed(column_types) → Hash
+ *   stmt.fetch_packed(column_types, max_rows) → Hash
+ *
+ * Steps through the remaining rows of the statement, or at most +max_rows+ of
+ * them, packing numeric columns into binary Strings without creating a Ruby
+ * object per value.
+ *
+ * +column_types+ is an Array with an entry per result column: +:integer+ packs
+ * the column as little-endian signed 64-bit integers (<tt>"q<"</tt>), +:real+
+ * (or +:float+) as little-endian doubles (<tt>"E"</tt>), and +nil+ skips the
+ * column. Columns past the end of the Array are skipped. Values of another
+ * storage class are converted the way sqlite3_column_int64() and
+ * sqlite3_column_double() convert them.
+ *
+ * Returns a Hash of column name to a two-element Array <tt>[data, nulls]</tt>.
+ * +data+ holds one 8-byte value per row, with NULLs written as zero. +nulls+
+ * is a bitmap with bit <tt>i % 8</tt> of byte <tt>i / 8</tt> set when row +i+
+ * is NULL.
+ *
+ *   stmt = db.prepare("select id, value from metrics")
+ *   packed = stmt.fetch_packed([:integer, :real])
+ *   ids = packed["id"][0].unpack("q<*")
+ */
+static VALUE
+fetch_packed(int argc, VALUE *argv, VALUE self)
+{
+    sqlite3StmtRubyPtr ctx;
+    VALUE column_types, max_rows, columns, buffers, result;
+    VALUE types_handle = 0;
+    int *types;
+    long max, i, j, ncolumns;
+
+    TypedData_Get_Struct(self, sqlite3StmtRuby, &statement_type, ctx);
+
+    REQUIRE_LIVE_DB(ctx);
+    REQUIRE_OPEN_STMT(ctx);
+    REQUIRE_IDLE_STMT(ctx);
+    OFFLOAD_IF_NONBLOCKING(self, ctx, argc, argv);
+
+    rb_scan_args(argc, argv, "11", &column_types, &max_rows);
+    Check_Type(column_types, T_ARRAY);
+
+    max = NIL_P(max_rows) ? LONG_MAX : NUM2LONG(max_rows);
+    if (max < 0) {
+        rb_raise(rb_eArgError, "negative row count");
+    }
+
+    columns = stmt_columns(self, ctx);
+    ncolumns = RARRAY_LEN(columns);
+
+    types = ALLOCV_N(int, types_handle, ncolumns);
+    buffers = rb_ary_new_capa(ncolumns * 2);
+    for (j = 0; j < ncolumns; j++) {
+        VALUE type = j < RARRAY_LEN(column_types) ? RARRAY_AREF(column_types, j) : Qnil;
+
+        if (NIL_P(type)) {
+            types[j] = SQLITE_NULL;
+        } else if (type == ID2SYM(rb_intern("integer"))) {
+            types[j] = SQLITE_INTEGER;
+        } else if (type == ID2SYM(rb_intern("real")) || type == ID2SYM(rb_intern("float"))) {
+            types[j] = SQLITE_FLOAT;
+        } else {
+            ALLOCV_END(types_handle);
+            rb_raise(rb_eArgError, "unknown packed column type: %"PRIsVALUE, rb_inspect(type));
+        }
+
+        rb_ary_push(buffers, rb_str_buf_new(0));
+        rb_ary_push(buffers, rb_str_buf_new(0));
+    }
+
+    for (i = 0; i < max && !ctx->done_p; i++) {
+        int value = stmt_step(ctx);
+
+        if (value == SQLITE_ROW) {
+            for (j = 0; j < ncolumns; j++) {
+                VALUE data, nulls;
+                sqlite3_uint64 bits = 0;
+
+                if (types[j] == SQLITE_NULL) { continue; }
+
+                data = RARRAY_AREF(buffers, j * 2);
+                nulls = RARRAY_AREF(buffers, j * 2 + 1);
+
+                if (i % 8 == 0) { rb_str_buf_cat(nulls, "\0", 1); }
+
+                if (sqlite3_column_type(ctx->st, (int)j) == SQLITE_NULL) {
+                    RSTRING_PTR(nulls)[i / 8] |= (char)(1 << (i % 8));
+                } else if (types[j] == SQLITE_INTEGER) {
+                    bits = (sqlite3_uint64)sqlite3_column_int64(ctx->st, (int)j);
+                } else {
+                    double d = sqlite3_column_double(ctx->st, (int)j);
+                    memcpy(&bits, &d, sizeof(bits));
+                }
+
+                packed_cat_le64(data, bits);
+            }
+        } else if (value == SQLITE_DONE) {
+            ctx->done_p = 1;
+        } else {
+            ALLOCV_END(types_handle);
+            stmt_step_failed(ctx, value);
+        }
+    }
+
+    result = rb_hash_new_capa(ncolumns);
+    for (j = 0; j < ncolumns; j++) {
+        if (types[j] == SQLITE_NULL) { continue; }
+        rb_hash_aset(result, RARRAY_AREF(columns, j),
+                     rb_ary_new_from_args(2, RARRAY_AREF(buffers, j * 2), RARRAY_AREF(buffers, j * 2 + 1)));
+    }
+    ALLOCV_END(types_handle);
+
+    return result;
+}
+
+/* Returns a frozen Hash mapping the statement's parameter names to their
+ * indexes, built on first use. A named parameter can be found by its full
+ * name (":name", "@name" or "$name") or by its bare name, which prefers the
+ * ":name" parameter if several differ only by prefix. */
+static VALUE
+stmt_bind_names(VALUE self, sqlite3StmtRubyPtr ctx)
+{
+    VALUE names = ctx->bind_names;
+    int i, count;
+
+    if (names) { return names; }
+
+    count = sqlite3_bind_parameter_count(ctx->st);
+    names = rb_hash_new();
+
+    for (i = 1; i <= count; i++) {
+        const char *name = sqlite3_bind_parameter_name(ctx->st, i);
+        VALUE bare;
+
+        if (!name) { continue; }
+
+        rb_hash_aset(names, interned_utf8_cstr(name), INT2FIX(i));
+        if (*name == '?') { continue; }
+
+        bare = interned_utf8_cstr(name + 1);
+        if (*name == ':' || !RTEST(rb_hash_lookup2(names, bare, Qfalse))) {
+            rb_hash_aset(names, bare, INT2FIX(i));
+        }
+    }
+
+    rb_obj_freeze(names);
+    RB_OBJ_WRITE(self, &ctx->bind_names, names);
+
+    return names;
+}
+
+/* Binds a frozen String without copying it. SQLite keeps pointing at the
+ * String's bytes until the parameter is rebound, the bindings are cleared or
+ * the statement is finalized, so the String is kept alive (and pinned) by the
+ * statement until then. */
+static int
+stmt_bind_pinned(VALUE self, sqlite3StmtRubyPtr ctx, int index, VALUE str, int blob_p)
+{
+    const char *ptr = RSTRING_PTR(str);
+    int status;
+
+#ifdef HAVE_SQLITE3_BIND_TEXT64
+    if (blob_p) {
+        status = sqlite3_bind_blob64(ctx->st, index, ptr, (sqlite3_uint64)RSTRING_LEN(str), SQLITE_STATIC);
+    } else {
+        status = sqlite3_bind_text64(ctx->st, index, ptr, (sqlite3_uint64)RSTRING_LEN(str), SQLITE_STATIC,
+                                     SQLITE_UTF8);
+    }
+#else
+    if (blob_p) {
+        status = sqlite3_bind_blob(ctx->st, index, ptr, (int)RSTRING_LEN(str), SQLITE_STATIC);
+    } else {
+        status = sqlite3_bind_text(ctx->st, index, ptr, (int)RSTRING_LEN(str), SQLITE_STATIC);
+    }
+#endif
+
+    if (status == SQLITE_OK) {
+        if (!ctx->bound_values) {
+            RB_OBJ_WRITE(self, &ctx->bound_values, rb_ary_new());
+        }
+        rb_ary_store(ctx->bound_values, index, str);
+    }
+
+    return status;
+}
+
+/* Drops the String pinned for parameter +index+, if any, once another value
+ * has been bound in its place. */
+static void
+stmt_unpin(sqlite3StmtRubyPtr ctx, int index)
+{
+    if (ctx->bound_values && index < RARRAY_LEN(ctx->bound_values)) {
+        rb_ary_store(ctx->bound_values, index, Qnil);
+    }
+}
+
+/* Binds +value+ to the parameter named or numbered by +key+. */
+static void
+stmt_bind(VALUE self, sqlite3StmtRubyPtr ctx, VALUE key, VALUE value)
+{
+    int status;
+    int index;
+    int pinned = 0;
+
+    switch (TYPE(key)) {
+        case T_SYMBOL:
+            key = rb_sym2str(key);
+        /* fall through */
+        case T_STRING:
+            index = FIX2INT(rb_hash_lookup2(stmt_bind_names(self, ctx), key, INT2FIX(0)));
+            break;
+        default:
+            index = (int)NUM2INT(key);
+    }
+
+    if (index == 0) {
+        rb_raise(rb_path2class("SQLite3::Exception"), "no such bind parameter");
+    }
+
+    /* The previous value stays pinned until the new one is bound: SQLite
+     * keeps pointing at it if converting the new one raises. */
+    switch (TYPE(value)) {
+        case T_STRING:
+            if (CLASS_OF(value) == cSqlite3Blob
+                    || rb_enc_get_index(value) == rb_ascii8bit_encindex()
+               ) {
+                if (OBJ_FROZEN(value)) {
+                    status = stmt_bind_pinned(self, ctx, index, value, 1);
+                    pinned = 1;
+                    break;
+                }
+                status = sqlite3_bind_blob(
+                             ctx->st,
+                             index,
+                             (const char *)StringValuePtr(value),
+                             (int)RSTRING_LEN(value),
+                             SQLITE_TRANSIENT
+                         );
+            } else {
+
+
+                if (UTF16_LE_P(value) || UTF16_BE_P(value)) {
+                    status = sqlite3_bind_text16(
+                                 ctx->st,
+                                 index,
+                                 (const char *)StringValuePtr(value),
+                                 (int)RSTRING_LEN(value),
+                                 SQLITE_TRANSIENT
+                             );
+                } else {
+                    if (!UTF8_P(value) && !USASCII_P(value)) {
+                        value = rb_str_encode(value, rb_enc_from_encoding(rb_utf8_encoding()), 0, Qnil);
+                    } else if (OBJ_FROZEN(value)) {
+                        status = stmt_bind_pinned(self, ctx, index, value, 0);
+                        pinned = 1;
+                        break;
+                    }
+                    status = sqlite3_bind_text(
+                                 ctx->st,
+                                 index,
+                                 (const char *)StringValuePtr(value),
+                                 (int)RSTRING_LEN(value),
+                                 SQLITE_TRANSIENT
+                             );
+                }
+            }
+            break;
+        case T_BIGNUM: {
+            sqlite3_int64 num64;
+            if (bignum_to_int64(value, &num64)) {
+                status = sqlite3_bind_int64(ctx->st, index, num64);
+                break;
+            }
+        }
+        case T_FLOAT:
+            status = sqlite3_bind_double(ctx->st, index, NUM2DBL(value));
+            break;
+        case T_FIXNUM:
+            status = sqlite3_bind_int64(ctx->st, index, (sqlite3_int64)FIX2LONG(value));
+            break;
+        case T_NIL:
+            status = sqlite3_bind_null(ctx->st, index);
+            break;
+        default:
+            if (rb_obj_is_kind_of(value, cSqlite3JSONB)) {
+                status = stmt_bind_pinned(self, ctx, index, rb_sqlite3_jsonb_dump(rb_sqlite3_jsonb_value(value)), 1);
+                pinned = 1;
+                break;
+            }
+            rb_raise(rb_eRuntimeError, "can't prepare %s",
+                     rb_class2name(CLASS_OF(value)));
+            break;
+    }
+
+    if (status == SQLITE_OK && !pinned) { stmt_unpin(ctx, index); }
+    CHECK(sqlite3_db_handle(ctx->st), status);
+}
+
+/* call-seq: stmt.bind_param(key, value)
+ *
+ * Binds value to the named (or positional) placeholder. If +param+ is a
+ * Fixnum, it is treated as an index for a positional placeholder.
+ * Otherwise it is used as the name of the placeholder to bind to, with or
+ * without its prefix character (<tt>:</tt>, <tt>@</tt> or <tt>$</tt>).
+ *
+ * Type mapping from Ruby to SQLite3:
+ * - +nil+        → NULL
+ * - Integer      → INTEGER (or REAL when outside the signed int64 range)
+ * - Float        → REAL
+ * - SQLite3::Blob → BLOB
+ * - String with Encoding::ASCII_8BIT (a.k.a. BINARY) → BLOB
+ * - String with Encoding::UTF_16LE or Encoding::UTF_16BE → TEXT (bound as UTF-16)
+ * - String (all other encodings) → TEXT (re-encoded to UTF-8 if necessary)
+ * - SQLite3::JSONB → BLOB, the wrapped value encoded in SQLite's JSONB format
+ * - Any other type → raises RuntimeError
+ *
+ * Note: if you have a string with only ASCII characters but ASCII-8BIT
+ * encoding and want it bound as TEXT rather than BLOB, re-encode it first:
+ *
+ *   stmt.bind_param(1, my_binary_str.encode(Encoding::UTF_8))
+ *
+ * Frozen Strings that need no transcoding are bound without being copied.
+ * The statement keeps them alive until the parameter is rebound, the
+ * bindings are cleared or the statement is closed.
+ *
+ * See also #bind_params.
+ */
+static VALUE
+bind_param(VALUE self, VALUE key, VALUE value)
+{
+    sqlite3StmtRubyPtr ctx;
+
+    TypedData_Get_Struct(self, sqlite3StmtRuby, &statement_type, ctx);
+
+    REQUIRE_LIVE_DB(ctx);
+    REQUIRE_OPEN_STMT(ctx);
+    REQUIRE_IDLE_STMT(ctx);
+
+    stmt_bind(self, ctx, key, value);
+
+    return self;
+}
+
+struct bind_hash_args {
+    VALUE self;
+    sqlite3StmtRubyPtr ctx;
+};
+
+static int
+stmt_bind_hash_i(VALUE key, VALUE value, VALUE data)
+{
+    struct bind_hash_args *args = (struct bind_hash_args *)data;
+    stmt_bind(args->self, args->ctx, key, value);
+    return ST_CONTINUE;
+}
+
+/* Binds one element of a bind_params argument list: a Hash binds by name and
+ * anything else binds to the next positional parameter. */
+static void
+stmt_bind_next(VALUE self, sqlite3StmtRubyPtr ctx, VALUE var, int *index)
+{
+    if (RB_TYPE_P(var, T_HASH)) {
+        struct bind_hash_args args;
+        args.self = self;
+        args.ctx = ctx;
+        rb_hash_foreach(var, stmt_bind_hash_i, (VALUE)&args);
+    } else {
+        stmt_bind(self, ctx, INT2FIX(*index), var);
+        (*index)++;
+    }
+}
+
+/* Binds a bind_params argument list, flattening any nested Arrays. */
+static void
+stmt_bind_values(VALUE self, sqlite3StmtRubyPtr ctx, int argc, const VALUE *argv)
+{
+    int i, index = 1;
+
+    for (i = 0; i < argc; i++) {
+        if (RB_TYPE_P(argv[i], T_ARRAY)) {
+            VALUE flat = rb_funcall(rb_ary_new_from_values(argc, argv), rb_intern("flatten"), 0);
+            long j;
+
+            for (j = 0; j < RARRAY_LEN(flat); j++) {
+                stmt_bind_next(self, ctx, RARRAY_AREF(flat, j), &index);
+            }
+            return;
+        }
+    }
+
+    for (i = 0; i < argc; i++) {
+        stmt_bind_next(self, ctx, argv[i], &index);
+    }
+}
+
+/* Binds +bind_vars+ the way Statement#bind_params binds a single argument. */
+static void
+stmt_bind_params(VALUE self, sqlite3StmtRubyPtr ctx, VALUE bind_vars)
+{
+    VALUE list = rb_check_array_type(bind_vars);
+    long i;
+    int index = 1;
+
+    if (NIL_P(list)) {
+        stmt_bind_values(self, ctx, 1, &bind_vars);
+        return;
+    }
+
+    for (i = 0; i < RARRAY_LEN(list); i++) {
+        if (RB_TYPE_P(RARRAY_AREF(list, i), T_ARRAY)) {
+            list = rb_funcall(list, rb_intern("flatten"), 0);
+            break;
+        }
+    }
+
+    for (i = 0; i < RARRAY_LEN(list); i++) {
+        stmt_bind_next(self, ctx, RARRAY_AREF(list, i), &index);
+    }
+}
+
+/* call-seq: stmt.bind_params(*bind_vars)
+ *
+ * Binds the given variables to the corresponding placeholders in the SQL
+ * text. Arrays are flattened; each Hash binds its values to the parameters
+ * named by its keys (see #bind_param), and every other value binds to the
+ * next positional parameter.
+ *
+ * See Database#execute for a description of the valid placeholder
+ * syntaxes, and #bind_param for how Ruby values map to SQLite3 types.
+ *
+ * Note: a String with Encoding::ASCII_8BIT (BINARY) is always bound as a
+ * BLOB, even when its bytes are all valid ASCII. If you want such a string
+ * compared or stored as TEXT, re-encode it before binding:
+ *
+ *   stmt.bind_params(my_binary_str.encode(Encoding::UTF_8))
+ *
+ * Example:
+ *
+ *   stmt = db.prepare( "select * from table where a=? and b=?" )
+ *   stmt.bind_params( 15, "hello" )
+ *
+ * See also #execute, #bind_param, Statement#bind_param, and
+ * Statement#bind_params.
+ */
+static VALUE
+bind_params(int argc, VALUE *argv, VALUE self)
+{
+    sqlite3StmtRubyPtr ctx;
+
+    TypedData_Get_Struct(self, sqlite3StmtRuby, &statement_type, ctx);
+
+    REQUIRE_LIVE_DB(ctx);
+    REQUIRE_OPEN_STMT(ctx);
+    REQUIRE_IDLE_STMT(ctx);
+
+    stmt_bind_values(self, ctx, argc, argv);
+
+    return self;
+}
+
+VALUE
+rb_sqlite3_statement_execute_all(VALUE self, VALUE bind_vars, int as_hash)
+{
+    sqlite3StmtRubyPtr ctx;
+    rb_encoding *internal_encoding = rb_default_internal_encoding();
+    int yield_p = rb_block_given_p();
+    VALUE columns = Qnil;
+    VALUE rows = yield_p ? Qnil : rb_ary_new();
+
+    TypedData_Get_Struct(self, sqlite3StmtRuby, &statement_type, ctx);
+
+    REQUIRE_LIVE_DB(ctx);
+    REQUIRE_OPEN_STMT(ctx);
+
+    stmt_bind_params(self, ctx, bind_vars);
+
+    for (;;) {
+        int value = stmt_step(ctx);
+        VALUE row;
+
+        if (value == SQLITE_DONE) {
+            ctx->done_p = 1;
+            break;
+        } else if (value != SQLITE_ROW) {
+            stmt_step_failed(ctx, value);
+        }
+
+        if (as_hash) {
+            if (NIL_P(columns)) { columns = stmt_columns(self, ctx); }
+            row = stmt_row_to_hash(self, ctx, columns, internal_encoding);
+        } else {
+            row = stmt_row_to_ary(self, ctx, internal_encoding);
+        }
+
+        if (yield_p) {
+            rb_yield(row);
+        } else {
+            rb_ary_push(rows, row);
+        }
+    }
+
+    return yield_p ? Qnil : rb_obj_freeze(rows);
+}
+
+struct execute_script_args {
+    VALUE self;             /* runs each statement of the script in turn */
+    VALUE sql;
+    VALUE bind_vars;
+    long bind_count;
+    const char *statement;  /* where the statement being run starts */
+    int index;              /* and its index in the script */
+};
+
+/* Finalizes the statement of the script being run, and forgets everything
+ * cached about it. */
+static void
+stmt_script_finalize(VALUE self, sqlite3StmtRubyPtr ctx)
+{
+    if (ctx->st) {
+        sqlite3_finalize(ctx->st);
+        ctx->st = NULL;
+    }
+    if (ctx->bound_values) {
+        rb_ary_clear(ctx->bound_values);
+    }
+    RB_OBJ_WRITE(self, &ctx->columns, Qfalse);
+    RB_OBJ_WRITE(self, &ctx->bind_names, Qfalse);
+    ctx->decode_plan_len = 0;
+    ctx->reprepares = 0;
+    ctx->done_p = 0;
+}
+
+/* Raises the error of preparing the statement at +sql+. Rather than the rest
+ * of the script, only the statement is quoted: up to where SQLite stopped
+ * parsing, or to the end of the line the error is on if that is further. */
+static void
+stmt_script_prepare_failed(sqlite3 *db, int status, const char *sql, const char *tail, const char *end)
+{
+    const char *quote_end = tail > sql && tail <= end ? tail : end;
+#ifdef HAVE_SQLITE3_ERROR_OFFSET
+    int offset = sqlite3_error_offset(db);
+
+    if (offset >= 0 && offset < end - sql && sql + offset >= quote_end) {
+        quote_end = memchr(sql + offset, '\n', (size_t)(end - sql - offset));
+        if (!quote_end) { quote_end = end; }
+    }
+#endif
+
+    rb_sqlite3_raise_with_sql_len(db, status, sql, quote_end - sql);
+}
+
+static VALUE
+stmt_execute_script_body(VALUE data)
+{
+    struct execute_script_args *args = (struct execute_script_args *)data;
+    sqlite3StmtRubyPtr ctx;
+    const char *p = RSTRING_PTR(args->sql), *end = RSTRING_END(args->sql), *tail;
+    VALUE result = Qnil;
+    int status;
+
+    TypedData_Get_Struct(args->self, sqlite3StmtRuby, &statement_type, ctx);
+
+    for (;;) {
+        while (p < end && ISSPACE(*p)) { p++; }
+        if (p == end) { break; }
+
+        args->statement = p;
+        tail = NULL;
+#ifdef HAVE_SQLITE3_PREPARE_V2
+        status = sqlite3_prepare_v2(ctx->db->db, p, (int)(end - p), &ctx->st, &tail);
+#else
+        status = sqlite3_prepare(ctx->db->db, p, (int)(end - p), &ctx->st, &tail);
+#endif
+        if (status != SQLITE_OK) { stmt_script_prepare_failed(ctx->db->db, status, p, tail, end); }
+
+        p = tail;
+        if (!ctx->st) { continue; } /* only a comment */
+
+        timespecclear(&ctx->db->stmt_deadline);
+        stmt_inherit_settings(args->self, ctx);
+        if (args->bind_count == sqlite3_bind_parameter_count(ctx->st)) {
+            stmt_bind_params(args->self, ctx, args->bind_vars);
+        }
+        result = step(args->self);
+
+        stmt_script_finalize(args->self, ctx);
+        args->index++;
+    }
+
+    return result;
+}
+
+VALUE
+rb_sqlite3_statement_execute_script(VALUE db, VALUE sql, VALUE bind_vars)
+{
+    struct execute_script_args args;
+    sqlite3StmtRubyPtr ctx;
+    VALUE result, error;
+    int state = 0;
+
+    StringValue(sql);
+    /* as Statement#initialize does */
+    if (!UTF8_P(sql) && !rb_enc_str_asciionly_p(sql)) {
+        sql = rb_str_encode(sql, rb_enc_from_encoding(rb_utf8_encoding()), 0, Qnil);
+    }
+    if (RB_TYPE_P(bind_vars, T_HASH)) {
+        args.bind_count = (long)RHASH_SIZE(bind_vars);
+    } else {
+        Check_Type(bind_vars, T_ARRAY);
+        args.bind_count = RARRAY_LEN(bind_vars);
+    }
+
+    /* A frozen copy shares the buffer, which bind parameters and translators
+     * then cannot modify under us. */
+    args.sql = rb_str_new_frozen(sql);
+    args.bind_vars = bind_vars;
+    args.statement = NULL;
+    args.index = 0;
+    args.self = rb_obj_alloc(cSqlite3Statement);
+    TypedData_Get_Struct(args.self, sqlite3StmtRuby, &statement_type, ctx);
+    ctx->db = sqlite3_database_unwrap(db);
+
+    result = rb_protect(stmt_execute_script_body, (VALUE)&args, &state);
+
+    if (state) {
+        error = rb_errinfo();
+        if (args.statement && rb_obj_is_kind_of(error, rb_path2class("SQLite3::Exception"))) {
+            rb_iv_set(error, "@statement_index", INT2FIX(args.index));
+            rb_iv_set(error, "@statement_offset", LONG2NUM(args.statement - RSTRING_PTR(args.sql)));
+            if (ctx->st && NIL_P(rb_ivar_get(error, rb_intern("@sql")))) {
+                rb_iv_set(error, "@sql", rb_utf8_str_new_cstr(sqlite3_sql(ctx->st)));
+                rb_iv_set(error, "@sql_offset", INT2FIX(-1));
+            }
+        }
+    }
+
+    stmt_script_finalize(args.self, ctx);
+    RB_GC_GUARD(args.sql);
+
+    if (state) { rb_jump_tag(state); }
+    return result;
+}
+
+struct execute_rows_args {
+    VALUE self;
+    sqlite3StmtRubyPtr ctx;
+    VALUE rows;
+    long changes;
+};
+
+/* Binds one row of parameters and steps the statement to the end. */
+static void
+stmt_execute_row(struct execute_rows_args *args, VALUE bind_vars)
+{
+    sqlite3StmtRubyPtr ctx = args->ctx;
+    int value;
+
+    REQUIRE_OPEN_STMT(ctx);
+
+    sqlite3_reset(ctx->st);
+    stmt_clear_bindings(ctx);
+    stmt_bind_params(args->self, ctx, bind_vars);
+
+    while ((value = stmt_step(ctx)) == SQLITE_ROW) {}
+
+    if (value != SQLITE_DONE) {
+        stmt_step_failed(ctx, value);
+    }
+
+    /* sqlite3_changes still reports the last write after a read-only statement */
+    if (!sqlite3_stmt_readonly(ctx->st)) {
+        args->changes += sqlite3_changes(sqlite3_db_handle(ctx->st));
+    }
+}
+
+static VALUE
+execute_row_i(RB_BLOCK_CALL_FUNC_ARGLIST(row, data))
+{
+    if (argc > 1) { row = rb_ary_new_from_values(argc, argv); }
+    stmt_execute_row((struct execute_rows_args *)data, row);
+    return Qnil;
+}
+
+static VALUE
+execute_rows_body(VALUE data)
+{
+    struct execute_rows_args *args = (struct execute_rows_args *)data;
+    long i;
+
+    if (RB_TYPE_P(args->rows, T_ARRAY)) {
+        for (i = 0; i < RARRAY_LEN(args->rows); i++) {
+            stmt_execute_row(args, RARRAY_AREF(args->rows, i));
+        }
+    } else {
+        rb_block_call(args->rows, rb_intern("each"), 0, NULL, execute_row_i, data);
+    }
+
+    return Qnil;
+}
+
+static VALUE
+execute_rows_ensure(VALUE data)
+{
+    struct execute_rows_args *args = (struct execute_rows_args *)data;
+
+    if (args->ctx->st) {
+        sqlite3_reset(args->ctx->st);
+    }
+    args->ctx->done_p = 0;
+
+    return Qnil;
+}
+
+/* call-seq: stmt.execute_rows(rows)
+ *
+ * Executes the statement once for each set of bind parameters in +rows+,
+ * and returns the total number of rows changed. See #execute_many.
+ */
+static VALUE
+execute_rows(VALUE self, VALUE rows)
+{
+    struct execute_rows_args args;
+
+    TypedData_Get_Struct(self, sqlite3StmtRuby, &statement_type, args.ctx);
+
+    REQUIRE_LIVE_DB(args.ctx);
+    REQUIRE_OPEN_STMT(args.ctx);
+    REQUIRE_IDLE_STMT(args.ctx);
+    OFFLOAD_IF_NONBLOCKING(self, args.ctx, 1, &rows);
+
+    args.self = self;
+    args.rows = rows;
+    args.changes = 0;
+
+    rb_ensure(execute_rows_body, (VALUE)&args, execute_rows_ensure, (VALUE)&args);
+
+    return LONG2NUM(args.changes);
+}
+
+/* call-seq: stmt.reset!
+ *
+ * Resets the statement. This is typically done internally, though it might
+ * occasionally be necessary to manually reset the statement.
+ */
+static VALUE
+reset_bang(VALUE self)
+{
+    sqlite3StmtRubyPtr ctx;
+
+    TypedData_Get_Struct(self, sqlite3StmtRuby, &statement_type, ctx);
+
+    REQUIRE_LIVE_DB(ctx);
+    REQUIRE_OPEN_STMT(ctx);
+    REQUIRE_IDLE_STMT(ctx);
+
+    sqlite3_reset(ctx->st);
+
+    ctx->done_p = 0;
 
     return self;
 }
@@ -360,8 +1716,9 @@ clear_bindings_bang(VALUE self)
 
     REQUIRE_LIVE_DB(ctx);
     REQUIRE_OPEN_STMT(ctx);
+    REQUIRE_IDLE_STMT(ctx);
 
-    sqlite3_clear_bindings(ctx->st);
+    stmt_clear_bindings(ctx);
 
     ctx->done_p = 0;
 
@@ -382,36 +1739,166 @@ done_p(VALUE self)
     return Qfalse;
 }
 
-/* call-seq: stmt.column_count
+/* call-seq: stmt.release_gvl = true
  *
- * Returns the number of columns to be returned for this statement
+ * When +true+, the GVL is released while SQLite steps this statement, so that
+ * other Ruby threads keep running during a slow query. Interrupting the
+ * stepping thread (for example with Thread#raise) calls Database#interrupt.
+ *
+ * Statements inherit this setting from Database#release_gvl= when they are
+ * prepared.
  */
 static VALUE
-column_count(VALUE self)
+set_release_gvl(VALUE self, VALUE enable)
 {
     sqlite3StmtRubyPtr ctx;
     TypedData_Get_Struct(self, sqlite3StmtRuby, &statement_type, ctx);
 
-    REQUIRE_LIVE_DB(ctx);
-    REQUIRE_OPEN_STMT(ctx);
+    if (RTEST(enable)) {
+        ctx->flags |= SQLITE3_RB_STATEMENT_RELEASE_GVL;
+    } else {
+        ctx->flags &= ~SQLITE3_RB_STATEMENT_RELEASE_GVL;
+    }
 
-    return INT2NUM(sqlite3_column_count(ctx->st));
+    return enable;
 }
 
-#if HAVE_RB_ENC_INTERNED_STR_CSTR
+/* call-seq: stmt.release_gvl?
+ *
+ * Returns +true+ if the GVL is released while stepping this statement.
+ */
 static VALUE
-interned_utf8_cstr(const char *str)
+release_gvl_p(VALUE self)
 {
-    return rb_enc_interned_str_cstr(str, rb_utf8_encoding());
+    sqlite3StmtRubyPtr ctx;
+    TypedData_Get_Struct(self, sqlite3StmtRuby, &statement_type, ctx);
+
+    return (ctx->flags & SQLITE3_RB_STATEMENT_RELEASE_GVL) ? Qtrue : Qfalse;
 }
-#else
+
+/* call-seq: stmt.dedup_text = true
+ *
+ * When +true+, TEXT values in the rows of this statement are returned as
+ * interned (deduplicated) frozen Strings, so a value that repeats across rows
+ * is the same object in every row. This saves memory and GC time for columns
+ * with few distinct values, but adds a lookup per value, which is wasted work
+ * for columns whose values are mostly distinct.
+ *
+ * Statements inherit this setting from Database#dedup_text= when they are
+ * prepared.
+ */
 static VALUE
-interned_utf8_cstr(const char *str)
+set_dedup_text(VALUE self, VALUE enable)
 {
-    VALUE rb_str = rb_utf8_str_new_cstr(str);
-    return rb_funcall(rb_str, rb_intern("-@"), 0);
+    sqlite3StmtRubyPtr ctx;
+    TypedData_Get_Struct(self, sqlite3StmtRuby, &statement_type, ctx);
+
+    if (RTEST(enable)) {
+        ctx->flags |= SQLITE3_RB_STATEMENT_DEDUP_TEXT;
+    } else {
+        ctx->flags &= ~SQLITE3_RB_STATEMENT_DEDUP_TEXT;
+    }
+
+    return enable;
 }
-#endif
+
+/* call-seq: stmt.dedup_text?
+ *
+ * Returns +true+ if TEXT values of this statement are deduplicated.
+ */
+static VALUE
+dedup_text_p(VALUE self)
+{
+    sqlite3StmtRubyPtr ctx;
+    TypedData_Get_Struct(self, sqlite3StmtRuby, &statement_type, ctx);
+
+    return (ctx->flags & SQLITE3_RB_STATEMENT_DEDUP_TEXT) ? Qtrue : Qfalse;
+}
+
+/* call-seq: stmt.type_translators = translators
+ *
+ * Sets the type translator registry of this statement, overriding the one
+ * inherited from Database#type_translators=, which describes the registry.
+ */
+static VALUE
+set_type_translators(VALUE self, VALUE translators)
+{
+    sqlite3StmtRubyPtr ctx;
+    TypedData_Get_Struct(self, sqlite3StmtRuby, &statement_type, ctx);
+
+    RB_OBJ_WRITE(self, &ctx->translators, rb_sqlite3_type_translators_normalize(translators));
+    ctx->decode_plan_len = 0;
+
+    return translators;
+}
+
+/* call-seq: stmt.type_translators
+ *
+ * Returns the type translator registry of this statement, or +nil+ if type
+ * translation is off.
+ */
+static VALUE
+type_translators(VALUE self)
+{
+    sqlite3StmtRubyPtr ctx;
+    TypedData_Get_Struct(self, sqlite3StmtRuby, &statement_type, ctx);
+
+    return RTEST(ctx->translators) ? ctx->translators : Qnil;
+}
+
+/* call-seq: stmt.column_translators = translators
+ *
+ * Chooses the translators of particular result columns, given as a Hash of
+ * column index or name to translator, or clears them with +nil+. They take
+ * precedence over #type_translators, and also apply to expressions, which
+ * have no declared type. Translators are described at
+ * Database#type_translators=.
+ *
+ *   stmt = db.prepare("select json_extract(doc, '$.tags') as tags from posts")
+ *   stmt.column_translators = { "tags" => :json }
+ *   stmt.to_a # => [[["sqlite", "ruby"]]]
+ */
+static VALUE
+set_column_translators(VALUE self, VALUE translators)
+{
+    sqlite3StmtRubyPtr ctx;
+    TypedData_Get_Struct(self, sqlite3StmtRuby, &statement_type, ctx);
+
+    RB_OBJ_WRITE(self, &ctx->column_translators, rb_sqlite3_column_translators_normalize(translators));
+    ctx->decode_plan_len = 0;
+
+    return translators;
+}
+
+/* call-seq: stmt.column_translators
+ *
+ * Returns the translators chosen with #column_translators=, or +nil+.
+ */
+static VALUE
+column_translators(VALUE self)
+{
+    sqlite3StmtRubyPtr ctx;
+    TypedData_Get_Struct(self, sqlite3StmtRuby, &statement_type, ctx);
+
+    return RTEST(ctx->column_translators) ? ctx->column_translators : Qnil;
+}
+
+/* call-seq: stmt.column_count
+ *
+ * Returns the number of columns to be returned for this statement
+ */
+static VALUE
+column_count(VALUE self)
+{
+    sqlite3StmtRubyPtr ctx;
+    TypedData_Get_Struct(self, sqlite3StmtRuby, &statement_type, ctx);
+
+    REQUIRE_LIVE_DB(ctx);
+    REQUIRE_OPEN_STMT(ctx);
+
+    return INT2NUM(sqlite3_column_count(ctx->st));
+}
+
 
 /* call-seq: stmt.column_name(index)
  *
@@ -730,10 +2217,27 @@ init_sqlite3_statement(void)
     rb_define_method(cSqlite3Statement, "close", sqlite3_rb_close, 0);
     rb_define_method(cSqlite3Statement, "closed?", closed_p, 0);
     rb_define_method(cSqlite3Statement, "bind_param", bind_param, 2);
+    rb_define_method(cSqlite3Statement, "bind_params", bind_params, -1);
     rb_define_method(cSqlite3Statement, "reset!", reset_bang, 0);
     rb_define_method(cSqlite3Statement, "clear_bindings!", clear_bindings_bang, 0);
     rb_define_method(cSqlite3Statement, "step", step, 0);
+    rb_define_method(cSqlite3Statement, "step_many", step_many, 1);
+    rb_define_method(cSqlite3Statement, "step_hash", step_hash, 0);
+    rb_define_method(cSqlite3Statement, "step_many_hashes", step_many_hashes, 1);
+    rb_define_method(cSqlite3Statement, "step_lazy", step_lazy, 0);
+    rb_define_method(cSqlite3Statement, "step_into", step_into, 1);
+    rb_define_method(cSqlite3Statement, "step_many_lazy", step_many_lazy, 1);
+    rb_define_method(cSqlite3Statement, "fetch_columns", fetch_columns, -1);
+    rb_define_method(cSqlite3Statement, "fetch_packed", fetch_packed, -1);
     rb_define_method(cSqlite3Statement, "done?", done_p, 0);
+    rb_define_method(cSqlite3Statement, "release_gvl=", set_release_gvl, 1);
+    rb_define_method(cSqlite3Statement, "release_gvl?", release_gvl_p, 0);
+    rb_define_method(cSqlite3Statement, "dedup_text=", set_dedup_text, 1);
+    rb_define_method(cSqlite3Statement, "dedup_text?", dedup_text_p, 0);
+    rb_define_method(cSqlite3Statement, "type_translators=", set_type_translators, 1);
+    rb_define_method(cSqlite3Statement, "type_translators", type_translators, 0);
+    rb_define_method(cSqlite3Statement, "column_translators=", set_column_translators, 1);
+    rb_define_method(cSqlite3Statement, "column_translators", column_translators, 0);
     rb_define_method(cSqlite3Statement, "column_count", column_count, 0);
     rb_define_method(cSqlite3Statement, "column_name", column_name, 1);
     rb_define_method(cSqlite3Statement, "column_decltype", column_decltype, 1);
@@ -748,7 +2252,9 @@ init_sqlite3_statement(void)
     rb_define_method(cSqlite3Statement, "memused", memused, 0);
 #endif
 
-    rb_define_private_method(cSqlite3Statement, "prepare", prepare, 2);
+    rb_define_private_method(cSqlite3Statement, "prepare", prepare, -1);
+    rb_define_private_method(cSqlite3Statement, "execute_rows", execute_rows, 1);
+    rb_define_private_method(cSqlite3Statement, "each_row", each_row, 1);
     rb_define_private_method(cSqlite3Statement, "stats_as_hash", stats_as_hash, 0);
     rb_define_private_method(cSqlite3Statement, "stat_for", stat_for, 1);
 }
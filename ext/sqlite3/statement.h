@@ -3,15 +3,58 @@
 
 #include <sqlite3_ruby.h>
 
+/* bits in the `flags` field */
+#define SQLITE3_RB_STATEMENT_RELEASE_GVL 0x01
+#define SQLITE3_RB_STATEMENT_DEDUP_TEXT 0x02
+#define SQLITE3_RB_STATEMENT_NONBLOCKING 0x04
+#define SQLITE3_RB_STATEMENT_PREFETCHING 0x08
+
+/* How the values of one result column are decoded. */
+struct _sqlite3StmtColumnPlan {
+    unsigned char storage_class;
+    unsigned char translator;
+    VALUE callable;
+};
+
 struct _sqlite3StmtRuby {
     sqlite3_stmt *st;
     sqlite3Ruby *db;
     int done_p;
+    int flags;
+    VALUE columns;
+    VALUE bind_names;
+    VALUE bound_values;
+    VALUE translators;
+    VALUE column_translators;
+    struct _sqlite3StmtColumnPlan *decode_plan;
+    int decode_plan_len;
+    int reprepares;
 };
 
 typedef struct _sqlite3StmtRuby sqlite3StmtRuby;
 typedef sqlite3StmtRuby *sqlite3StmtRubyPtr;
 
+extern VALUE cSqlite3Statement;
+
 void init_sqlite3_statement();
+sqlite3StmtRubyPtr sqlite3_statement_unwrap(VALUE stmt);
+
+/* Hooks for the database's statement cache. Checkout and recycle return 0 if
+ * the statement has been closed. */
+int rb_sqlite3_statement_checkout(VALUE stmt);
+int rb_sqlite3_statement_recycle(VALUE stmt);
+void rb_sqlite3_statement_finalize(VALUE stmt);
+
+/* Binds +bind_vars+ as Database#execute does and steps +stmt+ to the end,
+ * yielding each row or returning them all in a frozen Array. */
+VALUE rb_sqlite3_statement_execute_all(VALUE stmt, VALUE bind_vars, int as_hash);
+
+/* Runs each statement of the script +sql+ in turn, as Database#execute_batch
+ * does, and returns the first row of the last one. */
+VALUE rb_sqlite3_statement_execute_script(VALUE db, VALUE sql, VALUE bind_vars);
+
+/* Converts +len+ bytes of UTF-8 +text+ into a frozen String the way row
+ * values are converted, interning it when +dedup+ is set. */
+VALUE rb_sqlite3_text_value(const char *text, long len, int dedup, rb_encoding *internal_encoding);
 
 #endif
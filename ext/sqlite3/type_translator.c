@@ -0,0 +1,410 @@
+#include <sqlite3_ruby.h>
+
+static VALUE cDate;
+static int bigdecimal_loaded;
+static ID id_new, id_BigDecimal, id_call, id_to_s;
+static VALUE sym_time, sym_date, sym_boolean, sym_decimal, sym_json;
+/* { exception: false }, for BigDecimal() */
+static VALUE no_exception;
+
+/* Returns the registry key of a declared type: lowercased, without a size or
+ * precision ("DECIMAL(10, 2)" is "decimal") and without surrounding blanks. */
+static VALUE
+type_key(const char *name, long len)
+{
+    VALUE key;
+    long start = 0, end, i;
+    char *ptr;
+
+    for (end = 0; end < len && name[end] != '('; end++);
+    while (start < end && ISSPACE(name[start])) { start++; }
+    while (end > start && ISSPACE(name[end - 1])) { end--; }
+
+    key = rb_utf8_str_new(name + start, end - start);
+    ptr = RSTRING_PTR(key);
+    for (i = 0; i < end - start; i++) {
+        ptr[i] = (char)TOLOWER(ptr[i]);
+    }
+
+    return key;
+}
+
+static void
+check_translator(VALUE name, VALUE translator)
+{
+    if (SYMBOL_P(translator)) {
+        if (translator != sym_time && translator != sym_date && translator != sym_boolean
+                && translator != sym_decimal && translator != sym_json) {
+            rb_raise(rb_eArgError, "unknown type translator %"PRIsVALUE, rb_inspect(translator));
+        }
+        /* BigDecimal is a bundled gem: fail here rather than while stepping */
+        if (translator == sym_decimal && !bigdecimal_loaded) {
+            rb_require("bigdecimal");
+            bigdecimal_loaded = 1;
+        }
+    } else if (!rb_respond_to(translator, id_call)) {
+        rb_raise(rb_eArgError, "type translator for %"PRIsVALUE" must be a built-in translator name or respond to #call",
+                 rb_inspect(name));
+    }
+}
+
+static int
+normalize_i(VALUE name, VALUE translator, VALUE normalized)
+{
+    if (SYMBOL_P(name)) { name = rb_sym2str(name); }
+    StringValue(name);
+    check_translator(name, translator);
+
+    rb_hash_aset(normalized, type_key(RSTRING_PTR(name), RSTRING_LEN(name)), translator);
+
+    return ST_CONTINUE;
+}
+
+static int
+normalize_column_i(VALUE column, VALUE translator, VALUE normalized)
+{
+    if (SYMBOL_P(column)) { column = rb_sym2str(column); }
+    if (!RB_INTEGER_TYPE_P(column)) {
+        StringValue(column);
+        column = rb_str_new_frozen(column);
+    }
+    check_translator(column, translator);
+
+    rb_hash_aset(normalized, column, translator);
+
+    return ST_CONTINUE;
+}
+
+VALUE
+rb_sqlite3_type_translators_normalize(VALUE translators)
+{
+    VALUE normalized;
+
+    if (!RTEST(translators)) { return Qfalse; }
+    if (translators == Qtrue) {
+        translators = rb_const_get(rb_path2class("SQLite3::Database"), rb_intern("TYPE_TRANSLATORS"));
+    }
+
+    Check_Type(translators, T_HASH);
+    normalized = rb_hash_new();
+    rb_hash_foreach(translators, normalize_i, normalized);
+
+    return rb_obj_freeze(normalized);
+}
+
+VALUE
+rb_sqlite3_column_translators_normalize(VALUE translators)
+{
+    VALUE normalized;
+
+    if (!RTEST(translators)) { return Qfalse; }
+
+    Check_Type(translators, T_HASH);
+    normalized = rb_hash_new();
+    rb_hash_foreach(translators, normalize_column_i, normalized);
+
+    return rb_obj_freeze(normalized);
+}
+
+static enum rb_sqlite3_type_translator
+translator_kind(VALUE translator, VALUE *callable)
+{
+    *callable = Qnil;
+    if (NIL_P(translator)) { return SQLITE3_TRANSLATE_NONE; }
+    if (translator == sym_time) { return SQLITE3_TRANSLATE_TIME; }
+    if (translator == sym_date) { return SQLITE3_TRANSLATE_DATE; }
+    if (translator == sym_boolean) { return SQLITE3_TRANSLATE_BOOLEAN; }
+    if (translator == sym_decimal) { return SQLITE3_TRANSLATE_DECIMAL; }
+    if (translator == sym_json) { return SQLITE3_TRANSLATE_JSON; }
+
+    *callable = translator;
+    return SQLITE3_TRANSLATE_CUSTOM;
+}
+
+enum rb_sqlite3_type_translator
+rb_sqlite3_type_translator_for(VALUE translators, const char *decltype, VALUE *callable)
+{
+    *callable = Qnil;
+    if (!RTEST(translators) || !decltype) { return SQLITE3_TRANSLATE_NONE; }
+
+    return translator_kind(rb_hash_lookup(translators, type_key(decltype, (long)strlen(decltype))), callable);
+}
+
+enum rb_sqlite3_type_translator
+rb_sqlite3_column_translator_for(VALUE translators, int index, const char *name, VALUE *callable)
+{
+    VALUE translator;
+
+    *callable = Qnil;
+    if (!RTEST(translators)) { return SQLITE3_TRANSLATE_NONE; }
+
+    translator = rb_hash_lookup(translators, INT2FIX(index));
+    if (NIL_P(translator) && name) {
+        translator = rb_hash_lookup(translators, rb_utf8_str_new_cstr(name));
+    }
+
+    return translator_kind(translator, callable);
+}
+
+/* Reads exactly +n+ digits. */
+static int
+read_digits(const char **p, const char *end, int n, int *out)
+{
+    int value = 0;
+
+    if (end - *p < n) { return 0; }
+    while (n--) {
+        if (!ISDIGIT(**p)) { return 0; }
+        value = value * 10 + (**p - '0');
+        (*p)++;
+    }
+
+    *out = value;
+    return 1;
+}
+
+static int
+days_in_month(int year, int month)
+{
+    static const int days[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+
+    if (month == 2 && (year % 4 == 0 && (year % 100 != 0 || year % 400 == 0))) { return 29; }
+    return days[month - 1];
+}
+
+/* Days since 1970-01-01 of a date in the proleptic Gregorian calendar. */
+static long long
+days_from_civil(int year, int month, int day)
+{
+    long long y = year - (month <= 2);
+    long long era = (y >= 0 ? y : y - 399) / 400;
+    long long yoe = y - era * 400;
+    long long doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    long long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+    return era * 146097 + doe - 719468;
+}
+
+static int
+parse_date(const char **p, const char *end, int *year, int *month, int *day)
+{
+    if (!read_digits(p, end, 4, year) || *p >= end || *(*p)++ != '-'
+            || !read_digits(p, end, 2, month) || *p >= end || *(*p)++ != '-'
+            || !read_digits(p, end, 2, day)) {
+        return 0;
+    }
+
+    return *month >= 1 && *month <= 12 && *day >= 1 && *day <= days_in_month(*year, *month);
+}
+
+/* Parses the time strings understood by SQLite's date and time functions:
+ * "YYYY-MM-DD", optionally followed by " HH:MM", ":SS" and ".SSS" (with a
+ * space or "T" in between) and a "Z" or "+HH:MM" offset. Times without an
+ * offset are UTC, as they are in SQLite. Sets +offset+ to INT_MAX - 1 for UTC,
+ * the value rb_time_timespec_new() expects. */
+static int
+parse_time(const char *p, const char *end, struct timespec *ts, int *offset)
+{
+    int year, month, day, hour = 0, min = 0, sec = 0, sign, oh, om = 0;
+    long nsec = 0;
+
+    if (!parse_date(&p, end, &year, &month, &day)) { return 0; }
+
+    *offset = INT_MAX - 1;
+
+    if (p < end && (*p == ' ' || *p == 'T' || *p == 't')) {
+        p++;
+        if (!read_digits(&p, end, 2, &hour) || p >= end || *p++ != ':' || !read_digits(&p, end, 2, &min)) {
+            return 0;
+        }
+        if (p < end && *p == ':') {
+            p++;
+            if (!read_digits(&p, end, 2, &sec)) { return 0; }
+            if (p < end && *p == '.') {
+                long scale = 100000000;
+                p++;
+                if (p >= end || !ISDIGIT(*p)) { return 0; }
+                for (; p < end && ISDIGIT(*p); p++) {
+                    nsec += (*p - '0') * scale;
+                    scale /= 10;
+                }
+            }
+        }
+        if (hour > 23 || min > 59 || sec > 59) { return 0; }
+
+        while (p < end && *p == ' ') { p++; }
+        if (p < end && (*p == 'Z' || *p == 'z')) {
+            p++;
+        } else if (p < end && (*p == '+' || *p == '-')) {
+            sign = *p++ == '-' ? -1 : 1;
+            if (!read_digits(&p, end, 2, &oh)) { return 0; }
+            if (p < end && *p == ':') { p++; }
+            if (p < end && !read_digits(&p, end, 2, &om)) { return 0; }
+            if (oh > 23 || om > 59) { return 0; }
+            *offset = sign * (oh * 3600 + om * 60);
+        }
+    }
+
+    if (p != end) { return 0; }
+
+    ts->tv_sec = (time_t)(days_from_civil(year, month, day) * 86400 + hour * 3600 + min * 60 + sec);
+    if (*offset != INT_MAX - 1) { ts->tv_sec -= *offset; }
+    ts->tv_nsec = nsec;
+
+    return 1;
+}
+
+static VALUE
+translate_time(sqlite3_stmt *stmt, int i)
+{
+    struct timespec ts;
+    int offset;
+
+    switch (sqlite3_column_type(stmt, i)) {
+        case SQLITE_INTEGER:
+            ts.tv_sec = (time_t)sqlite3_column_int64(stmt, i);
+            ts.tv_nsec = 0;
+            return rb_time_timespec_new(&ts, INT_MAX - 1);
+        case SQLITE_TEXT: {
+            const char *text = (const char *)sqlite3_column_text(stmt, i);
+            if (parse_time(text, text + sqlite3_column_bytes(stmt, i), &ts, &offset)) {
+                return rb_time_timespec_new(&ts, offset);
+            }
+        }
+        break;
+    }
+
+    return Qundef;
+}
+
+static VALUE
+translate_date(sqlite3_stmt *stmt, int i)
+{
+    const char *p, *end;
+    int year, month, day;
+
+    if (sqlite3_column_type(stmt, i) != SQLITE_TEXT) { return Qundef; }
+
+    p = (const char *)sqlite3_column_text(stmt, i);
+    end = p + sqlite3_column_bytes(stmt, i);
+    if (!parse_date(&p, end, &year, &month, &day) || p != end) { return Qundef; }
+
+    if (!cDate) {
+        rb_require("date");
+        cDate = rb_const_get(rb_cObject, rb_intern("Date"));
+        rb_gc_register_mark_object(cDate);
+    }
+
+    return rb_funcall(cDate, id_new, 3, INT2FIX(year), INT2FIX(month), INT2FIX(day));
+}
+
+static int
+text_matches(const char *text, int len, const char *word)
+{
+    return (size_t)len == strlen(word) && !sqlite3_strnicmp(text, word, len);
+}
+
+static VALUE
+translate_boolean(sqlite3_stmt *stmt, int i)
+{
+    switch (sqlite3_column_type(stmt, i)) {
+        case SQLITE_INTEGER:
+            return sqlite3_column_int64(stmt, i) ? Qtrue : Qfalse;
+        case SQLITE_FLOAT:
+            return sqlite3_column_double(stmt, i) != 0.0 ? Qtrue : Qfalse;
+        case SQLITE_TEXT: {
+            const char *text = (const char *)sqlite3_column_text(stmt, i);
+            int len = sqlite3_column_bytes(stmt, i);
+
+            if (text_matches(text, len, "t") || text_matches(text, len, "true") || text_matches(text, len, "1")
+                    || text_matches(text, len, "y") || text_matches(text, len, "yes")) {
+                return Qtrue;
+            }
+            if (text_matches(text, len, "f") || text_matches(text, len, "false") || text_matches(text, len, "0")
+                    || text_matches(text, len, "n") || text_matches(text, len, "no")) {
+                return Qfalse;
+            }
+        }
+        break;
+    }
+
+    return Qundef;
+}
+
+static VALUE
+translate_decimal(sqlite3_stmt *stmt, int i)
+{
+    VALUE source, args[2], decimal;
+
+    switch (sqlite3_column_type(stmt, i)) {
+        case SQLITE_INTEGER:
+            source = LL2NUM(sqlite3_column_int64(stmt, i));
+            break;
+        case SQLITE_FLOAT:
+            source = rb_funcall(rb_float_new(sqlite3_column_double(stmt, i)), id_to_s, 0);
+            break;
+        case SQLITE_TEXT:
+            source = rb_utf8_str_new((const char *)sqlite3_column_text(stmt, i), sqlite3_column_bytes(stmt, i));
+            break;
+        default:
+            return Qundef;
+    }
+
+    args[0] = source;
+    args[1] = no_exception;
+    decimal = rb_funcallv_kw(rb_mKernel, id_BigDecimal, 2, args, RB_PASS_KEYWORDS);
+
+    return NIL_P(decimal) ? Qundef : decimal;
+}
+
+static VALUE
+translate_json(sqlite3_stmt *stmt, int i)
+{
+    switch (sqlite3_column_type(stmt, i)) {
+        case SQLITE_TEXT:
+            return rb_sqlite3_json_parse((const char *)sqlite3_column_text(stmt, i), sqlite3_column_bytes(stmt, i));
+        case SQLITE_BLOB:
+            return rb_sqlite3_jsonb_load(sqlite3_column_blob(stmt, i), sqlite3_column_bytes(stmt, i));
+        default:
+            return Qundef;
+    }
+}
+
+VALUE
+rb_sqlite3_type_translate(enum rb_sqlite3_type_translator translator, sqlite3_stmt *stmt, int i)
+{
+    switch (translator) {
+        case SQLITE3_TRANSLATE_TIME:
+            return translate_time(stmt, i);
+        case SQLITE3_TRANSLATE_DATE:
+            return translate_date(stmt, i);
+        case SQLITE3_TRANSLATE_BOOLEAN:
+            return translate_boolean(stmt, i);
+        case SQLITE3_TRANSLATE_DECIMAL:
+            return translate_decimal(stmt, i);
+        case SQLITE3_TRANSLATE_JSON:
+            return translate_json(stmt, i);
+        default:
+            return Qundef;
+    }
+}
+
+void
+init_sqlite3_type_translator(void)
+{
+    id_new = rb_intern("new");
+    id_BigDecimal = rb_intern("BigDecimal");
+    id_call = rb_intern("call");
+    id_to_s = rb_intern("to_s");
+
+    sym_time = ID2SYM(rb_intern("time"));
+    sym_date = ID2SYM(rb_intern("date"));
+    sym_boolean = ID2SYM(rb_intern("boolean"));
+    sym_decimal = ID2SYM(rb_intern("decimal"));
+    sym_json = ID2SYM(rb_intern("json"));
+
+    no_exception = rb_hash_new();
+    rb_hash_aset(no_exception, ID2SYM(rb_intern("exception")), Qfalse);
+    rb_obj_freeze(no_exception);
+    rb_gc_register_mark_object(no_exception);
+}
@@ -0,0 +1,40 @@
+#ifndef SQLITE3_TYPE_TRANSLATOR_RUBY
+#define SQLITE3_TYPE_TRANSLATOR_RUBY
+
+#include <sqlite3_ruby.h>
+
+/* How the values of a result column are translated, by declared type. */
+enum rb_sqlite3_type_translator {
+    SQLITE3_TRANSLATE_NONE = 0,
+    SQLITE3_TRANSLATE_TIME,
+    SQLITE3_TRANSLATE_DATE,
+    SQLITE3_TRANSLATE_BOOLEAN,
+    SQLITE3_TRANSLATE_DECIMAL,
+    SQLITE3_TRANSLATE_JSON,
+    SQLITE3_TRANSLATE_CUSTOM
+};
+
+void init_sqlite3_type_translator();
+
+/* Validates a translator registry given by the user and returns it as a frozen
+ * Hash keyed by normalized type name, or Qfalse if translation is off. */
+VALUE rb_sqlite3_type_translators_normalize(VALUE translators);
+
+/* Validates the translators given to Statement#column_translators= and returns
+ * them as a frozen Hash keyed by column index or name, or Qfalse if empty. */
+VALUE rb_sqlite3_column_translators_normalize(VALUE translators);
+
+/* Looks up the translator of a column declared as +decltype+. Custom
+ * translators are returned in +callable+. */
+enum rb_sqlite3_type_translator rb_sqlite3_type_translator_for(VALUE translators, const char *decltype, VALUE *callable);
+
+/* Looks up the translator chosen for result column +index+, named +name+, by
+ * Statement#column_translators=. */
+enum rb_sqlite3_type_translator rb_sqlite3_column_translator_for(VALUE translators, int index, const char *name, VALUE *callable);
+
+/* Translates column +i+ of the current row of +stmt+ with one of the built-in
+ * translators. Returns Qundef for NULLs and for values the translator does not
+ * understand, which are then converted as usual. */
+VALUE rb_sqlite3_type_translate(enum rb_sqlite3_type_translator translator, sqlite3_stmt *stmt, int i);
+
+#endif
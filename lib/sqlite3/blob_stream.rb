@@ -0,0 +1,38 @@
+# frozen_string_literal: true
+
+module SQLite3
+  # A BlobStream reads and writes a single BLOB or TEXT value in place, in
+  # chunks, without loading the whole value into memory. It is created with
+  # Database#open_blob.
+  #
+  # The value cannot grow or shrink through the stream. Insert a zeroblob of
+  # the final size first when writing a large value:
+  #
+  #   db.execute("insert into files (data) values (zeroblob(?))", [File.size(path)])
+  #   db.open_blob("files", "data", db.last_insert_row_id, writable: true) do |blob|
+  #     File.open(path, "rb") do |file|
+  #       buffer = +""
+  #       blob.write(buffer) while file.read(65_536, buffer)
+  #     end
+  #   end
+  class BlobStream
+    alias_method :tell, :pos
+
+    # Moves the current position to +offset+ bytes from the start of the value.
+    def pos=(offset)
+      seek(offset)
+      offset
+    end
+
+    # Moves the current position back to the start of the value.
+    def rewind
+      seek(0)
+    end
+
+    # Returns true if the current position is at the end of the value.
+    def eof?
+      pos >= size
+    end
+    alias_method :eof, :eof?
+  end
+end
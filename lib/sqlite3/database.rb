@@ -4,8 +4,13 @@ require "sqlite3/constants"
 require "sqlite3/errors"
 require "sqlite3/pragmas"
 require "sqlite3/statement"
+require "sqlite3/blob_stream"
+require "sqlite3/jsonb"
 require "sqlite3/value"
 require "sqlite3/fork_safety"
+require "sqlite3/pool"
+require "sqlite3/write_queue"
+require "sqlite3/writer_lock"
 
 module SQLite3
   # == Overview
@@ -115,6 +120,25 @@ module SQLite3
       end
     end
 
+    # The default number of prepared statements kept by each connection for
+    # reuse (see #statement_cache_size=).
+    STATEMENT_CACHE_SIZE = 64
+
+    WRITER_LOCK_MODES = %w[immediate exclusive].freeze # :nodoc:
+
+    # The type translators used by <tt>type_translators = true</tt>, keyed by
+    # declared column type (see #type_translators=).
+    TYPE_TRANSLATORS = {
+      "datetime" => :time,
+      "timestamp" => :time,
+      "date" => :date,
+      "boolean" => :boolean,
+      "bool" => :boolean,
+      "decimal" => :decimal,
+      "json" => :json,
+      "jsonb" => :json
+    }.freeze
+
     # A boolean that indicates whether rows in result sets should be returned
     # as hashes or not. By default, rows are returned as arrays.
     attr_accessor :results_as_hash
@@ -137,6 +161,12 @@ module SQLite3
     # - +strict:+ +boolish+ (default false), disallow the use of double-quoted string literals (see https://www.sqlite.org/quirks.html#double_quoted_string_literals_are_accepted)
     # - +results_as_hash:+ +boolish+ (default false), return rows as hashes instead of arrays
     # - +default_transaction_mode:+ one of +:deferred+ (default), +:immediate+, or +:exclusive+. If a mode is not specified in a call to #transaction, this will be the default transaction mode.
+    # - +release_gvl:+ +boolish+ (default false), release the GVL while stepping statements (see #release_gvl=)
+    # - +dedup_text:+ +boolish+ (default false), return TEXT values as deduplicated frozen strings (see #dedup_text=)
+    # - +nonblocking:+ +boolish+ (default false), run statements from a fiber scheduler on a worker thread (see #nonblocking=)
+    # - +type_translators:+ +true+ or +Hash+ (default nil), translate values by declared column type (see #type_translators=)
+    # - +statement_cache_size:+ +Integer+ (default STATEMENT_CACHE_SIZE), the number of prepared statements to keep for reuse, or 0 to disable the cache (see #statement_cache_size=)
+    # - +writer_lock:+ +boolish+ (default false), queue this process's write transactions on the file in arrival order (see #writer_lock=)
     # - +extensions:+ <tt>Array[String | _ExtensionSpecifier]</tt> SQLite extensions to load into the database. See Database@SQLite+Extensions for more information.
     #
     def initialize file, options = {}, zvfs = nil
@@ -177,6 +207,13 @@ module SQLite3
       @results_as_hash = options[:results_as_hash]
       @readonly = mode & Constants::Open::READONLY != 0
       @default_transaction_mode = options[:default_transaction_mode] || :deferred
+      self.release_gvl = true if options[:release_gvl]
+      self.dedup_text = true if options[:dedup_text]
+      self.nonblocking = true if options[:nonblocking]
+      self.type_translators = options[:type_translators] if options[:type_translators]
+      self.statement_cache_size = options.fetch(:statement_cache_size, STATEMENT_CACHE_SIZE)
+      @writer_lock_held = nil
+      self.writer_lock = options[:writer_lock]
 
       initialize_extensions(options[:extensions])
 
@@ -244,18 +281,40 @@ module SQLite3
     # See also #execute2, #query, and #execute_batch for additional ways of
     # executing statements.
     def execute sql, bind_vars = [], &block
-      prepare(sql) do |stmt|
+      prepare_cached(sql) do |stmt|
         stmt.bind_params(bind_vars)
-        stmt = build_result_set stmt
+        result = build_result_set stmt
 
         if block
-          stmt.each do |row|
-            yield row
+          until (rows = result.next_batch).empty?
+            rows.each(&block)
           end
         else
-          stmt.to_a.freeze
+          result.to_a.freeze
         end
       end
+    ensure
+      release_finished_writer_lock if @writer_lock_held
+    end
+
+    # Executes the given SQL statement exactly as with #execute, returning (or
+    # yielding) the same rows. Binding and stepping happen in a single native
+    # call, without a ResultSet or per-row Ruby method calls, which makes
+    # this cheaper for short queries.
+    #
+    # See also #execute.
+    def execute_fast(sql, bind_vars = [], &block)
+      if offload?
+        rows = offload { exec_fast(sql, bind_vars, @results_as_hash) }
+        return rows unless block
+
+        rows.each(&block)
+        return nil
+      end
+
+      exec_fast(sql, bind_vars, @results_as_hash, &block)
+    ensure
+      release_finished_writer_lock if @writer_lock_held
     end
 
     # Executes the given SQL statement, exactly as with #execute. However, the
@@ -290,26 +349,20 @@ module SQLite3
     #
     # This always returns the result of the last statement.
     #
+    # The statements are prepared one after another straight from +sql+, so
+    # the time taken grows linearly with the length of the script. If one of
+    # them fails, the SQLite3::Exception raised tells which one by its
+    # +statement_index+ and by its +statement_offset+, the byte offset at
+    # which it starts in +sql+.
+    #
     # See also #execute_batch2 for additional ways of
     # executing statements.
     def execute_batch(sql, bind_vars = [])
-      sql = sql.strip
-      result = nil
-      until sql.empty?
-        prepare(sql) do |stmt|
-          unless stmt.closed?
-            # FIXME: this should probably use sqlite3's api for batch execution
-            # This implementation requires stepping over the results.
-            if bind_vars.length == stmt.bind_parameter_count
-              stmt.bind_params(bind_vars)
-            end
-            result = stmt.step
-          end
-          sql = stmt.remainder.strip
-        end
-      end
+      return offload { exec_script(sql, bind_vars) } if offload?
 
-      result
+      exec_script(sql, bind_vars)
+    ensure
+      release_finished_writer_lock if @writer_lock_held
     end
 
     # Executes all SQL statements in the given string. By contrast, the other
@@ -323,17 +376,33 @@ module SQLite3
     # Because all values except for 'NULL' are returned as strings,
     # a block can be passed to parse the values accordingly.
     #
+    # With <tt>stream: true</tt>, rows are not collected: each one is yielded
+    # to the block as soon as SQLite produces it, so a large SELECT in the
+    # script doesn't have to fit in memory, and +nil+ is returned. Breaking
+    # out of the block, or raising, stops the script before its next row or
+    # statement. Without a block an Enumerator is returned.
+    #
+    #   db.execute_batch2(File.read("report.sql"), stream: true) do |row|
+    #     csv << row
+    #   end
+    #
     # See also #execute_batch for additional ways of
     # executing statements.
-    def execute_batch2(sql, &block)
-      if block
-        result = exec_batch(sql, @results_as_hash)
+    def execute_batch2(sql, stream: false, &block)
+      if stream
+        return enum_for(__method__, sql, stream: true) unless block
+
+        exec_batch(sql, @results_as_hash, true, &block)
+      elsif block
+        result = exec_batch(sql, @results_as_hash, false)
         result.map do |val|
           yield val
         end
       else
-        exec_batch(sql, @results_as_hash)
+        exec_batch(sql, @results_as_hash, false)
       end
+    ensure
+      release_finished_writer_lock if @writer_lock_held
     end
 
     # This is a convenience method for creating a statement, binding
@@ -374,7 +443,8 @@ module SQLite3
     #
     # See also #get_first_row.
     def get_first_value(sql, *bind_vars)
-      query(sql, bind_vars) do |rs|
+      prepare_cached(sql) do |stmt|
+        rs = stmt.execute(bind_vars)
         if (row = rs.next)
           return @results_as_hash ? row[rs.columns[0]] : row[0]
         end
@@ -382,6 +452,38 @@ module SQLite3
       nil
     end
 
+    # Registers +translator+, or the block, as the type translator for columns
+    # declared as +type+, turning type translation on if it was off. See
+    # #type_translators=.
+    #
+    #   db.add_type_translator("point") { |text| Point.parse(text) }
+    def add_type_translator(type, translator = nil, &block)
+      self.type_translators = (type_translators || {}).merge(type => translator || block)
+    end
+
+    # Opens the value stored in +column+ of the row +rowid+ of +table+ for
+    # incremental I/O, and returns a BlobStream. The stream is read-only
+    # unless +writable+ is true. +db_name+ names the attached database that
+    # holds +table+.
+    #
+    # If a block is given, the stream is yielded to it and closed when the
+    # block returns, and the value of the block is returned.
+    #
+    #   db.open_blob("files", "data", id) do |blob|
+    #     buffer = +""
+    #     socket.write(buffer) while blob.read(65_536, buffer)
+    #   end
+    def open_blob(table, column, rowid, writable: false, db_name: "main")
+      stream = SQLite3::BlobStream.new(self, db_name, table, column, rowid, writable)
+      return stream unless block_given?
+
+      begin
+        yield stream
+      ensure
+        stream.close unless stream.closed?
+      end
+    end
+
     alias_method :busy_timeout, :busy_timeout=
 
     # Creates a new function for use in SQL statements. It will be added as
@@ -643,9 +745,19 @@ module SQLite3
     # If a block is not given, it is the caller's responsibility to end the
     # transaction explicitly, either by calling #commit, or by calling
     # #rollback.
+    #
+    # With a #writer_lock, +:immediate+ and +:exclusive+ transactions wait for
+    # the lock before they begin, and release it when they end.
     def transaction(mode = nil)
       mode = @default_transaction_mode if mode.nil?
-      execute "begin #{mode} transaction"
+      release_finished_writer_lock if @writer_lock_held
+      acquire_writer_lock if @writer_lock && WRITER_LOCK_MODES.include?(mode.to_s.downcase)
+      begin
+        execute "begin #{mode} transaction"
+      rescue
+        release_writer_lock
+        raise
+      end
 
       if block_given?
         abort = false
@@ -669,6 +781,8 @@ module SQLite3
     def commit
       execute "commit transaction"
       true
+    ensure
+      release_finished_writer_lock if @writer_lock_held
     end
 
     # Rolls the current transaction back. If there is no current transaction,
@@ -678,6 +792,38 @@ module SQLite3
     def rollback
       execute "rollback transaction"
       true
+    ensure
+      release_finished_writer_lock if @writer_lock_held
+    end
+
+    # The WriterLock this connection's write transactions take, or +nil+ (the
+    # default) to leave concurrent writers to the busy handler.
+    attr_reader :writer_lock
+
+    # Turns the in-process writer lock on or off. When on, #transaction takes
+    # the WriterLock shared by the connections of this process to the same
+    # file before beginning an +:immediate+ or +:exclusive+ transaction, so
+    # writers in this process wait for each other in arrival order instead of
+    # retrying through the busy handler. Transactions begun by executing
+    # +BEGIN+ directly don't take the lock.
+    #
+    # A transaction begun by #transaction but ended by executing +COMMIT+ or
+    # +ROLLBACK+ directly releases the lock once #execute, #execute_fast,
+    # #execute_batch or #execute_batch2 returns, or otherwise when the next
+    # #transaction begins. Until then the other connections keep waiting.
+    def writer_lock=(enabled)
+      @writer_lock = enabled ? WriterLock.for(self) : nil
+    end
+
+    # call-seq:
+    #   write_queue(window: 0, batch_size: 64) -> WriteQueue
+    #
+    # Returns the connection's WriteQueue, which commits writes submitted by many threads
+    # together. The options configure the queue when it is first created.
+    #
+    #   db.write_queue.submit("insert into events (name) values (?)", ["signup"])
+    def write_queue(**options)
+      @write_queue ||= WriteQueue.new(self, **options)
     end
 
     # Returns +true+ if the database has been open in readonly mode
@@ -686,23 +832,37 @@ module SQLite3
       @readonly
     end
 
-    # Sets a #busy_handler that releases the GVL between retries,
-    # but only retries up to the indicated number of +milliseconds+.
-    # This is an alternative to #busy_timeout, which holds the GVL
-    # while SQLite sleeps and retries.
+    # call-seq:
+    #   busy_backoff(timeout: 5000, min_delay: 1, max_delay: 25, jitter: 0.5) -> self
+    #
+    # Installs a busy handler, implemented in C, that retries a busy resource
+    # for up to +timeout+ milliseconds. It sleeps +min_delay+ milliseconds
+    # before the first retry and doubles the delay for each one after, up to
+    # +max_delay+. Each delay is shortened by a random fraction of up to
+    # +jitter+, so that connections waiting for the same lock spread out.
+    #
+    # Unlike #busy_timeout, whose sleeps hold the GVL, the handler sleeps with
+    # the GVL released, so other threads keep running while a connection
+    # waits. A thread interrupted while it waits (by Thread#raise or
+    # Thread#kill, for example) stops waiting within a few milliseconds, and
+    # so does one whose connection is interrupted with #interrupt when SQLite
+    # is 3.41.0 or later. The time spent waiting is counted in #busy_stats.
+    #
+    # This replaces any #busy_handler or #busy_timeout.
+    def busy_backoff(timeout: 5000, min_delay: 1, max_delay: 25, jitter: 0.5)
+      raise ArgumentError, "timeout must not be negative" if timeout.negative?
+      raise ArgumentError, "delays must be positive" unless min_delay.positive? && max_delay >= min_delay
+      raise ArgumentError, "jitter must be between 0 and 1" unless (0..1).cover?(jitter)
+
+      set_busy_backoff(timeout.fdiv(1000), min_delay.fdiv(1000), max_delay.fdiv(1000), jitter.to_f)
+    end
+
+    # Installs a #busy_backoff handler that releases the GVL between
+    # retries, but only retries up to the indicated number of +milliseconds+.
+    # This is an alternative to #busy_timeout, which holds the GVL while
+    # SQLite sleeps and retries.
     def busy_handler_timeout=(milliseconds)
-      timeout_seconds = milliseconds.fdiv(1000)
-
-      busy_handler do |count|
-        now = Process.clock_gettime(Process::CLOCK_MONOTONIC)
-        if count.zero?
-          @timeout_deadline = now + timeout_seconds
-        elsif now > @timeout_deadline
-          next false
-        else
-          sleep(0.001)
-        end
-      end
+      busy_backoff(timeout: milliseconds)
     end
 
     # call-seq:
@@ -784,6 +944,64 @@ module SQLite3
       end
     end
 
+    # Yields a prepared statement for +sql+ like #prepare does, but takes it
+    # from the statement cache when possible and returns it there afterwards.
+    def prepare_cached(sql) # :nodoc:
+      stmt = statement_cache_fetch(sql) ||
+        SQLite3::Statement.new(self, sql, persistent: statement_cache_size > 0)
+      begin
+        yield stmt
+      ensure
+        statement_cache_store(sql, stmt)
+      end
+    end
+
+    def acquire_writer_lock # :nodoc:
+      @writer_lock.acquire
+      @writer_lock_held = @writer_lock
+    end
+
+    # Releases the writer lock once the transaction that took it has ended,
+    # whether or not through #commit or #rollback.
+    def release_finished_writer_lock # :nodoc:
+      release_writer_lock if closed? || !transaction_active?
+    end
+
+    # Releases the writer lock taken by the current transaction. Also called
+    # by #close, as closing the connection ends the transaction.
+    def release_writer_lock # :nodoc:
+      lock = @writer_lock_held
+      @writer_lock_held = nil
+      lock&.release
+    end
+
+    # Runs the block on this connection's worker thread and returns its result,
+    # or raises its exception. The calling fiber waits on a Queue, so the fiber
+    # scheduler runs other fibers meanwhile. A fiber stopped while it waits
+    # interrupts the block's statement and waits for it to unwind. The worker
+    # exits once it has been idle for a second. See #nonblocking=.
+    def offload(&block) # :nodoc:
+      reply = Thread::Queue.new
+      begin
+        offload_queue << [block, reply]
+      rescue ClosedQueueError
+        retry
+      end
+
+      done = false
+      begin
+        failed, value = reply.pop
+        done = true
+      ensure
+        unless done
+          interrupt
+          reply.pop
+        end
+      end
+      raise value if failed
+      value
+    end
+
     # Given a statement, return a result set.
     # This is not intended for general consumption
     # :nodoc:
@@ -794,5 +1012,27 @@ module SQLite3
         ResultSet.new(self, stmt)
       end
     end
+
+    private
+
+    def offload_queue
+      return @offload_queue if @offload_worker&.alive? && !@offload_queue.closed?
+
+      queue = @offload_queue = Thread::Queue.new
+      @offload_worker = Thread.new { run_offloaded(queue) }
+      queue
+    end
+
+    def run_offloaded(queue)
+      # a job pushed as the worker gives up is still run before it exits
+      while (job = queue.pop(timeout: 1) || queue.close.pop)
+        block, reply = job
+        begin
+          reply << [false, block.call]
+        rescue ::Exception => e # standard:disable Lint/RescueException
+          reply << [true, e]
+        end
+      end
+    end
   end
 end
@@ -12,6 +12,14 @@ module SQLite3
     # offset. If the offset is not available, this will be -1.
     attr_reader :sql_offset
 
+    # If the error was raised by Database#execute_batch, this is the index of
+    # the statement that failed among those in the script.
+    attr_reader :statement_index
+
+    # If the error was raised by Database#execute_batch, this is the byte offset
+    # at which the statement that failed starts in the script.
+    attr_reader :statement_offset
+
     def message
       [super, sql_error].compact.join(":\n")
     end
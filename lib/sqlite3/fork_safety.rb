@@ -16,6 +16,7 @@ module SQLite3
     end
 
     @databases = []
+    @pools = []
     @mutex = Mutex.new
     @suppress = false
 
@@ -30,7 +31,22 @@ module SQLite3
         end
       end
 
+      def track_pool(pool) # :nodoc:
+        @mutex.synchronize do
+          @pools << WeakRef.new(pool)
+        end
+      end
+
       def discard # :nodoc:
+        # Pools outlive the fork and reopen their connections, so they are
+        # discarded first and without a warning.
+        @pools.select! do |pool|
+          pool.discard
+          true
+        rescue WeakRef::RefError
+          false
+        end
+
         warned = @suppress
         @databases.each do |db|
           next unless db.weakref_alive?
@@ -53,6 +69,7 @@ module SQLite3
           end
         end
         @databases.clear
+        WriterLock.discard
       end
 
       # Call to suppress the fork-related warnings.
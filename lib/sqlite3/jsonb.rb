@@ -0,0 +1,32 @@
+# frozen_string_literal: true
+
+module SQLite3
+  # Wraps a value so that it binds as a BLOB in SQLite's binary JSON format
+  # (JSONB), encoded straight from the Ruby objects without going through JSON
+  # text. JSONB values can be read and modified by SQLite's JSON functions
+  # from version 3.45 on.
+  #
+  #   db.execute("insert into docs (body) values (?)", [SQLite3::JSONB.new({"tags" => ["a", "b"]})])
+  #   db.execute("select body ->> '$.tags[1]' from docs") # => [["b"]]
+  #
+  # Columns declared JSON or JSONB are decoded back into Hashes and Arrays by
+  # the +:json+ type translator (see Database#type_translators=).
+  # JSONB.dump and JSONB.load convert to and from the binary format directly.
+  class JSONB
+    # The wrapped value.
+    attr_reader :value
+
+    def initialize(value)
+      @value = value
+    end
+
+    def ==(other)
+      other.is_a?(JSONB) && value == other.value
+    end
+    alias_method :eql?, :==
+
+    def hash
+      [self.class, value].hash
+    end
+  end
+end
@@ -0,0 +1,352 @@
+# frozen_string_literal: true
+
+module SQLite3
+  # A Pool shares one database file between threads through a set of read-only
+  # connections and a single writer connection. In WAL mode readers neither block the
+  # writer nor each other, so reads scale across threads, and writes wait for the writer
+  # connection in the pool instead of failing with SQLITE_BUSY.
+  #
+  #   pool = SQLite3::Pool.new("app.db", readers: 4)
+  #   pool.write { |db| db.execute("insert into events (name) values (?)", ["signup"]) }
+  #   pool.read { |db| db.get_first_value("select count(*) from events") }
+  #
+  # Connections are opened as they are needed. The writer is opened first, with the file
+  # created and switched to +journal_mode+ if necessary, and readers are opened with
+  # Constants::Open::READONLY and <tt>PRAGMA query_only</tt>.
+  #
+  # A thread (or fiber) that already holds a connection is handed the same connection by
+  # nested calls, and #read within #write uses the writer, so it sees the uncommitted
+  # changes. Idle readers are handed back to the thread that used them last where possible,
+  # which keeps that thread's statements in the connection's statement cache.
+  #
+  # A transaction left open by a block is rolled back when the connection is returned.
+  # Connections that were closed, or that fail a <tt>SELECT 1</tt> after sitting idle for
+  # more than +health_check_interval+ seconds, are replaced by new ones.
+  #
+  # A forked child discards the connections it inherited from the pool, without the warning
+  # ForkSafety emits for writable connections, and opens new ones as they are needed.
+  class Pool
+    # Raised when no connection became available within the checkout timeout.
+    class TimeoutError < SQLite3::Exception; end
+
+    # The number of reader connections the pool opens at most.
+    attr_reader :size
+
+    # The default number of seconds #read and #write wait for a connection.
+    attr_accessor :checkout_timeout
+
+    # call-seq:
+    #   SQLite3::Pool.new(file, readers: 4, checkout_timeout: 5, **options)
+    #
+    # Create a pool of connections to +file+.
+    #
+    # [Parameters]
+    # - +readers+: the maximum number of reader connections.
+    # - +checkout_timeout+: the default number of seconds to wait for a connection before
+    #   raising TimeoutError.
+    # - +journal_mode+: the journal mode the writer sets when it is opened, or +nil+ to leave
+    #   it unchanged. Defaults to <tt>"wal"</tt>.
+    # - +busy_timeout+: the Database#busy_timeout, in milliseconds, of every connection. This
+    #   only matters when other processes use the file too.
+    # - +health_check_interval+: the number of seconds a connection may sit idle before it is
+    #   checked with <tt>SELECT 1</tt> on checkout.
+    #
+    # Any other +options+, including +flags+, are passed to Database.new.
+    def initialize(file, readers: 4, checkout_timeout: 5, journal_mode: "wal", busy_timeout: 5000,
+      health_check_interval: 30, **options)
+      raise ArgumentError, "readers must be positive" unless readers.is_a?(Integer) && readers > 0
+      if options.key?(:readonly) || options.key?(:readwrite)
+        raise ArgumentError, "readonly and readwrite cannot be set on a pool, pass flags instead"
+      end
+
+      @file = file
+      @size = readers
+      @checkout_timeout = checkout_timeout
+      @journal_mode = journal_mode
+      @busy_timeout = busy_timeout
+      @health_check_interval = health_check_interval
+
+      flags = options.delete(:flags) || (Constants::Open::READWRITE | Constants::Open::CREATE)
+      @writer_options = options.merge(flags: flags)
+      @reader_options = options.merge(
+        flags: (flags & ~(Constants::Open::READWRITE | Constants::Open::CREATE)) | Constants::Open::READONLY
+      )
+
+      @reader_key = :"__sqlite3_pool_reader_#{object_id}"
+      @writer_key = :"__sqlite3_pool_writer_#{object_id}"
+      @closed = false
+      @timeouts = 0
+      reset
+
+      ForkSafety.track_pool(self)
+    end
+
+    # call-seq:
+    #   read(timeout: checkout_timeout) { |db| ... } -> result of the block
+    #
+    # Yields a read-only connection, waiting up to +timeout+ seconds for one to become
+    # available.
+    def read(timeout: @checkout_timeout)
+      held = Thread.current[@writer_key] || Thread.current[@reader_key]
+      return yield(held) if held
+
+      lease(:reader, @reader_key, timeout) { |db| yield db }
+    end
+
+    # call-seq:
+    #   write(timeout: checkout_timeout) { |db| ... } -> result of the block
+    #
+    # Yields the writer connection, waiting up to +timeout+ seconds for other threads to
+    # return it.
+    def write(timeout: @checkout_timeout)
+      held = Thread.current[@writer_key]
+      return yield(held) if held
+
+      lease(:writer, @writer_key, timeout) { |db| yield db }
+    end
+
+    # Closes the idle connections and marks the pool closed. Connections in use are closed
+    # when they are returned.
+    def close
+      connections = @mutex.synchronize do
+        @closed = true
+        @reader_available.broadcast
+        @writer_available.broadcast
+        idle = @idle.dup
+        @idle.clear
+        @readers -= idle.size
+        if @writer && !@writer_out
+          idle << @writer
+          @writer = nil
+        end
+        idle.each { |db| forget(db) }
+      end
+      connections.each { |db| db.close unless db.closed? }
+      nil
+    end
+
+    # Returns true if #close has been called.
+    def closed?
+      @closed
+    end
+
+    # Returns a Hash describing the connections of the pool:
+    #
+    # - +:readers+: the number of open reader connections
+    # - +:idle_readers+: the number of those not in use
+    # - +:writer+: +:closed+, +:idle+ or +:in_use+
+    # - +:waiting+: the number of threads waiting for a connection
+    # - +:timeouts+: the number of checkouts that raised TimeoutError
+    def stats
+      @mutex.synchronize do
+        {
+          readers: @readers,
+          idle_readers: @idle.size,
+          writer: @writer.nil? ? :closed : (@writer_out ? :in_use : :idle),
+          waiting: @waiting,
+          timeouts: @timeouts
+        }
+      end
+    end
+
+    # Drops the connections inherited by a forked child, closing the writer. Called by
+    # ForkSafety.
+    def discard # :nodoc:
+      writer = @writer
+      reset
+      writer.close if writer && !writer.closed?
+    end
+
+    private
+
+    def reset
+      @mutex = Mutex.new
+      @reader_available = ConditionVariable.new
+      @writer_available = ConditionVariable.new
+      @connections = {}.compare_by_identity
+      @idle = []
+      @readers = 0
+      @writer = nil
+      @writer_out = false
+      @waiting = 0
+    end
+
+    def lease(role, key, timeout)
+      db = checkout(role, timeout)
+      Thread.current[key] = db
+      begin
+        yield db
+      ensure
+        Thread.current[key] = nil
+        checkin(db, role)
+      end
+    end
+
+    def checkout(role, timeout)
+      deadline = Process.clock_gettime(Process::CLOCK_MONOTONIC) + timeout
+      loop do
+        db = (role == :writer) ? checkout_writer(deadline) : checkout_reader(deadline)
+        return db if healthy?(db)
+
+        @mutex.synchronize { discard_connection(db, role) }
+        db.close unless db.closed?
+      end
+    end
+
+    def checkout_writer(deadline)
+      @mutex.synchronize do
+        raise SQLite3::Exception, "cannot use a closed pool" if @closed
+        until @writer.nil? || !@writer_out
+          wait(@writer_available, deadline)
+        end
+        @writer ||= open_writer
+        @writer_out = true
+        @writer
+      end
+    end
+
+    def checkout_reader(deadline)
+      @mutex.synchronize do
+        raise SQLite3::Exception, "cannot use a closed pool" if @closed
+        while @idle.empty? && @readers >= @size
+          wait(@reader_available, deadline)
+        end
+        unless @idle.empty?
+          index = @idle.rindex { |db| @connections[db].thread.equal?(Thread.current) } || -1
+          return @idle.delete_at(index)
+        end
+
+        # The file has to exist, in the right journal mode, before a read-only
+        # connection can open it.
+        @writer ||= open_writer
+        @readers += 1
+      end
+
+      begin
+        db = open_reader
+      rescue
+        @mutex.synchronize do
+          @readers -= 1
+          @reader_available.signal
+        end
+        raise
+      end
+      @mutex.synchronize { track(db) }
+      db
+    end
+
+    def checkin(db, role)
+      healthy = release(db)
+      @mutex.synchronize do
+        slot = @connections[db]
+        return close_orphan(db) unless slot
+
+        if @closed || !healthy
+          discard_connection(db, role)
+        else
+          slot.thread = Thread.current
+          slot.idle_since = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+          if role == :writer
+            @writer_out = false
+            @writer_available.signal
+          else
+            @idle << db
+            @reader_available.signal
+          end
+          return
+        end
+      end
+      db.close unless db.closed?
+    end
+
+    # A connection checked out before a fork, or before the pool was closed, is
+    # no longer tracked and is closed as it's returned.
+    def close_orphan(db)
+      db.close unless db.closed? || db.readonly?
+    end
+
+    def wait(condition, deadline)
+      remaining = deadline - Process.clock_gettime(Process::CLOCK_MONOTONIC)
+      if remaining <= 0
+        @timeouts += 1
+        raise TimeoutError, "could not obtain a connection from the pool within #{@checkout_timeout} seconds"
+      end
+
+      @waiting += 1
+      begin
+        condition.wait(@mutex, remaining)
+      ensure
+        @waiting -= 1
+      end
+      raise SQLite3::Exception, "cannot use a closed pool" if @closed
+    end
+
+    Slot = Struct.new(:thread, :idle_since) # :nodoc:
+
+    def track(db)
+      @connections[db] = Slot.new(Thread.current, Process.clock_gettime(Process::CLOCK_MONOTONIC))
+    end
+
+    def forget(db)
+      @connections.delete(db)
+      db
+    end
+
+    # Removes a connection that is checked out by the current thread from the pool.
+    def discard_connection(db, role)
+      return unless forget(db)
+
+      if role == :writer
+        @writer = nil
+        @writer_out = false
+        @writer_available.signal
+      else
+        @readers -= 1
+        @reader_available.signal
+      end
+    end
+
+    def open_writer
+      db = Database.new(@file, @writer_options)
+      db.busy_timeout = @busy_timeout if @busy_timeout
+      db.journal_mode = @journal_mode if @journal_mode
+      track(db)
+      db
+    rescue
+      db&.close
+      raise
+    end
+
+    def open_reader
+      db = Database.new(@file, @reader_options)
+      db.busy_timeout = @busy_timeout if @busy_timeout
+      db.query_only = true
+      db
+    rescue
+      db&.close
+      raise
+    end
+
+    def healthy?(db)
+      return false if db.closed?
+
+      idle_since = @mutex.synchronize { @connections[db]&.idle_since }
+      return true unless idle_since
+      return true if Process.clock_gettime(Process::CLOCK_MONOTONIC) - idle_since <= @health_check_interval
+
+      db.get_first_value("SELECT 1")
+      true
+    rescue SQLite3::Exception
+      false
+    end
+
+    def release(db)
+      return false if db.closed?
+
+      db.rollback if db.transaction_active?
+      true
+    rescue SQLite3::Exception
+      false
+    end
+  end
+end
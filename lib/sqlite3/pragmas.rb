@@ -578,34 +578,34 @@ module SQLite3
     # Returns information about +table+.  Yields each row of table information
     # if a block is provided.
     def table_info table
-      stmt = prepare "PRAGMA table_info(#{table})"
-      columns = stmt.columns
-
-      needs_tweak_default =
-        version_compare(SQLite3.libversion.to_s, "3.3.7") > 0
-
-      result = [] unless block_given?
-      stmt.each do |row|
-        new_row = columns.zip(row).to_h
-
-        tweak_default(new_row) if needs_tweak_default
-
-        # Ensure the type value is downcased.  On Mac and Windows
-        # platforms this value is now being returned as all upper
-        # case.
-        if new_row["type"]
-          new_row["type"] = new_row["type"].downcase
+      prepare_cached("PRAGMA table_info(#{table})") do |stmt|
+        columns = stmt.columns
+
+        needs_tweak_default =
+          version_compare(SQLite3.libversion.to_s, "3.3.7") > 0
+
+        result = [] unless block_given?
+        stmt.each do |row|
+          new_row = columns.zip(row).to_h
+
+          tweak_default(new_row) if needs_tweak_default
+
+          # Ensure the type value is downcased.  On Mac and Windows
+          # platforms this value is now being returned as all upper
+          # case.
+          if new_row["type"]
+            new_row["type"] = new_row["type"].downcase
+          end
+
+          if block_given?
+            yield new_row
+          else
+            result << new_row
+          end
         end
 
-        if block_given?
-          yield new_row
-        else
-          result << new_row
-        end
+        result
       end
-      stmt.close
-
-      result
     end
 
     private
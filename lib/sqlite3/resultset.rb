@@ -14,18 +14,20 @@ module SQLite3
     def initialize db, stmt
       @db = db
       @stmt = stmt
+      @buffer = []
     end
 
     # Reset the cursor, so that a result set which has reached end-of-file
     # can be rewound and reiterated.
     def reset(*bind_params)
+      @buffer = []
       @stmt.reset!
       @stmt.bind_params(*bind_params)
     end
 
     # Query whether the cursor has reached the end of the result set or not.
     def eof?
-      @stmt.done?
+      @buffer.empty? && @stmt.done?
     end
 
     # Obtain the next row from the cursor. If there are no more rows to be
@@ -40,17 +42,36 @@ module SQLite3
     # For hashes, the column names are the keys of the hash, and the column
     # types are accessible via the +types+ property.
     def next
-      @stmt.step
+      @buffer.shift || @stmt.step
+    end
+
+    # Obtain up to +max_rows+ of the next rows from the cursor in a single call.
+    # Returns an empty array once there are no more rows to be had.
+    #
+    # Rows are in the same form as those returned by #next.
+    def next_batch(max_rows = Statement::BATCH_SIZE)
+      return @buffer.shift(max_rows) unless @buffer.empty?
+
+      @stmt.step_many(max_rows)
     end
 
     # Required by the Enumerable mixin. Provides an internal iterator over the
     # rows of the result set.
     def each
-      while (node = self.next)
+      while (node = @buffer.shift || (@buffer = next_batch).shift)
         yield node
       end
     end
 
+    # Returns all remaining rows of the result set.
+    def to_a
+      rows = []
+      until (batch = next_batch).empty?
+        rows.concat(batch)
+      end
+      rows
+    end
+
     # Provides an internal iterator over the rows of the result set where
     # each row is yielded as a hash.
     def each_hash
@@ -83,14 +104,23 @@ module SQLite3
 
     # Return the next row as a hash
     def next_hash
-      row = @stmt.step
-      return nil if @stmt.done?
+      row = @buffer.shift
+      return @stmt.step_hash unless row
 
       @stmt.columns.zip(row).to_h
     end
   end
 
   class HashResultSet < ResultSet # :nodoc:
-    alias_method :next, :next_hash
+    def next
+      @buffer.shift || @stmt.step_hash
+    end
+    alias_method :next_hash, :next
+
+    def next_batch(max_rows = Statement::BATCH_SIZE)
+      return @buffer.shift(max_rows) unless @buffer.empty?
+
+      @stmt.step_many_hashes(max_rows)
+    end
   end
 end
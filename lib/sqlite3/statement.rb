@@ -14,18 +14,24 @@ module SQLite3
   class Statement
     include Enumerable
 
+    # The number of rows fetched with each call to #step_many when iterating.
+    BATCH_SIZE = 128
+
     # This is any text that followed the first valid SQL statement in the text
     # with which the statement was initialized. If there was no trailing text,
     # this will be the empty string.
     attr_reader :remainder
 
-    # call-seq: SQLite3::Statement.new(db, sql)
+    # call-seq: SQLite3::Statement.new(db, sql, persistent: false)
     #
     # Create a new statement attached to the given Database instance, and which
     # encapsulates the given SQL text. If the text contains more than one
     # statement (i.e., separated by semicolons), then the #remainder property
     # will be set to the trailing text.
-    def initialize(db, sql)
+    #
+    # Pass +persistent: true+ to hint to SQLite that the statement will be
+    # retained and reused many times (+SQLITE_PREPARE_PERSISTENT+).
+    def initialize(db, sql, persistent: false)
       raise ArgumentError, "prepare called on a closed database" if db.closed?
 
       sql = sql.encode(Encoding::UTF_8) if sql && sql.encoding != Encoding::UTF_8
@@ -33,50 +39,7 @@ module SQLite3
       @connection = db
       @columns = nil
       @types = nil
-      @remainder = prepare db, sql
-    end
-
-    # Binds the given variables to the corresponding placeholders in the SQL
-    # text.
-    #
-    # See Database#execute for a description of the valid placeholder
-    # syntaxes.
-    #
-    # Type mapping from Ruby to SQLite3:
-    # - +nil+                            → NULL
-    # - Integer                          → INTEGER (or REAL when outside the signed int64 range)
-    # - Float                            → REAL
-    # - SQLite3::Blob                    → BLOB
-    # - String with Encoding::ASCII_8BIT
-    #   (a.k.a. BINARY)                  → BLOB
-    # - String with Encoding::UTF_16LE
-    #   or Encoding::UTF_16BE            → TEXT (bound as UTF-16)
-    # - String (all other encodings)     → TEXT (re-encoded to UTF-8 if needed)
-    # - Any other type                   → raises RuntimeError
-    #
-    # Note: a String with Encoding::ASCII_8BIT (BINARY) is always bound as a
-    # BLOB, even when its bytes are all valid ASCII. If you want such a string
-    # compared or stored as TEXT, re-encode it before binding:
-    #
-    #   stmt.bind_params(my_binary_str.encode(Encoding::UTF_8))
-    #
-    # Example:
-    #
-    #   stmt = db.prepare( "select * from table where a=? and b=?" )
-    #   stmt.bind_params( 15, "hello" )
-    #
-    # See also #execute, #bind_param, Statement#bind_param, and
-    # Statement#bind_params.
-    def bind_params(*bind_vars)
-      index = 1
-      bind_vars.flatten.each do |var|
-        if Hash === var
-          var.each { |key, val| bind_param key, val }
-        else
-          bind_param index, var
-          index += 1
-        end
-      end
+      @remainder = prepare db, sql, persistent
     end
 
     # Execute the statement. This creates a new ResultSet object for the
@@ -124,6 +87,49 @@ module SQLite3
       block ? each(&block) : to_a
     end
 
+    # Executes the statement once for each entry of +rows+, an Array or any
+    # other Enumerable of bind parameters, and returns the total number of
+    # rows changed. Each entry is bound as by #bind_params: an Array binds
+    # positional parameters, a Hash binds named parameters, and a single value
+    # binds the first parameter. Resetting, binding and stepping all happen in
+    # a single native loop, and any rows the statement returns are discarded.
+    #
+    # The +transaction+ option wraps the loop so that either every row is
+    # applied or none is:
+    # - +nil+ or +false+ (the default): no wrapping
+    # - +true+, or one of <tt>:deferred</tt>, <tt>:immediate</tt> or
+    #   <tt>:exclusive</tt>: a transaction (see Database#transaction)
+    # - <tt>:savepoint</tt>: a savepoint, which may be used inside an
+    #   enclosing transaction
+    #
+    # Example:
+    #
+    #   stmt = db.prepare("insert into people (name, age) values (?, ?)")
+    #   stmt.execute_many([["Alice", 31], ["Bob", 42]], transaction: :immediate) # => 2
+    def execute_many(rows, transaction: nil)
+      case transaction
+      when nil, false
+        execute_rows(rows)
+      when :savepoint
+        @connection.execute("savepoint sqlite3_execute_many")
+        applied = false
+        begin
+          changes = execute_rows(rows)
+          applied = true
+        ensure
+          # Also undo the partial batch on a throw or an exception that isn't
+          # a StandardError, like Interrupt
+          @connection.execute("rollback to savepoint sqlite3_execute_many") unless applied
+          @connection.execute("release savepoint sqlite3_execute_many")
+        end
+        changes
+      else
+        @connection.transaction(transaction == true ? nil : transaction) do
+          execute_rows(rows)
+        end
+      end
+    end
+
     # Returns true if the statement is currently active, meaning it has an
     # open result set.
     def active?
@@ -138,12 +144,62 @@ module SQLite3
       @columns
     end
 
-    def each
-      loop do
-        val = step
-        break self if done?
-        yield val
+    # Yields each remaining row of the statement. The rows are stepped and
+    # yielded in one native call, one at a time, so leaving the block early
+    # leaves the statement right after the last row yielded, and #step
+    # continues from there. See #step_many to fetch rows in batches.
+    #
+    # Pass +lazy: true+ to yield a LazyRow for each row (see #step_lazy), which
+    # only converts the columns that are read.
+    #
+    # Pass +reuse_row: true+ to yield the same mutable Array for every row,
+    # refilled in place by #step_into, so that no Array is allocated per row.
+    # The yielded Array must not be retained or modified by the block: it is
+    # overwritten by the next row. Copy it (for example with +row.dup+) to keep
+    # a row.
+    def each(lazy: false, reuse_row: false, &block)
+      return enum_for(__method__, lazy: lazy, reuse_row: reuse_row) unless block
+      raise ArgumentError, "lazy and reuse_row cannot be combined" if lazy && reuse_row
+
+      if reuse_row
+        row = []
+        yield row while step_into(row)
+        return self
       end
+
+      each_row(lazy, &block)
+    end
+
+    # call-seq:
+    #   each_prefetched(batch: BATCH_SIZE, depth: 2) { |row| ... } -> self
+    #
+    # Yields each remaining row of the statement, like #each, while a worker
+    # thread steps the statement ahead with the GVL released. The worker copies
+    # the raw values of up to +depth+ batches of +batch+ rows ahead of the rows
+    # being yielded, and waits when the block falls that far behind, so that
+    # SQLite's work overlaps with the block's instead of alternating with it.
+    #
+    #   stmt = db.prepare("select * from events")
+    #   stmt.each_prefetched(batch: 512, depth: 4) { |row| csv << row }
+    #
+    # Rows are frozen Arrays, converted as LazyRow converts values: they are
+    # not translated by #type_translators. The block may use the connection.
+    #
+    # A worker calling a Ruby callback would need the GVL while holding the
+    # connection, which a block using the connection could be waiting for
+    # while holding the GVL. So if Ruby functions, aggregators, collations,
+    # an authorizer, a trace handler or a Ruby busy handler are registered on
+    # the connection when the iteration starts, the statement is stepped on
+    # the calling thread instead, +batch+ rows at a time, with the rows
+    # converted as by #step. Don't register any from the block.
+    #
+    # While a worker steps the statement, it cannot be used until the
+    # iteration ends. Leaving the block early interrupts the step the worker
+    # is in, as Database#interrupt would, and resets the statement.
+    def each_prefetched(batch: BATCH_SIZE, depth: 2, &block)
+      return enum_for(__method__, batch: batch, depth: depth) unless block
+
+      prefetch(batch, depth, &block)
     end
 
     # Return an array of the data types for each column in this statement. Note
@@ -163,6 +219,13 @@ module SQLite3
       end
     end
 
+    # Calls +method+ again on the database's worker thread. Called by the
+    # stepping methods of a nonblocking statement run from a fiber scheduler
+    # (see Database#nonblocking=).
+    def offload(method, *args) # :nodoc:
+      @connection.offload { __send__(method, *args) }
+    end
+
     # Returns a Hash containing information about the statement.
     # The contents of the hash are implementation specific and may change in
     # the future without notice. The hash includes information about internal
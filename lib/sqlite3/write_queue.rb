@@ -0,0 +1,150 @@
+# frozen_string_literal: true
+
+module SQLite3
+  # A WriteQueue coalesces writes submitted by many threads into shared transactions, so that
+  # they pay for one commit (and one WAL sync) between them instead of one each.
+  #
+  #   queue = db.write_queue(batch_size: 64)
+  #   queue.submit("insert into events (name) values (?)", ["signup"])
+  #   queue.submit { |db| db.execute("update counters set n = n + 1") }
+  #
+  # The first thread to submit a write becomes the committer. It waits up to +window+ seconds
+  # for more writes to arrive, or until +batch_size+ are queued, then runs them in order in one
+  # <tt>BEGIN IMMEDIATE</tt> transaction, each in its own savepoint. Writes submitted while a
+  # transaction is being committed are queued for the next one, so a batch forms even without
+  # a window, as long as other threads can run during the commit (see Database#release_gvl=). A write that raises is
+  # rolled back to its savepoint without affecting the others, and its exception is raised in
+  # the thread that submitted it. Every caller returns only once the transaction holding its
+  # write has been committed. When the committer's own write is done, a waiting thread takes
+  # over committing the writes that arrived meanwhile.
+  #
+  # Writes run on the committer's thread, so they shouldn't depend on thread-local state.
+  # While a queue is in use, the connection should not be written to other than through it.
+  class WriteQueue
+    Entry = Struct.new(:sql, :bind_vars, :block, :result, :error, :done) # :nodoc:
+
+    # The number of seconds the committer waits for more writes before it commits.
+    attr_accessor :window
+
+    # The maximum number of writes committed in one transaction.
+    attr_accessor :batch_size
+
+    # The Database the writes are applied to.
+    attr_reader :database
+
+    # call-seq:
+    #   SQLite3::WriteQueue.new(db, window: 0, batch_size: 64)
+    #
+    # Create a queue that coalesces writes to +db+. See also Database#write_queue.
+    def initialize(database, window: 0, batch_size: 64)
+      raise ArgumentError, "batch_size must be positive" unless batch_size.is_a?(Integer) && batch_size > 0
+
+      @database = database
+      @window = window
+      @batch_size = batch_size
+      @mutex = Mutex.new
+      @batch_full = ConditionVariable.new
+      @committed = ConditionVariable.new
+      @pending = []
+      @committing = false
+      @batches = 0
+      @writes = 0
+      @largest_batch = 0
+    end
+
+    # call-seq:
+    #   submit(sql, bind_vars = []) -> rows
+    #   submit { |db| ... } -> result of the block
+    #
+    # Queues a statement, executed as with Database#execute, or a block, which is passed the
+    # database. Returns the rows or the block's result once the write has been committed, and
+    # raises the exception the write raised, after its savepoint was rolled back, or the
+    # exception that prevented the transaction from being committed.
+    def submit(sql = nil, bind_vars = [], &block)
+      raise ArgumentError, "pass either a statement or a block" if sql.nil? == block.nil?
+
+      entry = Entry.new(sql, bind_vars, block)
+      @mutex.synchronize do
+        @pending << entry
+        @batch_full.signal if @pending.size >= @batch_size
+        until entry.done
+          if @committing
+            @committed.wait(@mutex)
+          else
+            commit_pending(entry)
+          end
+        end
+      end
+
+      raise entry.error if entry.error
+      entry.result
+    end
+
+    # Returns a Hash with the number of +:batches+ committed, the number of +:writes+ they
+    # held, the +:largest_batch+, and the number of writes +:pending+.
+    def stats
+      @mutex.synchronize do
+        {batches: @batches, writes: @writes, largest_batch: @largest_batch, pending: @pending.size}
+      end
+    end
+
+    private
+
+    # Commits batches, with the mutex held except while the transaction runs, until +entry+ has
+    # been committed, then leaves the writes queued since to another thread.
+    def commit_pending(entry)
+      @committing = true
+      begin
+        until entry.done
+          deadline = Process.clock_gettime(Process::CLOCK_MONOTONIC) + @window
+          while @pending.size < @batch_size
+            remaining = deadline - Process.clock_gettime(Process::CLOCK_MONOTONIC)
+            break if remaining <= 0
+            @batch_full.wait(@mutex, remaining)
+          end
+
+          batch = @pending.shift(@batch_size)
+          @mutex.unlock
+          begin
+            run_batch(batch)
+          ensure
+            @mutex.lock
+            batch.each { |write| write.done = true }
+            @batches += 1
+            @writes += batch.size
+            @largest_batch = batch.size if batch.size > @largest_batch
+            @committed.broadcast
+          end
+        end
+      ensure
+        # a committer interrupted while waiting takes its write back out of the queue
+        @pending.delete(entry) unless entry.done
+        @committing = false
+        @committed.broadcast
+      end
+    end
+
+    def run_batch(batch)
+      @database.transaction(:immediate) do |db|
+        batch.each do |write|
+          db.execute("SAVEPOINT sqlite3_write_queue")
+          begin
+            write.result = write.block ? write.block.call(db) : db.execute(write.sql, write.bind_vars)
+            db.execute("RELEASE sqlite3_write_queue")
+          rescue ::Exception => e # standard:disable Lint/RescueException
+            write.error = e
+            db.execute("ROLLBACK TO sqlite3_write_queue")
+            db.execute("RELEASE sqlite3_write_queue")
+          end
+        end
+      end
+    rescue ::Exception => e # standard:disable Lint/RescueException
+      # a failed COMMIT leaves the transaction open
+      @database.rollback if @database.transaction_active?
+      batch.each do |write|
+        write.result = nil
+        write.error ||= e
+      end
+    end
+  end
+end
@@ -0,0 +1,123 @@
+# frozen_string_literal: true
+
+module SQLite3
+  # A WriterLock queues the connections of this process that write to the same database file,
+  # so that they take turns in arrival order instead of contending for SQLite's lock through
+  # the busy handler. Enable it with Database#writer_lock= or the +writer_lock:+ option to
+  # Database.new; Database#transaction then acquires it before <tt>BEGIN IMMEDIATE</tt> or
+  # <tt>BEGIN EXCLUSIVE</tt> and releases it when the transaction ends. The busy handler is
+  # left to deal with other processes.
+  #
+  # Connections to the same file share one lock:
+  #
+  #   a = SQLite3::Database.new("app.db", writer_lock: true)
+  #   b = SQLite3::Database.new("app.db", writer_lock: true)
+  #   a.writer_lock.equal?(b.writer_lock) # => true
+  #
+  # The lock is not reentrant: a thread that holds it and begins a write transaction on
+  # another connection to the same file raises BusyException instead of waiting for itself.
+  class WriterLock
+    @locks = {}
+    @mutex = Mutex.new
+
+    class << self
+      # Returns the lock shared by the connections of this process to +db+'s main database
+      # file.
+      def for(db)
+        path = db.filename
+        raise ArgumentError, "a writer lock requires a database file" if path.nil? || path.empty?
+
+        @mutex.synchronize { @locks[path] ||= new }
+      end
+
+      # Forgets the locks, which may be held by threads that did not survive a fork. Called
+      # by ForkSafety.
+      def discard # :nodoc:
+        @locks = {}
+        @mutex = Mutex.new
+      end
+    end
+
+    def initialize # :nodoc:
+      @mutex = Mutex.new
+      @queue = []
+      @owner = nil
+      @acquisitions = 0
+      @contended = 0
+      @max_queue_depth = 0
+      @wait_time = 0.0
+      @max_wait_time = 0.0
+    end
+
+    # Waits for the threads queued before this one, then takes the lock.
+    def acquire
+      @mutex.synchronize do
+        if @owner.equal?(Thread.current)
+          raise BusyException, "the writer lock is already held by this thread"
+        end
+
+        if @owner || !@queue.empty?
+          started = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+          turn = ConditionVariable.new
+          @queue << turn
+          @max_queue_depth = @queue.size if @queue.size > @max_queue_depth
+          begin
+            turn.wait(@mutex) until @owner.nil? && @queue.first.equal?(turn)
+            @queue.shift
+            turn = nil
+          ensure
+            # a waiter that gives up passes its turn on
+            if turn
+              @queue.delete(turn)
+              @queue.first&.signal if @owner.nil?
+            end
+          end
+
+          waited = Process.clock_gettime(Process::CLOCK_MONOTONIC) - started
+          @contended += 1
+          @wait_time += waited
+          @max_wait_time = waited if waited > @max_wait_time
+        end
+
+        @owner = Thread.current
+        @acquisitions += 1
+      end
+      self
+    end
+
+    # Releases the lock and wakes the next thread in the queue.
+    def release
+      @mutex.synchronize do
+        @owner = nil
+        @queue.first&.signal
+      end
+      nil
+    end
+
+    # Returns true if a thread holds the lock.
+    def locked?
+      !@owner.nil?
+    end
+
+    # Returns a Hash of metrics:
+    #
+    # - +:acquisitions+: the number of times the lock was taken
+    # - +:contended+: the number of those that had to wait
+    # - +:queue_depth+: the number of threads waiting now
+    # - +:max_queue_depth+: the largest number of threads that waited at once
+    # - +:wait_time+: the total number of seconds threads waited
+    # - +:max_wait_time+: the longest wait, in seconds
+    def stats
+      @mutex.synchronize do
+        {
+          acquisitions: @acquisitions,
+          contended: @contended,
+          queue_depth: @queue.size,
+          max_queue_depth: @max_queue_depth,
+          wait_time: @wait_time,
+          max_wait_time: @max_wait_time
+        }
+      end
+    end
+  end
+end
@@ -124,6 +124,12 @@ module SQLite3
       skip("GC stress is too slow to measure throughput") if gc_level == :stress
     end
 
+    def count_allocations
+      before = GC.stat(:total_allocated_objects)
+      yield
+      GC.stat(:total_allocated_objects) - before
+    end
+
     def windows?
       ::RUBY_PLATFORM =~ /mingw|mswin/
     end
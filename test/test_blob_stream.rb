@@ -0,0 +1,208 @@
+require "helper"
+require "tmpdir"
+
+module SQLite3
+  class TestBlobStream < SQLite3::TestCase
+    def setup
+      @db = SQLite3::Database.new(":memory:")
+      @db.execute("create table files (id integer primary key, data blob)")
+      @db.execute("insert into files (id, data) values (1, ?), (2, ?)",
+        [SQLite3::Blob.new("hello world"), SQLite3::Blob.new("second")])
+    end
+
+    def teardown
+      @db.close unless @db.closed?
+    end
+
+    def test_read
+      @db.open_blob("files", "data", 1) do |blob|
+        assert_equal 11, blob.size
+        assert_equal "hello", blob.read(5)
+        assert_equal 5, blob.pos
+        assert_equal " world", blob.read
+        assert_equal Encoding::BINARY, blob.read.encoding
+      end
+    end
+
+    def test_read_at_the_end
+      @db.open_blob("files", "data", 1) do |blob|
+        assert_equal "hello world", blob.read(100)
+        assert_predicate blob, :eof?
+        assert_nil blob.read(1)
+        assert_equal "", blob.read
+        assert_equal "", blob.read(0)
+      end
+    end
+
+    def test_read_into_a_buffer
+      buffer = "some text".encode(Encoding::UTF_8)
+      @db.open_blob("files", "data", 1) do |blob|
+        assert_same buffer, blob.read(5, buffer)
+        assert_equal "hello", buffer
+        assert_equal Encoding::BINARY, buffer.encoding
+
+        blob.read(100, buffer)
+        assert_nil blob.read(5, buffer)
+        assert_equal "", buffer
+      end
+    end
+
+    def test_read_negative_length
+      @db.open_blob("files", "data", 1) do |blob|
+        assert_raises(ArgumentError) { blob.read(-1) }
+      end
+    end
+
+    def test_write
+      @db.open_blob("files", "data", 1, writable: true) do |blob|
+        assert_equal 5, blob.write("HELLO")
+        blob.seek(1, IO::SEEK_CUR)
+        blob.write("W")
+      end
+
+      assert_equal "HELLO World", @db.get_first_value("select data from files where id = 1")
+    end
+
+    def test_write_past_the_end
+      @db.open_blob("files", "data", 1, writable: true) do |blob|
+        blob.seek(-2, :END)
+        assert_raises(SQLite3::SQLException) { blob.write("abc") }
+      end
+    end
+
+    def test_write_to_a_read_only_stream
+      @db.open_blob("files", "data", 1) do |blob|
+        assert_raises(SQLite3::ReadOnlyException) { blob.write("x") }
+      end
+    end
+
+    def test_seek
+      @db.open_blob("files", "data", 1) do |blob|
+        assert_equal 0, blob.seek(6)
+        assert_equal "world", blob.read
+
+        blob.seek(-5, IO::SEEK_END)
+        assert_equal "wo", blob.read(2)
+
+        blob.seek(-4, :CUR)
+        assert_equal 4, blob.tell
+
+        blob.pos = 1
+        assert_equal "ello", blob.read(4)
+
+        blob.rewind
+        assert_equal "hello", blob.read(5)
+
+        assert_raises(ArgumentError) { blob.seek(-1) }
+        assert_raises(ArgumentError) { blob.seek(0, :NOWHERE) }
+      end
+    end
+
+    def test_reopen
+      skip("sqlite3_blob_reopen is not available") unless SQLite3::BlobStream.method_defined?(:reopen)
+
+      @db.open_blob("files", "data", 1) do |blob|
+        blob.read(5)
+        assert_same blob, blob.reopen(2)
+        assert_equal 0, blob.pos
+        assert_equal 6, blob.size
+        assert_equal "second", blob.read
+
+        assert_raises(SQLite3::SQLException) { blob.reopen(3) }
+      end
+    end
+
+    def test_open_missing_row
+      assert_raises(SQLite3::SQLException) { @db.open_blob("files", "data", 3) }
+      assert_raises(SQLite3::SQLException) { @db.open_blob("files", "nope", 1) }
+    end
+
+    def test_open_attached_database
+      @db.execute("attach ':memory:' as other")
+      @db.execute("create table other.files (data blob)")
+      @db.execute("insert into other.files (rowid, data) values (7, x'0102')")
+
+      @db.open_blob("files", "data", 7, db_name: "other") do |blob|
+        assert_equal "\x01\x02".b, blob.read
+      end
+    end
+
+    def test_without_a_block
+      blob = @db.open_blob("files", "data", 1)
+      refute_predicate blob, :closed?
+      assert_equal "hello world", blob.read
+    ensure
+      blob&.close
+    end
+
+    def test_block_closes_the_stream
+      stream = @db.open_blob("files", "data", 1) { |blob| blob }
+      assert_predicate stream, :closed?
+      assert_raises(SQLite3::Exception) { stream.read }
+      assert_raises(SQLite3::Exception) { stream.close }
+    end
+
+    def test_closed_database
+      blob = @db.open_blob("files", "data", 1)
+      @db.close
+
+      assert_raises(SQLite3::Exception) { blob.read }
+      assert_raises(ArgumentError) { @db.open_blob("files", "data", 1) }
+    ensure
+      blob&.close
+    end
+
+    def test_updating_the_row_expires_the_stream
+      @db.open_blob("files", "data", 1) do |blob|
+        @db.execute("update files set data = 'changed' where id = 1")
+        assert_raises(SQLite3::AbortException) { blob.read(1) }
+      end
+    end
+
+    CHUNK = 64 * 1024
+    STREAMED_SIZE = 32 * 1024 * 1024
+
+    def test_streaming_uses_flat_memory
+      Dir.mktmpdir do |dir|
+        db = SQLite3::Database.new(File.join(dir, "blobs.db"))
+        db.execute("create table files (data blob)")
+        db.execute("insert into files (data) values (zeroblob(?))", [STREAMED_SIZE])
+        rowid = db.last_insert_row_id
+        chunk = SQLite3::Blob.new("x" * CHUNK)
+        buffer = +""
+        total = 0
+
+        written = streamed_memory do
+          db.open_blob("files", "data", rowid, writable: true) do |blob|
+            blob.write(chunk) until blob.eof?
+          end
+        end
+        read = streamed_memory do
+          db.open_blob("files", "data", rowid) do |blob|
+            total += buffer.bytesize while blob.read(CHUNK, buffer)
+          end
+        end
+
+        assert_equal STREAMED_SIZE, total
+        [written, read].each do |memory, allocations|
+          assert_operator memory, :<, STREAMED_SIZE / 8
+          assert_operator allocations, :<, STREAMED_SIZE / CHUNK
+        end
+        assert_equal STREAMED_SIZE, db.get_first_value("select length(data) from files where instr(data, 'x') = 1")
+      ensure
+        db&.close
+      end
+    end
+
+    private
+
+    # Returns how far SQLite's memory use rose above its starting point while
+    # running the block, and how many Ruby objects the block allocated.
+    def streamed_memory
+      before = SQLite3.status(SQLite3::Constants::Status::MEMORY_USED, true)[:current]
+      allocations = count_allocations { yield }
+      highwater = SQLite3.status(SQLite3::Constants::Status::MEMORY_USED)[:highwater]
+      [highwater - before, allocations]
+    end
+  end
+end
@@ -0,0 +1,185 @@
+require "helper"
+require "tmpdir"
+
+module SQLite3
+  class TestBusyBackoff < SQLite3::TestCase
+    def setup
+      @dir = Dir.mktmpdir
+      @path = File.join(@dir, "busy.db")
+      @db = SQLite3::Database.new(@path)
+      @db.transaction do
+        @db.execute "create table foo ( a integer primary key, b text )"
+        @db.execute "insert into foo ( b ) values ( 'foo' )"
+        @db.execute "insert into foo ( b ) values ( 'bar' )"
+        @db.execute "insert into foo ( b ) values ( 'baz' )"
+      end
+    end
+
+    def teardown
+      @db.close
+      FileUtils.remove_entry(@dir)
+    end
+
+    # Holds an exclusive lock on the file from another connection until a value
+    # is pushed to the returned queue.
+    def hold_exclusive_lock
+      locked = Queue.new
+      release = Queue.new
+      thread = Thread.new do
+        db2 = SQLite3::Database.open(@path)
+        db2.transaction(:exclusive) do
+          locked << true
+          release.pop
+        end
+      ensure
+        db2&.close
+      end
+      locked.pop
+      [thread, release]
+    end
+
+    def test_busy_backoff_gives_up_at_the_deadline
+      @db.busy_backoff(timeout: 200, min_delay: 1, max_delay: 20)
+      holder, release = hold_exclusive_lock
+
+      start_time = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+      assert_raise(SQLite3::BusyException) do
+        @db.execute "insert into foo (b) values ( 'from 2' )"
+      end
+      elapsed = Process.clock_gettime(Process::CLOCK_MONOTONIC) - start_time
+      assert_operator(elapsed, :>=, 0.2)
+
+      stats = @db.busy_stats
+      assert_equal 1, stats[:waits]
+      assert_equal 1, stats[:timeouts]
+      # 1, 2, 4, 8, 16 ms, then 20 ms at most, each shortened by up to half
+      assert_operator stats[:retries], :>=, 10
+      assert_operator stats[:wait_time], :>=, 0.19
+    ensure
+      release&.push(true)
+      holder&.join
+    end
+
+    def test_busy_backoff_outwaits_the_lock
+      @db.busy_backoff(timeout: 10_000)
+      holder, release = hold_exclusive_lock
+
+      Thread.new do
+        sleep(0.05)
+        release << true
+      end
+      @db.execute "insert into foo (b) values ( 'from 2' )"
+
+      stats = @db.busy_stats
+      assert_equal 1, stats[:waits]
+      assert_equal 0, stats[:timeouts]
+      assert_operator stats[:retries], :>=, 1
+      assert_equal 4, @db.get_first_value("select count(*) from foo")
+    ensure
+      holder&.join
+    end
+
+    def test_busy_backoff_releases_gvl
+      skip_if_timing_unreliable
+
+      [false, true].each do |release_gvl|
+        @db.release_gvl = release_gvl
+        @db.busy_backoff(timeout: 200)
+        holder, release = hold_exclusive_lock
+
+        count = 0
+        done = false
+        counter = Thread.new do
+          until done
+            sleep 0.005
+            count += 1
+          end
+        end
+        assert_raise(SQLite3::BusyException) do
+          @db.execute "insert into foo (b) values ( 'from 2' )"
+        end
+        done = true
+        counter.join
+
+        # 40 is the theoretical max if the wait is 200ms and the counter sleeps 5ms
+        assert_operator(count, :>=, RUBY_PLATFORM.include?("linux") ? 25 : 2, "release_gvl: #{release_gvl}")
+      ensure
+        release&.push(true)
+        holder&.join
+      end
+    end
+
+    def test_busy_backoff_stops_when_the_thread_is_interrupted
+      @db.busy_backoff(timeout: 10_000, min_delay: 50, max_delay: 50)
+      holder, release = hold_exclusive_lock
+
+      waiter = Thread.new do
+        Thread.current.report_on_exception = false
+        @db.execute "insert into foo (b) values ( 'from 2' )"
+      end
+      Thread.pass until @db.busy_stats[:waits] == 1
+      start_time = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+      waiter.raise(Interrupt)
+
+      assert_raise(Interrupt) { waiter.join }
+      assert_operator(Process.clock_gettime(Process::CLOCK_MONOTONIC) - start_time, :<, 5)
+    ensure
+      release&.push(true)
+      holder&.join
+    end
+
+    def test_busy_backoff_stops_when_interrupted_without_the_gvl
+      @db.release_gvl = true
+      @db.busy_backoff(timeout: 10_000, min_delay: 2_000, max_delay: 2_000, jitter: 0)
+      holder, release = hold_exclusive_lock
+
+      waiter = Thread.new do
+        Thread.current.report_on_exception = false
+        @db.execute "insert into foo (b) values ( 'from 2' )"
+      end
+      Thread.pass until @db.busy_stats[:waits] == 1
+      start_time = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+      waiter.raise(Interrupt)
+
+      assert_raise(Interrupt) { waiter.join }
+      assert_operator(Process.clock_gettime(Process::CLOCK_MONOTONIC) - start_time, :<, 1)
+    ensure
+      release&.push(true)
+      holder&.join
+    end
+
+    def test_busy_backoff_stops_when_the_database_is_interrupted
+      skip("requires SQLite 3.41.0 or later") if SQLite3::SQLITE_VERSION_NUMBER < 3041000
+
+      [false, true].each do |release_gvl|
+        @db.release_gvl = release_gvl
+        @db.busy_backoff(timeout: 10_000, min_delay: 2_000, max_delay: 2_000, jitter: 0)
+        holder, release = hold_exclusive_lock
+        waits = @db.busy_stats[:waits]
+
+        waiter = Thread.new do
+          Thread.current.report_on_exception = false
+          @db.execute "insert into foo (b) values ( 'from 2' )"
+        end
+        Thread.pass until @db.busy_stats[:waits] > waits
+        start_time = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+        @db.interrupt
+
+        assert_raise(SQLite3::BusyException, SQLite3::InterruptException) { waiter.join }
+        assert_operator(Process.clock_gettime(Process::CLOCK_MONOTONIC) - start_time, :<, 1, "release_gvl: #{release_gvl}")
+      ensure
+        release&.push(true)
+        holder&.join
+      end
+    end
+
+    def test_busy_backoff_arguments
+      assert_raise(ArgumentError) { @db.busy_backoff(timeout: -1) }
+      assert_raise(ArgumentError) { @db.busy_backoff(min_delay: 0) }
+      assert_raise(ArgumentError) { @db.busy_backoff(min_delay: 10, max_delay: 5) }
+      assert_raise(ArgumentError) { @db.busy_backoff(jitter: 2) }
+      assert_same @db, @db.busy_backoff
+      assert_equal({waits: 0, retries: 0, timeouts: 0, wait_time: 0.0}, @db.busy_stats)
+    end
+  end
+end
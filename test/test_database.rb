@@ -193,6 +193,76 @@ module SQLite3
       assert_equal [0], @db.execute_batch(batch)
     end
 
+    def test_batch_binds_statements_with_matching_parameters
+      result = @db.execute_batch(<<~SQL, [7])
+        CREATE TABLE items (id integer);
+        INSERT INTO items VALUES (?);
+        -- a comment between statements
+        INSERT INTO items VALUES (?);
+        SELECT count(*), sum(id) FROM items WHERE id = ?
+      SQL
+
+      assert_equal [2, 14], result
+    end
+
+    def test_batch_prepare_error
+      error = assert_raises(SQLite3::SQLException) do
+        @db.execute_batch(<<~SQL)
+          CREATE TABLE items (id integer);
+          INSERT INTO items VALUES (1);
+          INSERT INTO itemz VALUES (2);
+          INSERT INTO items VALUES (3);
+        SQL
+      end
+
+      assert_equal 2, error.statement_index
+      assert_equal 63, error.statement_offset
+      assert_equal "INSERT INTO itemz VALUES (2);", error.sql
+      assert_equal 1, @db.get_first_value("SELECT count(*) FROM items")
+    end
+
+    def test_batch_step_error
+      @db.execute("CREATE TABLE items (id integer UNIQUE)")
+
+      error = assert_raises(SQLite3::ConstraintException) do
+        @db.execute_batch("INSERT INTO items VALUES (1);\n  INSERT INTO items VALUES (1); SELECT 1")
+      end
+
+      assert_equal 1, error.statement_index
+      assert_equal 32, error.statement_offset
+      assert_equal "INSERT INTO items VALUES (1);", error.sql
+      assert_match(/UNIQUE constraint failed/, error.message)
+    end
+
+    def test_batch_errors_from_ruby_are_not_annotated
+      @db.execute("CREATE TABLE items (id integer)")
+
+      error = assert_raises(RuntimeError) { @db.execute_batch("INSERT INTO items VALUES (?)", [Object.new]) }
+      refute_respond_to error, :statement_index
+      @db.execute_batch("INSERT INTO items VALUES (?)", [1])
+    end
+
+    def test_batch_encodes_the_script_as_utf8
+      @db.execute_batch("CREATE TABLE items (name text); INSERT INTO items VALUES ('a');".encode(Encoding::UTF_16LE))
+      @db.execute_batch("INSERT INTO items VALUES ('\u00fc');".encode(Encoding::ISO_8859_1))
+
+      names = @db.execute("SELECT name, hex(name) FROM items")
+      assert_equal [["a", "61"], ["\u00fc", "C3BC"]], names
+    end
+
+    # Stands in for a benchmark of long scripts: each statement is prepared
+    # from the one buffer, so no copy of the rest of the script is made per
+    # statement.
+    def test_batch_does_not_copy_the_script_per_statement
+      @db.execute("CREATE TABLE items (id integer)")
+      script = "INSERT INTO items VALUES (1);\n" * 5_000
+
+      allocations = count_allocations { @db.execute_batch(script) }
+
+      assert_equal 5_000, @db.get_first_value("SELECT count(*) FROM items")
+      assert_operator allocations, :<, 100
+    end
+
     def test_execute_batch2
       @db.results_as_hash = true
       return_value = @db.execute_batch2 <<-EOSQL
@@ -247,6 +317,66 @@ module SQLite3
       end
     end
 
+    def test_execute_batch2_stream
+      @db.execute_batch2(<<~SQL)
+        CREATE TABLE items (id integer PRIMARY KEY, name text);
+        INSERT INTO items (name) VALUES ('foo'), ('bar'), (NULL);
+      SQL
+
+      rows = []
+      return_value = @db.execute_batch2(<<~SQL, stream: true) { |row| rows << [row, @db.get_first_value("SELECT count(*) FROM items")] }
+        SELECT * FROM items;
+        INSERT INTO items (name) VALUES ('baz');
+        SELECT name FROM items WHERE id = 4;
+      SQL
+
+      assert_nil return_value
+      assert_equal [[["1", "foo"], 3], [["2", "bar"], 3], [["3", nil], 3], [["baz"], 4]], rows
+    end
+
+    def test_execute_batch2_stream_as_hash
+      @db.results_as_hash = true
+      rows = @db.execute_batch2("SELECT 1 AS a, 2 AS b UNION ALL SELECT 3, NULL; SELECT 4 AS c", stream: true).to_a
+
+      assert_equal [{"a" => "1", "b" => "2"}, {"a" => "3", "b" => nil}, {"c" => "4"}], rows
+      assert_same rows[0].keys.first, rows[1].keys.first
+      assert_predicate rows[0].keys.first, :frozen?
+    end
+
+    def test_execute_batch2_stream_break
+      @db.execute("CREATE TABLE items (id integer)")
+
+      seen = []
+      @db.execute_batch2("SELECT 1 UNION ALL SELECT 2; INSERT INTO items VALUES (1);", stream: true) do |row|
+        seen << row
+        break
+      end
+
+      assert_equal [["1"]], seen
+      assert_equal 0, @db.get_first_value("SELECT count(*) FROM items")
+    end
+
+    def test_execute_batch2_stream_raise
+      @db.execute("CREATE TABLE items (id integer)")
+
+      error = assert_raises(RuntimeError) do
+        @db.execute_batch2("SELECT 1; INSERT INTO items VALUES (1);", stream: true) { raise "boom" }
+      end
+
+      assert_equal "boom", error.message
+      assert_equal 0, @db.get_first_value("SELECT count(*) FROM items")
+      refute_predicate @db, :transaction_active?
+      @db.close
+      assert_predicate @db, :closed?
+    end
+
+    def test_execute_batch2_column_names_are_shared
+      @db.results_as_hash = true
+      rows = @db.execute_batch2("SELECT 1 AS a UNION ALL SELECT 2")
+
+      assert_same rows[0].keys.first, rows[1].keys.first
+    end
+
     def test_new
       db = SQLite3::Database.new(":memory:")
       assert_instance_of(SQLite3::Database, db)
@@ -762,6 +892,72 @@ module SQLite3
       assert_equal [["foo"]], @db.execute("select :n", {"n" => "foo"})
     end
 
+    def test_execute_fast_matches_execute
+      @db.execute("create table foo (a integer, b text, c real, d blob)")
+      @db.execute("insert into foo values (1, 'one', 1.5, x'00ff'), (2, NULL, NULL, NULL)")
+
+      [
+        ["select * from foo", []],
+        ["select * from foo where a = ?", [1]],
+        ["select * from foo where a = ?", 2],
+        ["select * from foo where a = ? or a = ?", [[1], [2]]],
+        ["select * from foo where a = :a", {a: 2}],
+        ["select * from foo where a = :a and b = ?", ["one", {"a" => 1}]],
+        ["select count(*) from foo where 0", []]
+      ].each do |sql, binds|
+        expected = @db.execute(sql, binds)
+        actual = @db.execute_fast(sql, binds)
+        assert_equal expected, actual, sql
+        assert_predicate actual, :frozen?
+        assert_equal expected.map(&:frozen?), actual.map(&:frozen?)
+      end
+
+      @db.results_as_hash = true
+      assert_equal @db.execute("select * from foo"), @db.execute_fast("select * from foo")
+    end
+
+    def test_execute_fast_with_block
+      @db.execute("create table foo (a integer)")
+      @db.execute_fast("insert into foo values (1), (2)")
+
+      rows = []
+      assert_nil(@db.execute_fast("select a from foo order by a") { |row| rows << row })
+      assert_equal [[1], [2]], rows
+    end
+
+    def test_execute_fast_errors_leave_the_connection_usable
+      @db.execute("create table foo (a integer primary key)")
+      @db.execute_fast("insert into foo values (?)", [1])
+
+      assert_raises(SQLite3::ConstraintException) { @db.execute_fast("insert into foo values (?)", [1]) }
+      assert_raises(SQLite3::RangeException) { @db.execute_fast("select * from foo where a = ?", [1, 2]) }
+      assert_raises(RuntimeError) { @db.execute_fast("select * from foo") { raise "boom" } }
+
+      assert_equal [[1]], @db.execute_fast("select * from foo where a = ?", [1])
+      assert_equal [[nil]], @db.execute_fast("select ?")
+    end
+
+    def test_execute_fast_on_a_closed_database
+      @db.close
+      assert_raises(SQLite3::Exception) { @db.execute_fast("select 1") }
+    end
+
+    def test_execute_fast_allocates_less_than_execute
+      @db.execute("create table foo (a integer, b text)")
+      100.times { |i| @db.execute("insert into foo values (?, ?)", [i, "row #{i}"]) }
+      sql = "select * from foo where a < ?"
+      binds = [10]
+      2.times do
+        @db.execute(sql, binds)
+        @db.execute_fast(sql, binds)
+      end
+
+      execute = count_allocations { @db.execute(sql, binds) }
+      execute_fast = count_allocations { @db.execute_fast(sql, binds) }
+
+      assert_operator execute_fast, :<, execute
+    end
+
     def test_strict_mode
       unless Gem::Requirement.new(">= 3.29.0").satisfied_by?(Gem::Version.new(SQLite3::SQLITE_VERSION))
         skip("strict mode feature not available in #{SQLite3::SQLITE_VERSION}")
@@ -0,0 +1,124 @@
+require "helper"
+
+module SQLite3
+  class TestDedupText < SQLite3::TestCase
+    def setup
+      @db = SQLite3::Database.new(":memory:")
+      @db.execute("create table orders (id integer primary key, status text, note blob)")
+      @db.execute(<<~SQL)
+        WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM c WHERE x < 1000)
+        INSERT INTO orders (status, note) SELECT CASE x % 3 WHEN 0 THEN 'open' WHEN 1 THEN 'paid' ELSE 'shipped' END, x'00' FROM c
+      SQL
+    end
+
+    def teardown
+      @db.close unless @db.closed?
+    end
+
+    def test_disabled_by_default
+      refute_predicate @db, :dedup_text?
+      @db.prepare("select 1") { |stmt| refute_predicate stmt, :dedup_text? }
+
+      statuses = @db.execute("select status from orders").map(&:first)
+      assert_equal 1000, statuses.map(&:object_id).uniq.length
+    end
+
+    def test_database_option
+      db = SQLite3::Database.new(":memory:", dedup_text: true)
+      assert_predicate db, :dedup_text?
+    ensure
+      db&.close
+    end
+
+    def test_statements_inherit_the_database_setting
+      @db.dedup_text = true
+      stmt = @db.prepare("select 1")
+      assert_predicate stmt, :dedup_text?
+
+      @db.dedup_text = false
+      assert_predicate stmt, :dedup_text?
+      @db.prepare("select 1") { |s| refute_predicate s, :dedup_text? }
+    ensure
+      stmt&.close
+    end
+
+    def test_cached_statements_follow_the_database_setting
+      @db.execute("select status from orders limit 1")
+      @db.dedup_text = true
+      a = @db.execute("select status from orders limit 1").first.first
+      b = @db.execute("select status from orders limit 1").first.first
+      assert_same a, b
+    end
+
+    def test_repeated_values_share_one_object
+      @db.dedup_text = true
+      statuses = @db.execute("select status from orders").map(&:first)
+
+      assert_equal 3, statuses.map(&:object_id).uniq.length
+      assert_equal %w[open paid shipped], statuses.uniq.sort
+      assert statuses.all?(&:frozen?)
+      assert_equal Encoding::UTF_8, statuses.first.encoding
+    end
+
+    def test_every_row_form
+      @db.prepare("select status from orders") do |stmt|
+        stmt.dedup_text = true
+
+        rows = stmt.step_many(6) + stmt.step_many_hashes(6).map(&:values)
+        assert_equal 3, rows.flatten.map(&:object_id).uniq.length
+
+        stmt.reset!
+        assert_equal 3, stmt.fetch_columns["status"].map(&:object_id).uniq.length
+
+        stmt.reset!
+        first = stmt.step.first
+        2.times { stmt.step_hash }
+        assert_same first, stmt.step.first
+      end
+
+      @db.dedup_text = true
+      @db.results_as_hash = true
+      statuses = @db.execute_fast("select status from orders").map { |row| row["status"] }
+      assert_equal 3, statuses.map(&:object_id).uniq.length
+    end
+
+    def test_blobs_are_not_deduplicated
+      @db.dedup_text = true
+      notes = @db.execute("select note from orders limit 10").map(&:first)
+      assert_equal 10, notes.map(&:object_id).uniq.length
+      assert_equal Encoding::BINARY, notes.first.encoding
+    end
+
+    def test_internal_encoding
+      warn_before = $-w
+      $-w = false
+      before_enc = Encoding.default_internal
+      Encoding.default_internal = "EUC-JP"
+
+      @db.dedup_text = true
+      @db.execute("insert into orders (status) values (?)", ["日本"])
+      values = @db.execute("select status from orders where id > 1000 union all select status from orders where id > 1000")
+        .map(&:first)
+
+      assert_equal "日本".encode("EUC-JP"), values.first
+      assert_equal Encoding::EUC_JP, values.first.encoding
+      assert_predicate values.first, :frozen?
+      assert_same values.first, values.last
+    ensure
+      Encoding.default_internal = before_enc
+      $-w = warn_before
+    end
+
+    def test_fewer_allocations
+      sql = "select status from orders"
+      @db.execute(sql)
+
+      plain = count_allocations { @db.execute(sql) }
+      @db.dedup_text = true
+      @db.execute(sql)
+      deduped = count_allocations { @db.execute(sql) }
+
+      assert_operator deduped, :<, plain - 900
+    end
+  end
+end
@@ -0,0 +1,183 @@
+require "helper"
+
+module SQLite3
+  class TestJSON < SQLite3::TestCase
+    # {"a":[1,true],"b":"x\"y"}, as SQLite encodes it
+    JSONB_DOC = "\xCC\x0D\x17a\x3B\x131\x01\x17b\x48x\\\"y".b
+
+    def setup
+      @db = SQLite3::Database.new(":memory:")
+      @db.execute("create table docs (id integer primary key, body json, bin jsonb)")
+    end
+
+    def teardown
+      @db.close unless @db.closed?
+    end
+
+    def test_json_columns
+      @db.type_translators = true
+      @db.execute("insert into docs (body, bin) values (?, ?)",
+        ['{"a": [1, true], "b": "x\"y", "c": {"d": null, "e": -1.5e3, "f": 123456789012345678901}}', JSONB_DOC])
+
+      body, bin = @db.execute("select body, bin from docs").first
+      assert_equal({"a" => [1, true], "b" => "x\"y", "c" => {"d" => nil, "e" => -1500.0, "f" => 123456789012345678901}}, body)
+      assert_equal({"a" => [1, true], "b" => "x\"y"}, bin)
+      assert_equal Encoding::UTF_8, body["b"].encoding
+    end
+
+    def test_json_scalars
+      @db.type_translators = {"json" => :json}
+      ['"text"', "[]", "{}", "true", "null", " 0 ", "-0.25", '"é😀\n\/"'].each do |text|
+        @db.execute("insert into docs (body) values (?)", [text])
+      end
+
+      assert_equal ["text", [], {}, true, nil, 0, -0.25, "é😀\n/"],
+        @db.execute("select body from docs order by id").map(&:first)
+    end
+
+    def test_values_that_are_not_json_are_returned_unchanged
+      @db.type_translators = true
+      ["plain text", '{"a": 1', "[1,]", "01", '"\x41"', "{a: 1}", SQLite3::Blob.new("\x00\xFF"), 7].each do |value|
+        @db.execute("insert into docs (body) values (?)", [value])
+      end
+
+      assert_equal ["plain text", '{"a": 1', "[1,]", 1, '"\x41"', "{a: 1}", "\x00\xFF".b, 7],
+        @db.execute("select body from docs order by id").map(&:first)
+    end
+
+    def test_keys_are_deduplicated
+      @db.type_translators = true
+      2.times { @db.execute("insert into docs (body, bin) values (?, ?)", ['{"name": 1}', JSONB_DOC]) }
+
+      a, b = @db.execute("select body, bin from docs")
+      assert_same a[0].keys.first, b[0].keys.first
+      assert_same a[1].keys.first, b[1].keys.first
+      assert_predicate a[0].keys.first, :frozen?
+    end
+
+    def test_column_translators
+      @db.execute("insert into docs (body) values (?)", ['{"tags": ["a", "b"], "n": 1}'])
+
+      @db.prepare("select body -> '$.tags' as tags, json_array(1, 2), body from docs") do |stmt|
+        assert_nil stmt.column_translators
+        stmt.column_translators = {tags: :json, 1 => :json}
+        assert_equal({"tags" => :json, 1 => :json}, stmt.column_translators)
+        assert_equal [[%w[a b], [1, 2], '{"tags": ["a", "b"], "n": 1}']], stmt.to_a
+
+        stmt.reset!
+        stmt.column_translators = nil
+        assert_equal [['["a","b"]', "[1,2]", '{"tags": ["a", "b"], "n": 1}']], stmt.to_a
+      end
+    end
+
+    def test_column_translators_take_precedence
+      @db.type_translators = true
+      @db.execute("insert into docs (body) values ('[1]')")
+
+      @db.prepare("select body from docs") do |stmt|
+        stmt.column_translators = {"body" => ->(text) { text.length }}
+        assert_equal [[3]], stmt.to_a
+      end
+    end
+
+    def test_invalid_column_translators
+      @db.prepare("select 1") do |stmt|
+        assert_raises(ArgumentError) { stmt.column_translators = {0 => :nope} }
+        assert_raises(TypeError) { stmt.column_translators = {1.5 => :json} }
+        assert_raises(TypeError) { stmt.column_translators = [:json] }
+      end
+    end
+
+    def test_dump
+      assert_equal "\x6C\x17a\x3B\x131\x01".b, SQLite3::JSONB.dump({a: [1, true]})
+      assert_predicate SQLite3::JSONB.dump([]), :frozen?
+      assert_equal Encoding::BINARY, SQLite3::JSONB.dump([]).encoding
+    end
+
+    def test_dump_and_load
+      [
+        true, false, 0, -42, 2**70, -2**70, 1.5, -0.0, 1.0e+20, 2.5e-7, "", "plain", "quote\" \\ \n\u0001",
+        "é😀", :sym, [], {}, [[[]]], {"a" => {"b" => [1, {"c" => nil}]}},
+        {"long" => "x" * 300, "longer" => "y" * 70_000}, Array.new(20) { |i| i }
+      ].each do |value|
+        expected = value.is_a?(Symbol) ? value.to_s : value
+        assert_equal expected, SQLite3::JSONB.load(SQLite3::JSONB.dump(value)), value.inspect[0, 40]
+      end
+
+      assert_nil SQLite3::JSONB.load(SQLite3::JSONB.dump(nil))
+      assert_equal({"1" => 2, "sym" => 3}, SQLite3::JSONB.load(SQLite3::JSONB.dump({1 => 2, :sym => 3})))
+    end
+
+    def test_load_invalid
+      ["", "\x13", "\x1312", "\x0D", "\x21\x00".b, "\x1B\x13", "\x2C\x13\x31", "\x1C\x17", "\x1Cx"].each do |blob|
+        assert_raises(ArgumentError, blob.inspect) { SQLite3::JSONB.load(blob.b) }
+      end
+    end
+
+    def test_dump_unsupported
+      assert_raises(TypeError) { SQLite3::JSONB.dump(Object.new) }
+      assert_raises(TypeError) { SQLite3::JSONB.dump({"a" => [Time.now]}) }
+      assert_raises(ArgumentError) { SQLite3::JSONB.dump(Float::NAN) }
+      assert_raises(ArgumentError) { SQLite3::JSONB.dump([Float::INFINITY]) }
+
+      deep = []
+      1000.times { deep = [deep] }
+      assert_raises(ArgumentError) { SQLite3::JSONB.dump(deep) }
+      cyclic = []
+      cyclic << cyclic
+      assert_raises(ArgumentError) { SQLite3::JSONB.dump(cyclic) }
+    end
+
+    def test_nesting_limit
+      @db.type_translators = true
+      @db.execute("insert into docs (body) values (?), (?)", ["[" * 1000 + "]" * 1000, "[" * 1001 + "]" * 1001])
+
+      shallow, deep = @db.execute("select body from docs order by id").map(&:first)
+      assert_kind_of Array, shallow
+      assert_equal "[" * 1001 + "]" * 1001, deep
+    end
+
+    def test_bind
+      @db.type_translators = true
+      doc = SQLite3::JSONB.new({"tags" => %w[a b], "n" => 1})
+      assert_equal({"tags" => %w[a b], "n" => 1}, doc.value)
+      assert_equal SQLite3::JSONB.new({"tags" => %w[a b], "n" => 1}), doc
+
+      @db.execute("insert into docs (bin) values (?)", [doc])
+      @db.execute("insert into docs (bin) values (:doc)", {doc: SQLite3::JSONB.new([nil])})
+
+      assert_equal [["blob", {"tags" => %w[a b], "n" => 1}], ["blob", [nil]]],
+        @db.execute("select typeof(bin), bin from docs order by id")
+    end
+
+    def test_sqlite_reads_jsonb
+      unless Gem::Requirement.new(">= 3.45.0").satisfied_by?(Gem::Version.new(SQLite3::SQLITE_LOADED_VERSION))
+        skip("JSONB is not available in #{SQLite3::SQLITE_LOADED_VERSION}")
+      end
+
+      value = {"a" => [1, 2.5, nil, true], "b" => "quote\" é😀", "c" => {}, "long" => "x" * 70_000}
+      @db.execute("insert into docs (bin) values (?)", [SQLite3::JSONB.new(value)])
+
+      assert_equal 1, @db.get_first_value("select json_valid(bin, 8) from docs")
+      assert_equal "quote\" é😀", @db.get_first_value("select bin ->> '$.b' from docs")
+      assert_equal value, SQLite3::JSONB.load(@db.get_first_value("select jsonb(json(bin)) from docs"))
+    end
+
+    def test_sqlite_jsonb_with_json5
+      unless Gem::Requirement.new(">= 3.45.0").satisfied_by?(Gem::Version.new(SQLite3::SQLITE_LOADED_VERSION))
+        skip("JSONB is not available in #{SQLite3::SQLITE_LOADED_VERSION}")
+      end
+
+      @db.type_translators = true
+      @db.execute("insert into docs (bin) values (jsonb(?))",
+        [%q({hex: 0x1F, neg: -0x10, half: +.5, whole: 5., big: -Infinity, 'single': 'it\'s', esc: "\x41é\
+x", arr: [1, 2,],})])
+
+      assert_equal(
+        {"hex" => 31, "neg" => -16, "half" => 0.5, "whole" => 5.0, "big" => -Float::INFINITY, "single" => "it's",
+         "esc" => "Aéx", "arr" => [1, 2]},
+        @db.get_first_value("select bin from docs")
+      )
+    end
+  end
+end
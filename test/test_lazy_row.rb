@@ -0,0 +1,127 @@
+require "helper"
+
+module SQLite3
+  class TestLazyRow < SQLite3::TestCase
+    def setup
+      @db = SQLite3::Database.new(":memory:")
+      @db.execute("create table wide (id integer, score real, name text, body text, data blob, empty)")
+      @db.execute("insert into wide values (?, ?, ?, ?, ?, ?)",
+        [1, 2.5, "one", "x" * 10_000, SQLite3::Blob.new("\x00\xFF"), nil])
+      @db.execute("insert into wide values (2, 3.5, 'two', 'short', x'01', null)")
+      @stmt = @db.prepare("select * from wide")
+    end
+
+    def teardown
+      @stmt.close unless @stmt.closed?
+      @db.close unless @db.closed?
+    end
+
+    def test_step_lazy
+      row = @stmt.step_lazy
+      assert_kind_of SQLite3::LazyRow, row
+      assert_equal 1, row[0]
+      assert_in_delta 2.5, row[1]
+      assert_equal "one", row[2]
+      assert_equal "x" * 10_000, row[3]
+      assert_equal "\x00\xFF".b, row[4]
+      assert_nil row[5]
+
+      assert_equal 2, @stmt.step_lazy[0]
+      assert_nil @stmt.step_lazy
+    end
+
+    def test_values_match_step
+      expected = @stmt.to_a
+      @stmt.reset!
+      lazy = @stmt.each(lazy: true).map(&:to_a)
+
+      assert_equal expected, lazy
+      assert_equal expected.flatten.map(&:class), lazy.flatten.map(&:class)
+      assert_equal expected.flatten.map(&:frozen?), lazy.flatten.map(&:frozen?)
+      assert_equal expected.flatten.map { |v| v.encoding if v.is_a?(String) },
+        lazy.flatten.map { |v| v.encoding if v.is_a?(String) }
+    end
+
+    def test_to_h_matches_step_hash
+      expected = @stmt.step_hash
+      @stmt.reset!
+      assert_equal expected, @stmt.step_lazy.to_h
+    end
+
+    def test_column_names
+      row = @stmt.step_lazy
+      assert_equal "one", row["name"]
+      assert_equal "one", row[:name]
+      assert_equal 1, row["id"]
+      assert_nil row["missing"]
+      assert_equal %w[id score name body data empty], row.columns
+      assert_equal 6, row.size
+      assert_equal 6, row.length
+    end
+
+    def test_negative_and_out_of_range_indexes
+      row = @stmt.step_lazy
+      assert_nil row[-1]
+      assert_equal "one", row[-4]
+      assert_nil row[6]
+      assert_nil row[-7]
+    end
+
+    def test_values_are_converted_once
+      row = @stmt.step_lazy
+      assert_same row[2], row[2]
+      assert_same row[2], row.to_a[2]
+    end
+
+    def test_row_outlives_the_statement
+      row = @stmt.step_lazy
+      @stmt.step
+      @stmt.close
+
+      GC.start
+      assert_equal "x" * 10_000, row["body"]
+    end
+
+    def test_duplicate_column_names
+      @db.prepare("select 1 as a, 2 as a") do |stmt|
+        row = stmt.step_lazy
+        assert_equal 2, row["a"]
+        assert_equal({"a" => 2}, row.to_h)
+        assert_equal [1, 2], row.to_a
+      end
+    end
+
+    def test_step_many_lazy
+      rows = @stmt.step_many_lazy(10)
+      assert_equal [1, 2], rows.map { |row| row["id"] }
+      assert_empty @stmt.step_many_lazy(10)
+    end
+
+    def test_dedup_text
+      @stmt.dedup_text = true
+      a = @stmt.step_lazy
+      @stmt.reset!
+      b = @stmt.step_lazy
+      assert_same a["name"], b["name"]
+    end
+
+    def test_cannot_be_instantiated
+      assert_raises(TypeError) { SQLite3::LazyRow.new }
+    end
+
+    def test_reading_one_column_allocates_less
+      @db.execute("create table many (#{(1..40).map { |i| "c#{i} text" }.join(", ")})")
+      insert = @db.prepare("insert into many values (#{(["?"] * 40).join(", ")})")
+      insert.execute_many(Array.new(100) { |r| Array.new(40) { |c| "value #{r} #{c}" } })
+      insert.close
+
+      @db.prepare("select * from many") do |stmt|
+        eager = count_allocations { stmt.each { |row| row[0] } }
+        stmt.reset!
+        lazy = count_allocations { stmt.each(lazy: true) { |row| row[0] } }
+
+        assert_operator lazy * 5, :<, eager
+      end
+    end
+  end
+end
@@ -0,0 +1,187 @@
+require "helper"
+
+module SQLite3
+  class TestNonblocking < SQLite3::TestCase
+    # Just enough of a Fiber::Scheduler to run fibers that wait on queues and
+    # sleep. Threads wake a blocked fiber through a pipe.
+    class ToyScheduler
+      def initialize
+        @waiting = {}
+        @unblocked = []
+        @mutex = Thread::Mutex.new
+        @wakeup, @waker = IO.pipe
+      end
+
+      def fiber(&block)
+        fiber = Fiber.new(blocking: false, &block)
+        fiber.resume
+        fiber
+      end
+
+      def block(blocker, timeout = nil)
+        @waiting[Fiber.current] = timeout ? now + timeout : Float::INFINITY
+        Fiber.yield
+      end
+
+      def unblock(blocker, fiber)
+        @mutex.synchronize { @unblocked << fiber }
+        @waker.write_nonblock(".", exception: false)
+      end
+
+      def kernel_sleep(duration = nil)
+        block(:sleep, duration)
+        true
+      end
+
+      def io_wait(io, events, timeout)
+        Fiber.blocking { io.wait(events, timeout) }
+      end
+
+      def close
+        until @waiting.empty?
+          timeout = @waiting.values.min - now
+          if timeout > 0
+            IO.select([@wakeup], nil, nil, timeout.infinite? ? nil : timeout)
+            @wakeup.read_nonblock(1024, exception: false)
+          end
+
+          ready = @mutex.synchronize { @unblocked.slice!(0..) }
+          time = now
+          @waiting.each { |fiber, deadline| ready << fiber if deadline <= time }
+          ready.uniq.each { |fiber| fiber.resume if @waiting.delete(fiber) }
+        end
+        @wakeup.close
+        @waker.close
+      end
+
+      private
+
+      def now
+        Process.clock_gettime(Process::CLOCK_MONOTONIC)
+      end
+    end
+
+    SLOW_QUERY = <<~SQL
+      with recursive c(x) as (select 1 union all select x + 1 from c where x < ?)
+      select count(*) from c
+    SQL
+
+    def setup
+      @db = SQLite3::Database.new(":memory:", nonblocking: true)
+      @db.execute("create table items (id integer primary key, name text)")
+    end
+
+    def teardown
+      @db.close unless @db.closed?
+    end
+
+    # Runs the block in a fiber of a ToyScheduler on a new thread, and returns
+    # once every fiber it scheduled has finished.
+    def with_scheduler(&block)
+      Thread.new do
+        Fiber.set_scheduler(ToyScheduler.new)
+        Fiber.schedule(&block)
+      end.join
+    end
+
+    def test_nonblocking
+      assert_predicate @db, :nonblocking?
+      assert_predicate @db.prepare("select 1"), :release_gvl?
+
+      @db.nonblocking = false
+      refute_predicate @db, :nonblocking?
+      refute_predicate SQLite3::Database.new(":memory:"), :nonblocking?
+    end
+
+    def test_statements_run_on_a_worker_thread
+      threads = []
+      @db.create_function("thread_id", 0) { |func| func.result = threads.push(Thread.current).size }
+
+      @db.execute("select thread_id()")
+      with_scheduler do
+        @db.execute("select thread_id()")
+        @db.execute_fast("select thread_id()")
+        @db.execute_batch("select thread_id(); select thread_id()")
+        Fiber.blocking { @db.execute("select thread_id()") }
+      end
+
+      caller_threads = [threads[0], threads[5]]
+      workers = threads[1..4]
+      assert_equal 1, workers.uniq.size
+      refute_includes caller_threads, workers.first
+    end
+
+    def test_other_fibers_run_while_a_query_does
+      ticks = 0
+      result = ticks_when_done = nil
+      with_scheduler do
+        ticker = Fiber.schedule do
+          until result
+            ticks += 1
+            sleep(0.001)
+          end
+        end
+        Fiber.schedule do
+          result = @db.get_first_value(SLOW_QUERY, 2_000_000)
+          ticks_when_done = ticks
+        end
+        refute_nil ticker
+      end
+
+      assert_equal 2_000_000, result
+      assert_operator ticks_when_done, :>, 0
+    end
+
+    def test_results_and_errors_are_returned_to_the_fiber
+      rows = error = nil
+      with_scheduler do
+        @db.execute("insert into items (name) values (?)", ["a"])
+        stmt = @db.prepare("insert into items (name) values (?)")
+        stmt.execute_many([["b"], ["c"]])
+        stmt.close
+        rows = [
+          @db.execute("select name from items order by id"),
+          @db.execute_fast("select count(*) from items"),
+          @db.prepare("select name from items order by id").each.to_a
+        ]
+        error = assert_raises(SQLite3::SQLException) { @db.execute("select * from missing") }
+      end
+
+      assert_equal [[["a"], ["b"], ["c"]], [[3]], [["a"], ["b"], ["c"]]], rows
+      assert_match(/no such table/, error.message)
+    end
+
+    def test_interrupt_cancels_the_waiting_fiber
+      error = nil
+      with_scheduler do
+        Fiber.schedule do
+          error = assert_raises(SQLite3::InterruptException) do
+            @db.get_first_value(SLOW_QUERY, 1_000_000_000)
+          end
+        end
+        sleep(0.05)
+        @db.interrupt
+      end
+
+      assert_kind_of SQLite3::InterruptException, error
+      assert_equal 1, @db.get_first_value("select 1")
+    end
+
+    def test_stopping_the_fiber_interrupts_the_query
+      elapsed = nil
+      with_scheduler do
+        started = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+        query = Fiber.schedule do
+          @db.get_first_value(SLOW_QUERY, 1_000_000_000)
+        rescue Interrupt
+          elapsed = Process.clock_gettime(Process::CLOCK_MONOTONIC) - started
+        end
+        sleep(0.05)
+        query.raise(Interrupt)
+      end
+
+      assert_operator elapsed, :<, 5
+      assert_equal 1, @db.get_first_value("select 1")
+    end
+  end
+end
@@ -0,0 +1,274 @@
+require "helper"
+require "tmpdir"
+
+module SQLite3
+  class TestPool < SQLite3::TestCase
+    def setup
+      @dir = Dir.mktmpdir
+      @path = File.join(@dir, "pool.db")
+      @pool = SQLite3::Pool.new(@path, readers: 2)
+      @pool.write { |db| db.execute("create table items (id integer primary key, name text)") }
+    end
+
+    def teardown
+      @pool.close
+      FileUtils.remove_entry(@dir)
+    end
+
+    def test_read_and_write
+      @pool.write { |db| db.execute("insert into items (name) values ('a')") }
+
+      assert_equal [["a"]], @pool.read { |db| db.execute("select name from items") }
+      @pool.write do |db|
+        assert_equal "wal", db.journal_mode
+        refute_predicate db, :readonly?
+      end
+      @pool.read do |db|
+        assert_predicate db, :readonly?
+        assert_equal true, db.query_only
+        assert_raises(SQLite3::ReadOnlyException) { db.execute("insert into items (name) values ('b')") }
+      end
+    end
+
+    def test_nested_calls_reuse_the_held_connection
+      @pool.read do |reader|
+        @pool.read { |db| assert_same reader, db }
+        @pool.write { |db| refute_same reader, db }
+      end
+
+      @pool.write do |writer|
+        writer.execute("insert into items (name) values ('uncommitted')")
+        writer.transaction do
+          writer.execute("insert into items (name) values ('in a transaction')")
+          assert_equal 2, @pool.read { |db| db.get_first_value("select count(*) from items") }
+          @pool.write { |db| assert_same writer, db }
+        end
+      end
+    end
+
+    def test_readers_are_not_blocked_by_the_writer
+      @pool.write { |db| db.execute("insert into items (name) values ('committed')") }
+
+      @pool.write do |writer|
+        writer.transaction(:immediate) do
+          writer.execute("insert into items (name) values ('pending')")
+
+          counts = Queue.new
+          release = Queue.new
+          readers = Array.new(2) do
+            Thread.new do
+              @pool.read do |db|
+                counts << db.get_first_value("select count(*) from items")
+                release.pop
+              end
+            end
+          end
+          assert_equal [1, 1], Array.new(2) { counts.pop }
+          2.times { release << true }
+          readers.each(&:join)
+        end
+      end
+      assert_equal 2, @pool.stats[:readers]
+    end
+
+    def test_writers_wait_for_the_writer
+      order = Queue.new
+      threads = Array.new(4) do |i|
+        Thread.new do
+          @pool.write do |db|
+            db.transaction(:immediate) do
+              order << i
+              db.execute("insert into items (name) values (?)", [i.to_s])
+              sleep(0.01)
+            end
+          end
+        end
+      end
+      threads.each(&:join)
+
+      assert_equal 4, order.size
+      assert_equal 4, @pool.read { |db| db.get_first_value("select count(*) from items") }
+    end
+
+    def test_checkout_timeout
+      pool = SQLite3::Pool.new(@path, readers: 1, checkout_timeout: 0.05)
+      held = Queue.new
+      release = Queue.new
+      thread = Thread.new do
+        pool.read do
+          held << true
+          release.pop
+        end
+      end
+      held.pop
+
+      assert_raises(SQLite3::Pool::TimeoutError) { pool.read { flunk } }
+      assert_raises(SQLite3::Pool::TimeoutError) { pool.read(timeout: 0) { flunk } }
+      assert_equal 2, pool.stats[:timeouts]
+
+      release << true
+      thread.join
+      assert_equal 0, pool.read { |db| db.get_first_value("select count(*) from items") }
+    ensure
+      pool&.close
+    end
+
+    def test_waiting_reader_gets_the_returned_connection
+      pool = SQLite3::Pool.new(@path, readers: 1)
+      first = nil
+      thread = Thread.new { pool.read { |db| first = db } }
+      waiting = pool.read do |db|
+        thread.join(0.05)
+        db
+      end
+      thread.join
+
+      assert_same waiting, first
+      assert_equal({readers: 1, idle_readers: 1, writer: :idle, waiting: 0, timeouts: 0}, pool.stats)
+    ensure
+      pool&.close
+    end
+
+    def test_readers_prefer_the_thread_that_used_them
+      requests = [Queue.new, Queue.new]
+      results = Queue.new
+      workers = requests.map do |queue|
+        Thread.new do
+          while (job = queue.pop)
+            results << job.call
+          end
+        end
+      end
+      run = ->(i, &job) {
+        requests[i] << job
+        results.pop
+      }
+
+      held = Queue.new
+      release = Queue.new
+      requests[0] << -> { @pool.read { |db| held << true && release.pop && db } }
+      held.pop
+      second = run.call(1) { @pool.read(&:itself) }
+      release << true
+      first = results.pop
+      refute_same first, second
+
+      # the most recently returned reader is the first thread's
+      assert_same second, run.call(1) { @pool.read(&:itself) }
+      assert_same first, run.call(0) { @pool.read(&:itself) }
+    ensure
+      requests&.each { |queue| queue << nil }
+      workers&.each(&:join)
+    end
+
+    def test_open_transactions_are_rolled_back_on_checkin
+      @pool.write do |db|
+        db.execute("begin")
+        db.execute("insert into items (name) values ('abandoned')")
+      end
+
+      @pool.write { |db| refute_predicate db, :transaction_active? }
+      assert_equal 0, @pool.read { |db| db.get_first_value("select count(*) from items") }
+    end
+
+    def test_closed_connections_are_replaced
+      closed = @pool.read(&:itself)
+      closed.close
+      reader = @pool.read(&:itself)
+      refute_same closed, reader
+      refute_predicate reader, :closed?
+
+      writer = @pool.write { |db| db.tap(&:close) }
+      @pool.write do |db|
+        refute_same writer, db
+        db.execute("insert into items (name) values ('again')")
+      end
+      assert_equal 1, @pool.stats[:readers]
+    end
+
+    def test_idle_connections_are_checked
+      pool = SQLite3::Pool.new(@path, readers: 1, health_check_interval: 0)
+      reader = pool.read(&:itself)
+      reader.execute("select 1")
+
+      assert_same reader, pool.read(&:itself)
+    ensure
+      pool&.close
+    end
+
+    def test_close
+      reader = @pool.read(&:itself)
+      in_use = nil
+      @pool.write do |writer|
+        in_use = writer
+        @pool.close
+        refute_predicate writer, :closed?
+      end
+
+      assert_predicate reader, :closed?
+      assert_predicate in_use, :closed?
+      assert_predicate @pool, :closed?
+      assert_raises(SQLite3::Exception) { @pool.read {} }
+      assert_raises(SQLite3::Exception) { @pool.write {} }
+    end
+
+    def test_close_wakes_waiting_threads
+      pool = SQLite3::Pool.new(@path, readers: 1)
+      held = Queue.new
+      thread = Thread.new do
+        pool.read do
+          held << true
+          sleep(0.05)
+          pool.close
+        end
+      end
+      held.pop
+
+      error = assert_raises(SQLite3::Exception) { pool.read {} }
+      assert_match(/closed pool/, error.message)
+      thread.join
+    end
+
+    def test_invalid_options
+      assert_raises(ArgumentError) { SQLite3::Pool.new(@path, readers: 0) }
+      assert_raises(ArgumentError) { SQLite3::Pool.new(@path, readonly: true) }
+    end
+
+    def test_fork_reopens_connections
+      skip("interpreter doesn't support fork") unless Process.respond_to?(:fork)
+      skip("valgrind doesn't handle forking") if i_am_running_in_valgrind
+
+      parent_reader = @pool.read(&:itself)
+      parent_writer = @pool.write(&:itself)
+
+      read, write = IO.pipe
+      pid = Process.fork do
+        read.close
+        $stderr = StringIO.new
+        result = begin
+          @pool.write { |db| db.execute("insert into items (name) values ('child')") }
+          [
+            @pool.read { |db| db.equal?(parent_reader) || db.execute("select name from items") },
+            @pool.write { |db| db.equal?(parent_writer) },
+            parent_writer.closed?,
+            $stderr.string
+          ]
+        rescue => e
+          e.message
+        end
+        write.write(Marshal.dump(result))
+        write.close
+        exit!
+      end
+      write.close
+      result = Marshal.load(read.read)
+      read.close
+      Process.wait(pid)
+
+      assert_equal [[["child"]], false, true, ""], result
+      refute_predicate parent_writer, :closed?
+      @pool.write { |db| assert_same parent_writer, db }
+      assert_equal [["child"]], @pool.read { |db| db.execute("select name from items") }
+    end
+  end
+end
@@ -0,0 +1,156 @@
+require "helper"
+
+module SQLite3
+  class TestReleaseGvl < SQLite3::TestCase
+    SLOW_QUERY = <<~SQL
+      WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM c WHERE x < ?)
+      SELECT count(*) FROM c
+    SQL
+
+    ENDLESS_QUERY = <<~SQL
+      WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM c)
+      SELECT count(*) FROM c
+    SQL
+
+    def setup
+      @db = SQLite3::Database.new(":memory:")
+    end
+
+    def teardown
+      @db.close unless @db.closed?
+    end
+
+    def test_disabled_by_default
+      refute_predicate @db, :release_gvl?
+      @db.prepare("select 1") { |stmt| refute_predicate stmt, :release_gvl? }
+    end
+
+    def test_database_option
+      db = SQLite3::Database.new(":memory:", release_gvl: true)
+      assert_predicate db, :release_gvl?
+    ensure
+      db&.close
+    end
+
+    def test_statements_inherit_the_database_setting
+      @db.release_gvl = true
+      stmt = @db.prepare("select 1")
+      assert_predicate stmt, :release_gvl?
+
+      @db.release_gvl = false
+      assert_predicate stmt, :release_gvl?
+      @db.prepare("select 1") { |s| refute_predicate s, :release_gvl? }
+    ensure
+      stmt&.close
+    end
+
+    def test_statement_setting
+      @db.prepare("select 1") do |stmt|
+        stmt.release_gvl = true
+        assert_predicate stmt, :release_gvl?
+        assert_equal [[1]], stmt.execute.to_a
+      end
+    end
+
+    def test_results
+      @db.release_gvl = true
+      @db.execute("create table foo (a integer, b text, c real, d blob)")
+      @db.execute("insert into foo values (?, ?, ?, ?)", [1, "two", 3.0, SQLite3::Blob.new("four")])
+
+      assert_equal [[1, "two", 3.0, "four"]], @db.execute("select * from foo")
+      assert_equal 10, @db.execute(SLOW_QUERY, [10]).first.first
+    end
+
+    def test_functions_take_the_gvl_back
+      @db.release_gvl = true
+      @db.define_function("twice") { |x| x * 2 }
+      @db.create_aggregate("total", 1) do
+        step { |ctx, x| ctx[:total] = (ctx[:total] || 0) + x }
+        finalize { |ctx| ctx.result = ctx[:total] }
+      end
+
+      assert_equal [[10]], @db.execute("select twice(5)")
+      assert_equal [[6]], @db.execute("select total(x) from (select 1 as x union all select 2 union all select 3)")
+    end
+
+    def test_collations_take_the_gvl_back
+      comparator = Class.new do
+        def compare(a, b)
+          b <=> a
+        end
+      end
+      @db.release_gvl = true
+      @db.collation("reverse", comparator.new)
+
+      rows = @db.execute("select x from (select 'a' as x union all select 'c' union all select 'b') order by x collate reverse")
+      assert_equal [["c"], ["b"], ["a"]], rows
+    end
+
+    def test_authorizer_and_trace_take_the_gvl_back
+      traced = []
+      @db.release_gvl = true
+      @db.trace { |sql| traced << sql }
+      @db.authorizer = proc { true }
+
+      assert_equal [[1]], @db.execute("select 1")
+      assert_includes traced, "select 1"
+    end
+
+    def test_exceptions_in_functions_propagate
+      @db.release_gvl = true
+      @db.define_function("boom") { |_| raise ArgumentError, "boom" }
+
+      error = assert_raises(ArgumentError) { @db.execute("select boom(1)") }
+      assert_equal "boom", error.message
+
+      # the connection remains usable
+      assert_equal [[1]], @db.execute("select 1")
+    end
+
+    def test_other_threads_run_during_a_step
+      skip_if_timing_unreliable
+
+      @db.release_gvl = true
+      stop = false
+      count = 0
+      thread = Thread.new do
+        until stop
+          count += 1
+          Thread.pass
+        end
+      end
+      Thread.pass until count > 0
+
+      before = count
+      @db.execute(SLOW_QUERY, [2_000_000])
+      assert_operator count - before, :>, 10
+    ensure
+      stop = true
+      thread&.join
+    end
+
+    def test_thread_raise_interrupts_the_step
+      @db.release_gvl = true
+      started = Queue.new
+
+      thread = Thread.new do
+        Thread.current.report_on_exception = false
+        @db.prepare(ENDLESS_QUERY) do |stmt|
+          started << true
+          stmt.step
+        end
+      end
+      started.pop
+      sleep 0.05
+
+      thread.raise(Interrupt)
+      assert_raises(Interrupt) { thread.join(10) }
+      assert_equal [[1]], @db.execute("select 1")
+    ensure
+      if thread&.alive?
+        @db.interrupt
+        thread.kill.join
+      end
+    end
+  end
+end
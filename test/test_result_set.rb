@@ -43,5 +43,49 @@ module SQLite3
       end
       rs.close
     end
+
+    def test_next_batch
+      rs = @db.prepare("select 1 union all select 2 union all select 3").execute
+      assert_equal [[1], [2]], rs.next_batch(2)
+      assert_equal [[3]], rs.next_batch(2)
+      assert_empty rs.next_batch(2)
+      assert_predicate rs, :eof?
+      rs.close
+    end
+
+    def test_next_batch_as_hash
+      @db.results_as_hash = true
+      rs = @db.prepare("select 1 as a union all select 2").execute
+      assert_equal [{"a" => 1}, {"a" => 2}], rs.next_batch
+      assert_empty rs.next_batch
+      rs.close
+    end
+
+    def test_next_after_leaving_each_early
+      rs = @db.prepare("select 1 union all select 2 union all select 3").execute
+      assert_equal [1], rs.first
+      refute_predicate rs, :eof?
+      assert_equal [2], rs.next
+      assert_equal [[3]], rs.next_batch
+      assert_nil rs.next
+      assert_predicate rs, :eof?
+      rs.close
+    end
+
+    def test_next_hash_after_leaving_each_early
+      rs = @db.prepare("select 1 as a union all select 2").execute
+      assert_equal [1], rs.first
+      assert_equal({"a" => 2}, rs.next_hash)
+      assert_nil rs.next_hash
+      rs.close
+    end
+
+    def test_reset_discards_buffered_rows
+      rs = @db.prepare("select 1 union all select 2").execute
+      rs.first
+      rs.reset
+      assert_equal [[1], [2]], rs.to_a
+      rs.close
+    end
   end
 end
@@ -1,4 +1,5 @@
 require "helper"
+require "tmpdir"
 
 module SQLite3
   class TestStatement < SQLite3::TestCase
@@ -256,6 +257,91 @@ module SQLite3
       stmt.close
     end
 
+    def test_named_bind_with_any_prefix
+      stmt = SQLite3::Statement.new(@db, "select :foo, @bar, $baz, ?4")
+      stmt.bind_params(foo: 1, "bar" => 2, "$baz" => 3, "?4" => 4)
+      assert_equal [1, 2, 3, 4], stmt.step
+
+      stmt.reset!
+      stmt.bind_param(":foo", 5)
+      stmt.bind_param(:@bar, 6)
+      stmt.bind_param(:baz, 7)
+      assert_equal [5, 6, 7, 4], stmt.step
+    ensure
+      stmt&.close
+    end
+
+    def test_named_bind_prefers_colon_for_bare_names
+      stmt = SQLite3::Statement.new(@db, "select @foo, :foo")
+      stmt.bind_params(foo: 1, "@foo" => 2)
+      assert_equal [2, 1], stmt.step
+    ensure
+      stmt&.close
+    end
+
+    def test_bind_params_flattens_arrays
+      stmt = SQLite3::Statement.new(@db, "select ?, ?, ?, :d")
+      stmt.bind_params(1, [2, [3]], {d: 4})
+      assert_equal [1, 2, 3, 4], stmt.step
+    ensure
+      stmt&.close
+    end
+
+    def test_named_bind_does_not_allocate
+      stmt = SQLite3::Statement.new(@db, "select :foo, @bar, $baz")
+      binds = {foo: 1, "bar" => 2.0, baz: nil}
+      stmt.bind_params(binds)
+
+      assert_operator count_allocations { 100.times { stmt.bind_params(binds) } }, :<, 10
+      assert_equal [1, 2.0, nil], stmt.step
+    ensure
+      stmt&.close
+    end
+
+    def test_frozen_strings_are_bound_without_copying
+      big = ("x" * 4_000_000).freeze
+      stmt = SQLite3::Statement.new(@db, "select length(?), length(?)")
+
+      used = SQLite3.status(SQLite3::Constants::Status::MEMORY_USED)[:current]
+      stmt.bind_params(big, SQLite3::Blob.new(big).freeze)
+      growth = SQLite3.status(SQLite3::Constants::Status::MEMORY_USED)[:current] - used
+      assert_operator growth, :<, 1_000_000
+
+      stmt.clear_bindings!
+      stmt.bind_param(1, big.dup)
+      growth = SQLite3.status(SQLite3::Constants::Status::MEMORY_USED)[:current] - used
+      assert_operator growth, :>=, 4_000_000
+    ensure
+      stmt&.close
+    end
+
+    def test_frozen_strings_survive_gc_while_bound
+      stmt = SQLite3::Statement.new(@db, "select ?, ?")
+      stmt.bind_params("a string".dup.freeze, SQLite3::Blob.new("\x00\xFF".b).freeze)
+
+      GC.start
+      GC.compact if GC.respond_to?(:compact)
+
+      assert_equal ["a string", "\x00\xFF".b], stmt.step
+      stmt.reset!
+      assert_equal ["a string", "\x00\xFF".b], stmt.step
+    ensure
+      stmt&.close
+    end
+
+    def test_failed_rebind_keeps_the_bound_string_alive
+      stmt = SQLite3::Statement.new(@db, "select ?")
+      stmt.bind_param(1, ("a string " * 10).freeze)
+
+      assert_raises(RuntimeError) { stmt.bind_param(1, Object.new) }
+      GC.start
+      GC.compact if GC.respond_to?(:compact)
+
+      assert_equal ["a string " * 10], stmt.step
+    ensure
+      stmt&.close
+    end
+
     def test_params
       stmt = SQLite3::Statement.new(@db, "select  ?1, :foo, ?, $bar, @zed, ?250, @999, :123, $777")
       assert_equal ["foo", "bar", "zed", "999", "123", "777"], stmt.named_params
@@ -298,6 +384,593 @@ module SQLite3
       @stmt.done?
     end
 
+    def test_step_many
+      stmt = @db.prepare("select x, 'row' || x from (select 1 as x union all select 2 union all select 3)")
+
+      rows = stmt.step_many(2)
+      assert_equal [[1, "row1"], [2, "row2"]], rows
+      rows.each { |row| assert_predicate row, :frozen? }
+      refute_predicate stmt, :done?
+
+      assert_equal [[3, "row3"]], stmt.step_many(2)
+      assert_predicate stmt, :done?
+      assert_empty stmt.step_many(2)
+
+      stmt.reset!
+      assert_equal 3, stmt.step_many(100).length
+    ensure
+      stmt&.close
+    end
+
+    def test_step_hash
+      stmt = @db.prepare("select 1 as a, 'two' as b, null as c")
+      assert_equal({"a" => 1, "b" => "two", "c" => nil}, stmt.step_hash)
+      assert_nil stmt.step_hash
+      assert_predicate stmt, :done?
+    ensure
+      stmt&.close
+    end
+
+    def test_step_hash_keys_are_shared
+      stmt = @db.prepare("select x as a from (select 1 as x union all select 2)")
+      first = stmt.step_hash
+      second = stmt.step_hash
+
+      assert_same first.keys.first, second.keys.first
+      assert_same stmt.columns.first, first.keys.first
+      assert_predicate first.keys.first, :frozen?
+    ensure
+      stmt&.close
+    end
+
+    def test_step_hash_duplicate_column_names
+      stmt = @db.prepare("select 1 as a, 2 as a")
+      assert_equal({"a" => 2}, stmt.step_hash)
+    ensure
+      stmt&.close
+    end
+
+    def test_step_hash_follows_column_changes
+      @db.execute("create table foo (a)")
+      @db.execute("insert into foo values (1)")
+      stmt = @db.prepare("select * from foo")
+      assert_equal({"a" => 1}, stmt.step_hash)
+
+      @db.execute("alter table foo add column b")
+      stmt.reset!
+      assert_equal({"a" => 1, "b" => nil}, stmt.step_hash)
+    ensure
+      stmt&.close
+    end
+
+    def test_step_many_hashes
+      stmt = @db.prepare("select x as a from (select 1 as x union all select 2 union all select 3)")
+      assert_equal [{"a" => 1}, {"a" => 2}], stmt.step_many_hashes(2)
+      assert_equal [{"a" => 3}], stmt.step_many_hashes(2)
+      assert_empty stmt.step_many_hashes(2)
+    ensure
+      stmt&.close
+    end
+
+    def test_fetch_columns
+      stmt = @db.prepare("select x as a, 'row' || x as b from (select 1 as x union all select 2 union all select 3)")
+      assert_equal({"a" => [1, 2, 3], "b" => ["row1", "row2", "row3"]}, stmt.fetch_columns)
+      assert_predicate stmt, :done?
+      assert_equal({"a" => [], "b" => []}, stmt.fetch_columns)
+    ensure
+      stmt&.close
+    end
+
+    def test_fetch_columns_in_chunks
+      stmt = @db.prepare("select x as a from (select 1 as x union all select 2 union all select 3)")
+      assert_equal({"a" => [1, 2]}, stmt.fetch_columns(2))
+      refute_predicate stmt, :done?
+      assert_equal({"a" => [3]}, stmt.fetch_columns(2))
+      assert_predicate stmt, :done?
+    ensure
+      stmt&.close
+    end
+
+    def test_fetch_columns_matches_step
+      @db.execute("create table foo (i integer, f real, t text, b blob, n)")
+      @db.execute("insert into foo values (?, ?, ?, ?, ?)", [1, 2.5, "three", SQLite3::Blob.new("four"), nil])
+      rows = @db.execute("select * from foo")
+
+      @db.prepare("select * from foo") do |stmt|
+        assert_equal stmt.columns.zip(rows.transpose).to_h, stmt.fetch_columns
+      end
+    end
+
+    def test_fetch_columns_allocates_less_than_transpose
+      columns = (1..20).map { |i| "c#{i}" }
+      @db.execute("create table wide (#{columns.join(", ")})")
+      @db.transaction do
+        @db.prepare("insert into wide values (#{(["?"] * columns.length).join(", ")})") do |insert|
+          500.times { |row| insert.execute(*columns.length.times.map { |col| row * col }) }
+        end
+      end
+
+      transposed = nil
+      rows_allocations = count_allocations { transposed = @db.execute("select * from wide").transpose }
+
+      by_column = nil
+      columns_allocations = count_allocations do
+        @db.prepare("select * from wide") { |stmt| by_column = stmt.fetch_columns }
+      end
+
+      assert_equal columns.zip(transposed).to_h, by_column
+      assert_operator columns_allocations, :<, rows_allocations / 2
+    end
+
+    def test_fetch_packed
+      @db.execute("create table metrics (id integer, value real, label text)")
+      @db.execute("insert into metrics values (1, 1.5, 'a'), (-2, null, 'b'), (null, 3.25, 'c')")
+
+      @db.prepare("select * from metrics") do |stmt|
+        packed = stmt.fetch_packed([:integer, :real])
+        assert_equal ["id", "value"], packed.keys
+
+        ids, id_nulls = packed["id"]
+        assert_equal Encoding::BINARY, ids.encoding
+        assert_equal [1, -2, 0], ids.unpack("q<*")
+        assert_equal [0b100], id_nulls.bytes
+
+        values, value_nulls = packed["value"]
+        assert_equal [1.5, 0.0, 3.25], values.unpack("E*")
+        assert_equal [0b010], value_nulls.bytes
+
+        assert_predicate stmt, :done?
+      end
+    end
+
+    def test_fetch_packed_in_chunks
+      @db.prepare("with recursive c(x) as (select 1 union all select x + 1 from c where x < 10) select x from c") do |stmt|
+        data, nulls = stmt.fetch_packed([:integer], 9)["x"]
+        assert_equal((1..9).to_a, data.unpack("q<*"))
+        assert_equal 2, nulls.bytesize
+
+        data, = stmt.fetch_packed([:integer], 9)["x"]
+        assert_equal [10], data.unpack("q<*")
+      end
+    end
+
+    def test_fetch_packed_converts_other_storage_classes
+      @db.prepare("select 2.75, '42'") do |stmt|
+        packed = stmt.fetch_packed([:integer, :float])
+        assert_equal [2], packed["2.75"][0].unpack("q<*")
+        assert_equal [42.0], packed["'42'"][0].unpack("E*")
+      end
+    end
+
+    def test_fetch_packed_unknown_type
+      assert_raises(ArgumentError) { @stmt.fetch_packed([:text]) }
+      assert_raises(TypeError) { @stmt.fetch_packed(:integer) }
+    end
+
+    def test_execute_many
+      @db.execute("create table foo (a integer, b text)")
+      stmt = @db.prepare("insert into foo values (?, ?)")
+
+      assert_equal 3, stmt.execute_many([[1, "one"], [2, "two"], [3, nil]])
+      assert_equal [[1, "one"], [2, "two"], [3, nil]], @db.execute("select * from foo")
+    ensure
+      stmt&.close
+    end
+
+    def test_execute_many_named_and_single_values
+      @db.execute("create table foo (a integer, b text)")
+
+      @db.prepare("insert into foo values (:a, :b)") do |stmt|
+        assert_equal 2, stmt.execute_many([{a: 1, b: "one"}, {a: 2}])
+      end
+      @db.prepare("insert into foo (a) values (?)") do |stmt|
+        assert_equal 2, stmt.execute_many([3, 4])
+      end
+
+      assert_equal [[1, "one"], [2, nil], [3, nil], [4, nil]], @db.execute("select * from foo")
+    end
+
+    def test_execute_many_enumerable
+      @db.execute("create table foo (a integer)")
+      @db.prepare("insert into foo values (?)") do |stmt|
+        assert_equal 5, stmt.execute_many((1..5).lazy.map { |i| [i] })
+        assert_equal 0, stmt.execute_many([])
+      end
+      assert_equal 15, @db.get_first_value("select sum(a) from foo")
+    end
+
+    def test_execute_many_counts_only_changes
+      @db.execute("create table foo (a integer)")
+      @db.execute("insert into foo values (1), (1), (2)")
+
+      @db.prepare("update foo set a = a + 10 where a = ?") do |stmt|
+        assert_equal 3, stmt.execute_many([[1], [2], [3]])
+      end
+      @db.prepare("select * from foo where a = ?") do |stmt|
+        assert_equal 0, stmt.execute_many([[11]])
+      end
+    end
+
+    def test_execute_many_error
+      @db.execute("create table foo (a integer primary key)")
+      stmt = @db.prepare("insert into foo values (?)")
+
+      assert_raises(SQLite3::ConstraintException) { stmt.execute_many([[1], [2], [1], [3]]) }
+      assert_equal [[1], [2]], @db.execute("select * from foo")
+      refute_predicate @db, :transaction_active?
+
+      assert_equal 1, stmt.execute_many([[3]])
+    ensure
+      stmt&.close
+    end
+
+    def test_execute_many_transaction
+      @db.execute("create table foo (a integer primary key)")
+
+      @db.prepare("insert into foo values (?)") do |stmt|
+        assert_equal 2, stmt.execute_many([[1], [2]], transaction: true)
+        assert_raises(SQLite3::ConstraintException) do
+          stmt.execute_many([[3], [1]], transaction: :immediate)
+        end
+      end
+
+      assert_equal [[1], [2]], @db.execute("select * from foo")
+      refute_predicate @db, :transaction_active?
+    end
+
+    def test_execute_many_savepoint
+      @db.execute("create table foo (a integer primary key)")
+
+      @db.transaction do
+        @db.prepare("insert into foo values (?)") do |stmt|
+          assert_equal 1, stmt.execute_many([[1]], transaction: :savepoint)
+          assert_raises(SQLite3::ConstraintException) do
+            stmt.execute_many([[2], [1]], transaction: :savepoint)
+          end
+        end
+        assert_predicate @db, :transaction_active?
+      end
+
+      assert_equal [[1]], @db.execute("select * from foo")
+    end
+
+    def test_execute_many_savepoint_rolls_back_on_any_exit
+      @db.execute("create table foo (a integer primary key)")
+
+      @db.transaction do
+        @db.prepare("insert into foo values (?)") do |stmt|
+          rows = Enumerator.new do |y|
+            y << [1]
+            raise Interrupt
+          end
+          assert_raises(Interrupt) { stmt.execute_many(rows, transaction: :savepoint) }
+
+          rows = Enumerator.new do |y|
+            y << [2]
+            throw :stop
+          end
+          catch(:stop) { stmt.execute_many(rows, transaction: :savepoint) }
+        end
+        assert_predicate @db, :transaction_active?
+      end
+
+      assert_empty @db.execute("select * from foo")
+    end
+
+    def test_execute_many_allocates_less_than_execute
+      @db.execute("create table foo (a integer, b integer)")
+      rows = Array.new(100) { |i| [i, i * 2] }
+      stmt = @db.prepare("insert into foo values (?, ?)")
+      stmt.execute_many(rows.first(2))
+
+      per_row = count_allocations { rows.each { |row| stmt.execute(*row) } }
+      many = count_allocations { stmt.execute_many(rows) }
+
+      assert_operator many, :<, per_row / 10
+    ensure
+      stmt&.close
+    end
+
+    def test_step_many_zero_rows
+      assert_empty @stmt.step_many(0)
+      refute_predicate @stmt, :done?
+      assert_equal [["foo"]], @stmt.step_many(10)
+    end
+
+    def test_step_many_negative
+      assert_raises(ArgumentError) { @stmt.step_many(-1) }
+    end
+
+    def test_step_many_closed
+      @stmt.close
+      assert_raises(SQLite3::Exception) { @stmt.step_many(1) }
+    end
+
+    def test_step_many_error_resets
+      @db.define_function("fail_on_two") { |x| (x == 2) ? raise(ArgumentError) : x }
+      stmt = @db.prepare("select fail_on_two(x) from (select 1 as x union all select 2)")
+
+      assert_raises(ArgumentError) { stmt.step_many(10) }
+      refute_predicate stmt, :done?
+    ensure
+      stmt&.close
+    end
+
+    def test_each_more_rows_than_batch
+      count = SQLite3::Statement::BATCH_SIZE * 2 + 1
+      stmt = @db.prepare("with recursive c(x) as (select 1 union all select x + 1 from c where x < ?) select x from c")
+      stmt.bind_param(1, count)
+
+      assert_equal((1..count).map { |x| [x] }, stmt.to_a)
+    ensure
+      stmt&.close
+    end
+
+    def test_each_leaves_the_statement_after_the_last_row_yielded
+      stmt = @db.prepare("with recursive c(x) as (select 1 union all select x + 1 from c where x < 300) select x from c")
+
+      stmt.each { break }
+      assert_equal [2], stmt.step
+      assert_equal [[3], [4]], stmt.first(2)
+      assert_equal [6], stmt.each(lazy: true).find { |row| row[0] == 6 }.to_a
+      assert_equal [7], stmt.step
+      assert_equal 293, stmt.to_a.length
+      assert_predicate stmt, :done?
+    ensure
+      stmt&.close
+    end
+
+    def test_declared_types_fall_back_when_values_differ
+      @db.execute("create table loose (i integer, r real, t text, b blob)")
+      @db.execute("insert into loose values (1, 1.5, 'text', x'00')")
+      @db.execute("insert into loose values ('one', 'x', 2, 'not a blob')")
+      @db.execute("insert into loose values (null, null, null, null)")
+
+      rows = @db.execute("select * from loose")
+      assert_equal [[1, 1.5, "text", "\x00".b], ["one", "x", "2", "not a blob"], [nil, nil, nil, nil]], rows
+      assert_equal Encoding::BINARY, rows[0][3].encoding
+      assert_equal Encoding::UTF_8, rows[1][3].encoding
+    end
+
+    def test_declared_types_of_outer_joins
+      @db.execute("create table parents (id integer primary key) strict")
+      @db.execute("create table children (parent_id integer not null, name text not null) strict")
+      @db.execute("insert into parents values (1), (2)")
+      @db.execute("insert into children values (1, 'child')")
+
+      rows = @db.execute("select p.id, c.parent_id, c.name from parents p left join children c on c.parent_id = p.id order by p.id")
+      assert_equal [[1, 1, "child"], [2, nil, nil]], rows
+    end
+
+    def test_declared_text_has_its_coderange_computed
+      require "objspace"
+      @db.execute("create table texts (t text, u)")
+      @db.execute("insert into texts values (?, ?)", ["h\u00e9llo", "h\u00e9llo"])
+      @db.execute("insert into texts values (cast(x'ff' as text), 'ascii')")
+
+      declared, undeclared = @db.execute("select t, u from texts").first
+      assert_match(/"coderange":"valid"/, ObjectSpace.dump(declared))
+      assert_match(/"coderange":"unknown"/, ObjectSpace.dump(undeclared))
+
+      broken = @db.execute("select t from texts where u = 'ascii'").first.first
+      refute_predicate broken, :valid_encoding?
+    end
+
+    def test_step_into
+      stmt = @db.prepare("select 1, 'two' union all select 3, 'four'")
+      row = [:stale, :values, :extra]
+
+      assert_same row, stmt.step_into(row)
+      assert_equal [1, "two"], row
+      stmt.step_into(row)
+      assert_equal [3, "four"], row
+      assert_nil stmt.step_into(row)
+      assert_equal [3, "four"], row
+
+      assert_raises(FrozenError) { stmt.reset!.step_into([].freeze) }
+      assert_raises(TypeError) { stmt.step_into(nil) }
+    ensure
+      stmt&.close
+    end
+
+    def test_each_reuse_row
+      count = SQLite3::Statement::BATCH_SIZE * 2 + 1
+      stmt = @db.prepare("with recursive c(x) as (select 1 union all select x + 1 from c where x < ?) select x, 'row ' || x from c")
+      stmt.bind_param(1, count)
+
+      rows = []
+      objects = []
+      stmt.each(reuse_row: true) do |row|
+        rows << row.dup
+        objects << row
+      end
+
+      assert_equal((1..count).map { |x| [x, "row #{x}"] }, rows)
+      assert_equal 1, objects.uniq(&:object_id).length
+      refute_predicate objects.first, :frozen?
+    ensure
+      stmt&.close
+    end
+
+    def test_each_reuse_row_and_lazy_cannot_be_combined
+      assert_raises(ArgumentError) { @stmt.each(lazy: true, reuse_row: true) {} }
+    end
+
+    # Stands in for a GC-count benchmark of a long scan: reusing the row makes
+    # allocation (and so GC) independent of the number of rows.
+    def test_each_reuse_row_does_not_allocate_per_row
+      count = 10_000
+      sql = "with recursive c(x) as (select 1 union all select x + 1 from c where x < ?) select x, x * 2 from c"
+      stmt = @db.prepare(sql)
+
+      stmt.bind_param(1, count)
+      fresh = count_allocations { stmt.each { |row| row } }
+      stmt.reset!
+      reused = count_allocations { stmt.each(reuse_row: true) { |row| row } }
+
+      assert_operator fresh, :>=, count
+      assert_operator reused, :<, 10
+    ensure
+      stmt&.close
+    end
+
+    def test_each_prefetched
+      count = 1000
+      stmt = @db.prepare(<<~SQL)
+        with recursive c(x) as (select 1 union all select x + 1 from c where x < ?)
+        select x, x / 4.0, 'row ' || x, cast('blob ' || x as blob), nullif(x % 2, 1) from c
+      SQL
+      stmt.bind_param(1, count)
+      expected = stmt.each.to_a
+      stmt.reset!
+
+      rows = []
+      assert_same stmt, stmt.each_prefetched(batch: 7, depth: 3) { |row| rows << row }
+      assert_equal expected, rows
+      assert_equal count, rows.length
+      assert(rows.all?(&:frozen?))
+      assert_equal Encoding::ASCII_8BIT, rows.first[3].encoding
+      assert_predicate stmt, :done?
+      assert_empty stmt.each_prefetched.to_a
+
+      stmt.reset!
+      assert_equal expected.first(3), stmt.each_prefetched(batch: 2).first(3)
+      stmt.reset!
+      assert_equal expected, stmt.each_prefetched(batch: 1, depth: 1).to_a
+    ensure
+      stmt&.close
+    end
+
+    def test_each_prefetched_stays_at_most_depth_batches_ahead
+      sql = "with recursive c(x) as (select 1 union all select x + 1 from c where x < 1000) select x from c"
+      reference = @db.prepare(sql)
+      30.times { reference.step }
+      vm_steps = reference.stat(:vm_steps)
+      reference.close
+
+      stmt = @db.prepare(sql)
+      rows = 0
+      stmt.each_prefetched(batch: 10, depth: 2) do |row|
+        rows += 1
+        next unless row == [1]
+
+        # the first batch was handed over before it was yielded, so two more fill up
+        deadline = Process.clock_gettime(Process::CLOCK_MONOTONIC) + 5
+        Thread.pass until stmt.stat(:vm_steps) >= vm_steps || Process.clock_gettime(Process::CLOCK_MONOTONIC) > deadline
+        sleep(0.02)
+        assert_equal vm_steps, stmt.stat(:vm_steps)
+      end
+      assert_equal 1000, rows
+    ensure
+      stmt&.close
+    end
+
+    def test_each_prefetched_interrupts_the_worker_when_left_early
+      stmt = @db.prepare(<<~SQL)
+        with recursive c(x) as (select 1 union all select x + 1 from c where x < 1000000000)
+        select x from c where x = 1 or x % 500000000 = 0
+      SQL
+
+      started = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+      assert_equal [[1]], stmt.each_prefetched(batch: 1, depth: 1).first(1)
+      assert_operator Process.clock_gettime(Process::CLOCK_MONOTONIC) - started, :<, 2
+
+      # the statement was reset
+      assert_equal [1], stmt.step
+    ensure
+      stmt&.close
+    end
+
+    def test_each_prefetched_cleans_up_when_the_wait_for_the_worker_is_interrupted
+      Dir.mktmpdir do |dir|
+        path = File.join(dir, "prefetch.db")
+        db = SQLite3::Database.new(path)
+        db.execute("create table items (x integer)")
+        db.execute("insert into items values (1), (2)")
+        holder = SQLite3::Database.new(path)
+        holder.execute("begin exclusive")
+
+        # the worker waits for the lock in SQLite's busy handler, which isn't
+        # interrupted, so the wait for the worker outlasts the second raise
+        db.busy_timeout = 1000
+        stmt = db.prepare("select x from items")
+        caller = Thread.new do
+          Thread.current.report_on_exception = false
+          stmt.each_prefetched {}
+        end
+        sleep(0.1)
+        caller.raise(RuntimeError, "stop")
+        sleep(0.1)
+        caller.raise(RuntimeError, "stop again")
+
+        # the second one is raised from the ensure clause, once the worker ended
+        error = assert_raises(RuntimeError) { caller.join }
+        assert_equal "stop again", error.message
+        holder.rollback
+        stmt.reset!
+        assert_equal 2, stmt.each_prefetched.count
+      ensure
+        stmt&.close
+        holder&.close
+        db&.close
+      end
+    end
+
+    def test_each_prefetched_block_may_use_the_connection
+      @db.execute("create table log (x integer)")
+      stmt = @db.prepare("with recursive c(x) as (select 1 union all select x + 1 from c where x < 500) select x from c")
+      stmt.each_prefetched(batch: 16) { |row| @db.execute("insert into log values (?)", row) }
+      assert_equal 500, @db.get_first_value("select count(*) from log")
+      stmt.close
+
+      # with a Ruby function the statement is stepped on this thread, as a
+      # worker in the function would wait for the GVL held by the block
+      @db.define_function("twice") { |x| x * 2 }
+      stmt = @db.prepare("with recursive c(x) as (select 1 union all select x + 1 from c where x < 500) select twice(x) from c")
+      stmt.each_prefetched(batch: 16) { |row| @db.execute("insert into log values (?)", row) }
+      assert_equal 1000, @db.get_first_value("select count(*) from log")
+      assert_equal 501 * 500, @db.get_first_value("select sum(x) from log where rowid > 500")
+    ensure
+      stmt&.close
+    end
+
+    def test_each_prefetched_errors
+      stmt = @db.prepare("with recursive c(x) as (select 1 union all select x + 1 from c where x < 100) select abs(x - 50 + -9223372036854775807 - 1) from c where x >= 48")
+      rows = []
+      assert_raises(SQLite3::SQLException) { stmt.each_prefetched(batch: 1) { |row| rows << row } }
+      assert_equal 2, rows.length
+      refute_predicate stmt, :done?
+
+      @db.create_function("fail_at", 1) do |func, x|
+        raise ArgumentError, "failed at #{x}" if x == 5
+        func.result = x
+      end
+      stmt = @db.prepare("with recursive c(x) as (select 1 union all select x + 1 from c where x < 10) select fail_at(x) from c")
+      error = assert_raises(ArgumentError) { stmt.each_prefetched(batch: 2) {} }
+      assert_equal "failed at 5", error.message
+    ensure
+      stmt&.close
+    end
+
+    def test_each_prefetched_statement_is_in_use
+      stmt = @db.prepare("with recursive c(x) as (select 1 union all select x + 1 from c where x < 1000) select x from c")
+
+      stmt.each_prefetched do
+        assert_raises(SQLite3::Exception) { stmt.reset! }
+        assert_raises(SQLite3::Exception) { stmt.step }
+        assert_raises(SQLite3::Exception) { stmt.each_prefetched {} }
+        assert_raises(SQLite3::Exception) { stmt.close }
+        break
+      end
+
+      stmt.reset!
+      assert_equal 1000, stmt.each_prefetched.count
+      assert_raises(ArgumentError) { stmt.each_prefetched(batch: 0) {} }
+      assert_raises(ArgumentError) { stmt.each_prefetched(depth: 0) {} }
+      stmt.close
+      assert_raises(SQLite3::Exception) { stmt.each_prefetched {} }
+    end
+
     def test_column_count
       assert_equal 1, @stmt.column_count
     end
@@ -0,0 +1,140 @@
+require "helper"
+
+module SQLite3
+  class TestStatementCache < SQLite3::TestCase
+    def setup
+      @db = SQLite3::Database.new(":memory:")
+      @db.execute("create table foo (a integer, b text)")
+      @db.execute("insert into foo values (1, 'one'), (2, 'two')")
+      @db.clear_statement_cache
+    end
+
+    def teardown
+      @db.close unless @db.closed?
+    end
+
+    def test_default_size
+      assert_equal SQLite3::Database::STATEMENT_CACHE_SIZE, @db.statement_cache_size
+    end
+
+    def test_database_option
+      db = SQLite3::Database.new(":memory:", statement_cache_size: 2)
+      assert_equal 2, db.statement_cache_size
+    ensure
+      db&.close
+    end
+
+    def test_negative_size
+      assert_raises(ArgumentError) { @db.statement_cache_size = -1 }
+    end
+
+    def test_hits_and_misses
+      before = @db.statement_cache_stats
+
+      3.times { assert_equal [[1, "one"]], @db.execute("select * from foo where a = ?", [1]) }
+
+      stats = @db.statement_cache_stats
+      assert_equal 1, stats[:misses] - before[:misses]
+      assert_equal 2, stats[:hits] - before[:hits]
+      assert_equal 1, stats[:size]
+    end
+
+    def test_least_recently_used_statement_is_evicted
+      @db.statement_cache_size = 2
+      @db.execute("select 1")
+      @db.execute("select 2")
+      @db.execute("select 1")
+      @db.execute("select 3")
+
+      stats = @db.statement_cache_stats
+      assert_equal 1, stats[:evictions]
+      assert_equal 2, stats[:size]
+
+      hits = stats[:hits]
+      @db.execute("select 1")
+      assert_equal hits + 1, @db.statement_cache_stats[:hits]
+      @db.execute("select 2")
+      assert_equal hits + 1, @db.statement_cache_stats[:hits]
+    end
+
+    def test_shrinking_the_cache
+      3.times { |i| @db.execute("select #{i}") }
+      @db.statement_cache_size = 1
+      assert_equal 1, @db.statement_cache_stats[:size]
+    end
+
+    def test_disabled
+      @db.statement_cache_size = 0
+      before = @db.statement_cache_stats
+
+      2.times { @db.execute("select 1") }
+      assert_equal before, @db.statement_cache_stats
+    end
+
+    def test_get_first_value_and_pragmas_use_the_cache
+      2.times do
+        assert_equal 2, @db.get_first_value("select count(*) from foo")
+        @db.user_version
+        @db.table_info("foo")
+      end
+
+      assert_equal 3, @db.statement_cache_stats[:hits]
+    end
+
+    def test_bindings_are_cleared_on_check_in
+      assert_equal [[1]], @db.execute("select ?", [1])
+      assert_equal [[nil]], @db.execute("select ?")
+    end
+
+    def test_statements_are_reset_on_check_in
+      @db.execute("select * from foo") { break }
+      @db.execute("drop table foo")
+      assert_empty @db.execute("select name from sqlite_master")
+    end
+
+    def test_exceptions_leave_the_statement_reusable
+      assert_raises(RuntimeError) do
+        @db.execute("select * from foo") { raise "boom" }
+      end
+      assert_equal [[1, "one"], [2, "two"]], @db.execute("select * from foo")
+    end
+
+    def test_nested_use_of_the_same_sql
+      rows = []
+      @db.execute("select a from foo") do |(a)|
+        rows << [a, @db.execute("select a from foo").length]
+      end
+
+      assert_equal [[1, 2], [2, 2]], rows
+      assert_equal 1, @db.statement_cache_stats[:size]
+    end
+
+    def test_schema_changes
+      @db.results_as_hash = true
+      assert_equal({"a" => 1}, @db.execute("select * from foo limit 1").first.slice("a"))
+
+      @db.execute("alter table foo rename column a to c")
+      assert_equal({"c" => 1, "b" => "one"}, @db.execute("select * from foo limit 1").first)
+      assert_equal 1, @db.get_first_value("select * from foo")
+    end
+
+    def test_cached_statements_restart_the_statement_timeout
+      @db.statement_timeout = 1_000
+      3.times { assert_equal [[2]], @db.execute("select count(*) from foo") }
+    ensure
+      @db.statement_timeout = 0
+    end
+
+    def test_close_empties_the_cache
+      @db.execute("select 1")
+      @db.close
+      assert_equal 0, @db.statement_cache_stats[:size]
+    end
+
+    def test_discard_empties_the_cache
+      @db.execute("select 1")
+      @db.send(:discard)
+      assert_equal 0, @db.statement_cache_stats[:size]
+    end
+  end
+end
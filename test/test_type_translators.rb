@@ -0,0 +1,213 @@
+require "helper"
+require "date"
+require "bigdecimal"
+require "time"
+
+module SQLite3
+  class TestTypeTranslators < SQLite3::TestCase
+    def setup
+      @db = SQLite3::Database.new(":memory:")
+      @db.execute(<<~SQL)
+        create table events (
+          id integer primary key, at datetime, on_day date, done boolean, price decimal(10, 2), note text
+        )
+      SQL
+    end
+
+    def teardown
+      @db.close unless @db.closed?
+    end
+
+    def test_disabled_by_default
+      assert_nil @db.type_translators
+      @db.execute("insert into events values (1, '2024-02-29 12:34:56', '2024-02-29', 1, '1.10', 'x')")
+      assert_equal [[1, "2024-02-29 12:34:56", "2024-02-29", 1, 1.1, "x"]], @db.execute("select * from events")
+    end
+
+    def test_builtin_translators
+      @db.type_translators = true
+      @db.execute("insert into events values (1, '2024-02-29 12:34:56', '2024-02-29', 1, '1.10', 'x')")
+
+      id, at, on_day, done, price, note = @db.execute("select * from events").first
+      assert_equal 1, id
+      assert_equal Time.utc(2024, 2, 29, 12, 34, 56), at
+      assert_predicate at, :utc?
+      assert_equal Date.new(2024, 2, 29), on_day
+      assert_equal true, done
+      assert_equal BigDecimal("1.10"), price
+      assert_kind_of BigDecimal, price
+      assert_equal "x", note
+    end
+
+    def test_database_option
+      db = SQLite3::Database.new(":memory:", type_translators: true)
+      assert_equal SQLite3::Database::TYPE_TRANSLATORS, db.type_translators
+    ensure
+      db&.close
+    end
+
+    def test_time_formats
+      @db.type_translators = {"datetime" => :time}
+      {
+        "2024-01-02" => Time.utc(2024, 1, 2),
+        "2024-01-02 03:04" => Time.utc(2024, 1, 2, 3, 4),
+        "2024-01-02T03:04:05" => Time.utc(2024, 1, 2, 3, 4, 5),
+        "2024-01-02 03:04:05.250" => Time.utc(2024, 1, 2, 3, 4, 5.25r),
+        "2024-01-02 03:04:05Z" => Time.utc(2024, 1, 2, 3, 4, 5),
+        "2024-01-02 03:04:05+05:30" => Time.new(2024, 1, 2, 3, 4, 5, "+05:30"),
+        "2024-01-02T03:04:05-0800" => Time.new(2024, 1, 2, 3, 4, 5, "-08:00"),
+        "1969-12-31 23:59:59" => Time.utc(1969, 12, 31, 23, 59, 59)
+      }.each do |text, expected|
+        @db.execute("delete from events")
+        @db.execute("insert into events (at) values (?)", [text])
+        time = @db.get_first_value("select at from events")
+        assert_equal expected, time, text
+        assert_equal expected.utc_offset, time.utc_offset, text
+      end
+    end
+
+    def test_time_from_sqlite_and_unix_time
+      @db.type_translators = true
+      @db.execute("insert into events (id, at) values (1, datetime('2024-03-04 05:06:07')), (2, 1700000000)")
+
+      assert_equal [Time.utc(2024, 3, 4, 5, 6, 7), Time.at(1_700_000_000).utc],
+        @db.execute("select at from events order by id").flatten
+    end
+
+    def test_values_that_do_not_parse_are_returned_unchanged
+      @db.type_translators = true
+      @db.execute("insert into events values (1, 'yesterday', '2023-02-29', 'maybe', 'lots', null)")
+      @db.execute("insert into events values (2, null, null, null, null, null)")
+
+      assert_equal [[1, "yesterday", "2023-02-29", "maybe", "lots", nil], [2, nil, nil, nil, nil, nil]],
+        @db.execute("select * from events order by id")
+    end
+
+    def test_booleans
+      @db.type_translators = true
+      %w[t true TRUE 1 yes f false 0 no].each { |text| @db.execute("insert into events (done) values (?)", [text]) }
+      @db.execute("insert into events (done) values (0), (2), (0.0)")
+
+      assert_equal [true, true, true, true, true, false, false, false, false, false, true, false],
+        @db.execute("select done from events order by id").flatten
+    end
+
+    def test_decimals
+      @db.type_translators = true
+      @db.execute("insert into events (price) values ('19.99'), (42), (0.1 + 0.2)")
+      # a type name containing "text" has TEXT affinity, so the digits are kept
+      @db.execute("create table exact (amount money_text)")
+      @db.execute("insert into exact values ('12345678901234567890.123456789')")
+      @db.add_type_translator("money_text", :decimal)
+
+      assert_equal [BigDecimal("19.99"), BigDecimal("42"), BigDecimal("0.30000000000000004")],
+        @db.execute("select price from events order by id").flatten
+      assert_equal BigDecimal("12345678901234567890.123456789"), @db.get_first_value("select amount from exact")
+    end
+
+    def test_custom_translators
+      @db.execute("create table shapes (center point, label TEXT)")
+      @db.execute("insert into shapes values ('1,2', 'a'), (null, 'b')")
+
+      @db.add_type_translator("POINT") { |text| text.split(",").map(&:to_i) }
+      @db.add_type_translator("text", ->(text) { text.upcase })
+
+      assert_equal [[[1, 2], "A"], [nil, "B"]], @db.execute("select * from shapes")
+      assert_equal [[1, 2], "A"], @db.execute_fast("select * from shapes").first
+    end
+
+    def test_statement_translators
+      @db.execute("insert into events (id, done) values (1, 1)")
+
+      @db.prepare("select done from events") do |stmt|
+        assert_nil stmt.type_translators
+        stmt.type_translators = {"BOOLEAN" => :boolean}
+        assert_equal({"boolean" => :boolean}, stmt.type_translators)
+        assert_equal [[true]], stmt.to_a
+
+        stmt.reset!
+        stmt.type_translators = nil
+        assert_equal [[1]], stmt.to_a
+      end
+    end
+
+    def test_cached_statements_follow_the_database
+      @db.execute("insert into events (id, done) values (1, 1)")
+      assert_equal 1, @db.get_first_value("select done from events")
+
+      @db.type_translators = true
+      assert_equal true, @db.get_first_value("select done from events")
+
+      @db.type_translators = nil
+      assert_equal 1, @db.get_first_value("select done from events")
+    end
+
+    def test_reused_statement_follows_schema_changes
+      @db.type_translators = true
+      @db.execute("create table t (a integer, b date)")
+      @db.execute("insert into t values (1, '2024-02-29')")
+
+      stmt = @db.prepare("select * from t")
+      assert_equal [[1, Date.new(2024, 2, 29)]], stmt.to_a
+
+      # Same column count, other declared types
+      @db.execute("drop table t")
+      @db.execute("create table t (a date, b text)")
+      @db.execute("insert into t values ('2024-02-29', '2024-02-29')")
+      stmt.reset!
+      assert_equal [[Date.new(2024, 2, 29), "2024-02-29"]], stmt.to_a
+
+      @db.execute("alter table t rename column b to c")
+      stmt.reset!
+      assert_equal({"a" => Date.new(2024, 2, 29), "c" => "2024-02-29"}, stmt.step_hash)
+    ensure
+      stmt&.close
+    end
+
+    def test_every_row_form
+      @db.type_translators = true
+      @db.execute("insert into events (id, done) values (1, 1)")
+
+      @db.prepare("select id, done from events") do |stmt|
+        assert_equal [1, true], stmt.step
+        stmt.reset!
+        assert_equal({"id" => 1, "done" => true}, stmt.step_hash)
+        stmt.reset!
+        assert_equal({"id" => [1], "done" => [true]}, stmt.fetch_columns)
+        stmt.reset!
+        assert_equal [1, true], stmt.step_into([])
+      end
+    end
+
+    def test_invalid_registries
+      assert_raises(ArgumentError) { @db.type_translators = {"date" => :nope} }
+      assert_raises(ArgumentError) { @db.type_translators = {"date" => 42} }
+      assert_raises(TypeError) { @db.type_translators = "date" }
+    end
+
+    # Stands in for a benchmark against translating rows in Ruby: the native
+    # translators produce the same values without allocating the intermediate
+    # Strings, or running a parser, per cell.
+    def test_native_translation_allocates_less_than_ruby_post_processing
+      @db.execute(<<~SQL)
+        WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM c WHERE x < 1000)
+        INSERT INTO events (at, on_day, done) SELECT datetime(x * 3600, 'unixepoch'), date(x * 86400, 'unixepoch'), x % 2 FROM c
+      SQL
+      sql = "select at, on_day, done from events"
+
+      ruby = nil
+      in_ruby = count_allocations do
+        ruby = @db.execute(sql).map do |at, on_day, done|
+          [Time.strptime("#{at} UTC", "%Y-%m-%d %H:%M:%S %Z"), Date.iso8601(on_day), done == 1]
+        end
+      end
+
+      @db.type_translators = true
+      native = nil
+      in_c = count_allocations { native = @db.execute(sql) }
+
+      assert_equal ruby, native
+      assert_operator in_c * 2, :<, in_ruby
+    end
+  end
+end
@@ -0,0 +1,140 @@
+require "helper"
+require "tmpdir"
+
+module SQLite3
+  class TestWriteQueue < SQLite3::TestCase
+    def setup
+      @dir = Dir.mktmpdir
+      @path = File.join(@dir, "queue.db")
+      @db = SQLite3::Database.new(@path)
+      @db.journal_mode = "wal"
+      @db.execute("create table items (id integer primary key, name text unique)")
+    end
+
+    def teardown
+      @db.close unless @db.closed?
+      FileUtils.remove_entry(@dir)
+    end
+
+    def test_submit
+      queue = @db.write_queue
+      assert_same queue, @db.write_queue
+
+      assert_equal [], queue.submit("insert into items (name) values (?)", ["a"])
+      assert_equal 2, queue.submit { |db| db.execute("insert into items (name) values ('b')") && db.changes + 1 }
+      refute_predicate @db, :transaction_active?
+
+      SQLite3::Database.new(@path, readonly: true) do |other|
+        assert_equal %w[a b], other.execute("select name from items order by id").map(&:first)
+      end
+      assert_equal({batches: 2, writes: 2, largest_batch: 1, pending: 0}, queue.stats)
+      assert_raises(ArgumentError) { queue.submit }
+      assert_raises(ArgumentError) { queue.submit("select 1") {} }
+    end
+
+    def test_writes_that_arrive_during_a_commit_share_the_next_one
+      queue = SQLite3::WriteQueue.new(@db, window: 0)
+      started = Queue.new
+      release = Queue.new
+
+      first = Thread.new do
+        queue.submit do |db|
+          started << true
+          release.pop
+          db.execute("insert into items (name) values ('first')")
+        end
+      end
+      started.pop
+
+      others = Array.new(10) { |i| Thread.new { queue.submit("insert into items (name) values (?)", [i.to_s]) } }
+      Thread.pass until queue.stats[:pending] == 10
+      release << true
+      [first, *others].each(&:join)
+
+      assert_equal({batches: 2, writes: 11, largest_batch: 10, pending: 0}, queue.stats)
+      assert_equal 11, @db.get_first_value("select count(*) from items")
+    end
+
+    def test_a_full_batch_does_not_wait_for_the_window
+      queue = SQLite3::WriteQueue.new(@db, window: 10, batch_size: 3)
+      started = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+      threads = Array.new(3) { |i| Thread.new { queue.submit("insert into items (name) values (?)", [i.to_s]) } }
+      threads.each(&:join)
+
+      assert_operator Process.clock_gettime(Process::CLOCK_MONOTONIC) - started, :<, 5
+      assert_equal({batches: 1, writes: 3, largest_batch: 3, pending: 0}, queue.stats)
+    end
+
+    def test_a_failing_write_is_rolled_back_alone
+      queue = SQLite3::WriteQueue.new(@db, window: 0)
+      started = Queue.new
+      release = Queue.new
+      blocker = Thread.new do
+        queue.submit do
+          started << true
+          release.pop
+        end
+      end
+      started.pop
+
+      writes = [
+        -> { queue.submit("insert into items (name) values ('kept')") },
+        lambda do
+          queue.submit do |db|
+            db.execute("insert into items (name) values ('discarded')")
+            raise "boom"
+          end
+        end,
+        -> { queue.submit("insert into items (name) values ('kept')") }
+      ].each_with_index.map do |write, i|
+        thread = Thread.new do
+          write.call
+        rescue => e
+          e
+        end
+        Thread.pass until queue.stats[:pending] == i + 1
+        thread
+      end
+      release << true
+      blocker.join
+
+      results = writes.map(&:value)
+      assert_equal [], results[0]
+      assert_equal "boom", results[1].message
+      assert_kind_of SQLite3::ConstraintException, results[2]
+      assert_equal [["kept"]], @db.execute("select name from items")
+      assert_equal 2, queue.stats[:batches]
+    end
+
+    def test_a_failed_commit_fails_every_write_in_the_batch
+      @db.foreign_keys = true
+      @db.execute("create table children (parent integer references items (id) deferrable initially deferred)")
+      queue = SQLite3::WriteQueue.new(@db, window: 0)
+
+      error = assert_raises(SQLite3::ConstraintException) { queue.submit("insert into children values (42)") }
+      assert_match(/FOREIGN KEY/, error.message)
+      refute_predicate @db, :transaction_active?
+      assert_equal 0, @db.get_first_value("select count(*) from children")
+
+      queue.submit("insert into items (name) values ('after')")
+      assert_equal 1, @db.get_first_value("select count(*) from items")
+    end
+
+    # Stands in for a throughput benchmark: writes submitted concurrently are
+    # committed in far fewer transactions than there are writes.
+    def test_concurrent_writes_are_coalesced
+      queue = SQLite3::WriteQueue.new(@db, window: 0.005)
+      threads = Array.new(8) do |t|
+        Thread.new do
+          25.times { |i| queue.submit("insert into items (name) values (?)", ["#{t}-#{i}"]) }
+        end
+      end
+      threads.each(&:join)
+
+      stats = queue.stats
+      assert_equal 200, stats[:writes]
+      assert_equal 200, @db.get_first_value("select count(*) from items")
+      assert_operator stats[:batches], :<, 200
+    end
+  end
+end
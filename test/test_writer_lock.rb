@@ -0,0 +1,145 @@
+require "helper"
+require "tmpdir"
+
+module SQLite3
+  class TestWriterLock < SQLite3::TestCase
+    def setup
+      @dir = Dir.mktmpdir
+      @path = File.join(@dir, "lock.db")
+      @db = SQLite3::Database.new(@path, writer_lock: true)
+      @db.journal_mode = "wal"
+      @db.execute("create table items (id integer primary key, name text)")
+      @connections = [@db]
+    end
+
+    def teardown
+      @connections.each { |db| db.close unless db.closed? }
+      FileUtils.remove_entry(@dir)
+    end
+
+    def connect
+      SQLite3::Database.new(@path, writer_lock: true).tap { |db| @connections << db }
+    end
+
+    def test_connections_to_a_file_share_a_lock
+      other = connect
+      assert_kind_of SQLite3::WriterLock, @db.writer_lock
+      assert_same @db.writer_lock, other.writer_lock
+      refute_same @db.writer_lock, SQLite3::Database.new(File.join(@dir, "other.db"), writer_lock: true).writer_lock
+
+      other.writer_lock = false
+      assert_nil other.writer_lock
+      assert_nil SQLite3::Database.new(@path).tap { |db| @connections << db }.writer_lock
+      assert_raises(ArgumentError) { SQLite3::Database.new(":memory:", writer_lock: true) }
+    end
+
+    def test_write_transactions_hold_the_lock
+      lock = @db.writer_lock
+
+      @db.transaction(:immediate) { assert_predicate lock, :locked? }
+      refute_predicate lock, :locked?
+      assert_raises(RuntimeError) { @db.transaction(:exclusive) { raise "rolled back" } }
+      refute_predicate lock, :locked?
+
+      @db.transaction(:immediate)
+      assert_predicate lock, :locked?
+      @db.commit
+      refute_predicate lock, :locked?
+      @db.transaction("IMMEDIATE")
+      @db.rollback
+      refute_predicate lock, :locked?
+
+      @db.transaction { refute_predicate lock, :locked? }
+      assert_equal 4, lock.stats[:acquisitions]
+    end
+
+    def test_a_transaction_ended_by_sql_releases_the_lock
+      lock = @db.writer_lock
+      other = connect
+
+      @db.transaction(:immediate)
+      @db.execute("commit")
+      refute_predicate lock, :locked?
+
+      @db.transaction(:exclusive)
+      @db.execute_batch("insert into items (name) values ('a'); rollback")
+      refute_predicate lock, :locked?
+
+      @db.transaction(:immediate)
+      @db.prepare("commit").execute
+      @db.transaction(:immediate) { assert_predicate lock, :locked? }
+      refute_predicate lock, :locked?
+
+      other.transaction(:immediate) { other.execute("insert into items (name) values ('b')") }
+      assert_equal ["b"], @db.execute("select name from items").flatten
+    end
+
+    def test_writers_take_turns_in_arrival_order
+      lock = @db.writer_lock
+      order = Queue.new
+      @db.transaction(:immediate)
+
+      writers = Array.new(5) do |i|
+        db = connect
+        db.busy_timeout = 0
+        thread = Thread.new do
+          db.transaction(:immediate) do
+            order << i
+            db.execute("insert into items (name) values (?)", [i.to_s])
+          end
+        end
+        Thread.pass until lock.stats[:queue_depth] == i + 1
+        thread
+      end
+      @db.commit
+      writers.each(&:join)
+
+      assert_equal [0, 1, 2, 3, 4], Array.new(5) { order.pop }
+      stats = lock.stats
+      assert_equal 6, stats[:acquisitions]
+      assert_equal 5, stats[:contended]
+      assert_equal 0, stats[:queue_depth]
+      assert_equal 5, stats[:max_queue_depth]
+      assert_operator stats[:wait_time], :>, 0
+      assert_operator stats[:max_wait_time], :<=, stats[:wait_time]
+    end
+
+    def test_the_lock_is_not_reentrant
+      other = connect
+      @db.transaction(:immediate) do
+        assert_raises(SQLite3::BusyException) { other.transaction(:immediate) }
+        refute_predicate other, :transaction_active?
+      end
+      refute_predicate @db.writer_lock, :locked?
+    end
+
+    def test_a_failed_begin_releases_the_lock
+      @db.execute("begin")
+      assert_raises(SQLite3::SQLException) { @db.transaction(:immediate) }
+      refute_predicate @db.writer_lock, :locked?
+      @db.rollback
+    end
+
+    def test_closing_releases_the_lock
+      other = connect
+      other.transaction(:immediate)
+      other.close
+      refute_predicate @db.writer_lock, :locked?
+      @db.transaction(:immediate) { @db.execute("insert into items (name) values ('after')") }
+    end
+
+    def test_a_waiter_that_gives_up_passes_its_turn_on
+      lock = @db.writer_lock
+      @db.transaction(:immediate)
+      impatient = Thread.new { connect.transaction(:immediate) }
+      Thread.pass until lock.stats[:queue_depth] == 1
+      patient = Thread.new { connect.transaction(:immediate) { :done } }
+      Thread.pass until lock.stats[:queue_depth] == 2
+
+      impatient.kill.join
+      @db.commit
+      assert_equal :done, patient.value
+      refute_predicate lock, :locked?
+    end
+  end
+end